@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "thread_utils.hpp"
+#include "latency_histogram.hpp"
+
+namespace common {
+    struct BenchmarkCfg {
+        //core the measuring thread is pinned to, -1 leaves it where it is
+        int core_id_ = -1;
+        //untimed calls first, so caches, branch predictors and pools are warm
+        size_t warmup_ = 10000;
+        //timed samples, each one TSC interval around batch_ calls
+        size_t samples_ = 100000;
+        //calls per sample, for operations not much longer than the rdtsc() pair around them
+        size_t batch_ = 1;
+    };
+
+    //TSC ticks per sample, reported as ns per call
+    struct BenchmarkResult {
+        std::string name_;
+        size_t batch_ = 1;
+        LatencyHistogram ticks_;
+        uint64_t total_ticks_ = 0;
+    };
+
+    //Microbenchmark runner: run() times a callable with the TSC after a warmup and keeps the per-sample
+    //distribution, add() takes distributions measured elsewhere (e.g. one-way latencies across threads).
+    //Results go out as JSON, one benchmark per line, and can be compared against an earlier run's file.
+    class BenchmarkSuite final {
+    public:
+        explicit BenchmarkSuite(const std::string &name) : name_(name) {
+        }
+
+        BenchmarkSuite() = delete;
+        BenchmarkSuite(const BenchmarkSuite &) = delete;
+        BenchmarkSuite(const BenchmarkSuite &&) = delete;
+        BenchmarkSuite &operator=(const BenchmarkSuite &) = delete;
+        BenchmarkSuite &operator=(const BenchmarkSuite &&) = delete;
+
+        //op(i) is called warmup_ + samples_ * batch_ times with a running index
+        template<typename Op>
+        auto run(const std::string &name, const BenchmarkCfg &cfg, Op &&op) -> const BenchmarkResult & {
+            if (cfg.core_id_ >= 0)
+                ASSERT(setThreadCore(cfg.core_id_), "benchmark " + name + " could not be pinned to core " + std::to_string(cfg.core_id_));
+
+            size_t i = 0;
+            for (; i < cfg.warmup_; ++i)
+                op(i);
+
+            BenchmarkResult result{name, cfg.batch_, {}, 0};
+            for (size_t sample = 0; sample < cfg.samples_; ++sample) {
+                const auto t0 = rdtsc();
+                for (size_t j = 0; j < cfg.batch_; ++j)
+                    op(i++);
+                const auto ticks = rdtsc() - t0;
+                result.ticks_.record(ticks);
+                result.total_ticks_ += ticks;
+            }
+            return add(std::move(result));
+        }
+
+        auto add(BenchmarkResult &&result) -> const BenchmarkResult & {
+            results_.push_back(std::move(result));
+            std::cout << toJson(results_.back()) << std::endl;
+            return results_.back();
+        }
+
+        auto results() const noexcept -> const std::vector<BenchmarkResult> & {
+            return results_;
+        }
+
+        auto tsc() const noexcept -> const TSCClock & {
+            return tsc_;
+        }
+
+        //ns per call at percentile p of the samples
+        auto nsPerOp(const BenchmarkResult &result, double p) const noexcept -> double {
+            return tsc_.ticksToNanos(result.ticks_.percentile(p)) / static_cast<double>(result.batch_);
+        }
+
+        auto toJson(const BenchmarkResult &result) const -> std::string {
+            const auto batch = static_cast<double>(result.batch_);
+            const auto total_ns = tsc_.ticksToNanos(result.total_ticks_);
+            char json[512];
+            snprintf(json, sizeof(json),
+                     "{\"name\":\"%s\",\"batch\":%zu,\"samples\":%lu,\"ns_min\":%.2f,\"ns_p50\":%.2f,\"ns_p90\":%.2f,\"ns_p99\":%.2f,"
+                     "\"ns_p999\":%.2f,\"ns_max\":%.2f,\"ns_mean\":%.2f,\"ops_per_sec\":%.0f}",
+                     result.name_.c_str(), result.batch_, static_cast<unsigned long>(result.ticks_.count()),
+                     tsc_.ticksToNanos(result.ticks_.min()) / batch, nsPerOp(result, 0.5), nsPerOp(result, 0.9), nsPerOp(result, 0.99),
+                     nsPerOp(result, 0.999), tsc_.ticksToNanos(result.ticks_.max()) / batch,
+                     tsc_.ticksToNanos(static_cast<uint64_t>(result.ticks_.mean())) / batch,
+                     total_ns > 0 ? static_cast<double>(result.ticks_.count()) * batch * NANOS_TO_SECS / total_ns : 0.0);
+            return json;
+        }
+
+        auto toJson() const -> std::string {
+            std::stringstream ss;
+            ss << "{\"suite\":\"" << name_ << "\",\"tsc_ghz\":" << tsc_.ghz() << ",\"benchmarks\":[\n";
+            for (size_t i = 0; i < results_.size(); ++i)
+                ss << toJson(results_[i]) << (i + 1 < results_.size() ? ",\n" : "\n");
+            ss << "]}\n";
+            return ss.str();
+        }
+
+        auto writeJson(const std::string &path) const -> bool {
+            std::ofstream file(path);
+            file << toJson();
+            return file.good();
+        }
+
+        //Benchmarks whose p50 in the baseline file, an earlier writeJson(), was beaten by more than tolerance
+        //(0.1 = 10% slower), as "name baseline_ns -> ns". Benchmarks missing on either side are skipped.
+        auto regressions(const std::string &baseline_path, double tolerance) const -> std::vector<std::string> {
+            std::vector<std::string> regressed;
+            std::ifstream file(baseline_path);
+            std::string line;
+            while (std::getline(file, line)) {
+                const auto name = jsonField(line, "name");
+                const auto p50 = jsonField(line, "ns_p50");
+                if (name.empty() || p50.empty())
+                    continue;
+                const auto baseline_ns = std::stod(p50);
+                for (const auto &result : results_) {
+                    const auto ns = nsPerOp(result, 0.5);
+                    if (result.name_ == name && ns > baseline_ns * (1 + tolerance))
+                        regressed.push_back(name + " " + p50 + " -> " + std::to_string(ns));
+                }
+            }
+            return regressed;
+        }
+
+    private:
+        //value of "key": in one line of toJson() output, quotes stripped
+        static auto jsonField(const std::string &line, const std::string &key) -> std::string {
+            const auto start = line.find("\"" + key + "\":");
+            if (start == std::string::npos)
+                return {};
+            auto begin = start + key.size() + 3;
+            if (begin < line.size() && line[begin] == '"')
+                return line.substr(begin + 1, line.find('"', begin + 1) - begin - 1);
+            return line.substr(begin, line.find_first_of(",}", begin) - begin);
+        }
+
+        std::string name_;
+        TSCClock tsc_;
+        std::vector<BenchmarkResult> results_;
+    };
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include "macros.h"
+
+namespace common
+{
+    //Pool of power-of-two sized byte chunks, from min_chunk_size up to max_chunk_size.
+    //Chunks are carved out of slabs which are only allocated when a size class runs dry and are
+    //never returned to the OS, so a connection churning through the server reuses warm pages.
+    //Single threaded: owned by one reactor thread like the sockets drawing from it.
+    class BufferPool final
+    {
+    public:
+        BufferPool(std::size_t min_chunk_size, std::size_t max_chunk_size, std::size_t slab_size = 2 * 1024 * 1024, bool prefault = true)
+            : min_chunk_size_(min_chunk_size), max_chunk_size_(max_chunk_size), slab_size_(slab_size), prefault_(prefault)
+        {
+            ASSERT(min_chunk_size && !(min_chunk_size & (min_chunk_size - 1)), "BufferPool min_chunk_size must be a power of two: " + std::to_string(min_chunk_size));
+            ASSERT(max_chunk_size >= min_chunk_size && !(max_chunk_size & (max_chunk_size - 1)), "BufferPool max_chunk_size must be a power of two >= min_chunk_size: " + std::to_string(max_chunk_size));
+
+            for (auto size = min_chunk_size_; size <= max_chunk_size_; size *= 2)
+                free_lists_.emplace_back();
+        }
+
+        ~BufferPool()
+        {
+            for (auto slab : slabs_)
+                delete[] slab;
+        }
+
+        BufferPool() = delete;
+        BufferPool(const BufferPool &) = delete;
+        BufferPool(const BufferPool &&) = delete;
+        BufferPool &operator=(const BufferPool &) = delete;
+        BufferPool &operator=(const BufferPool &&) = delete;
+
+        //size actually handed out by acquire(size), a power of two
+        auto chunkSize(std::size_t size) const noexcept
+        {
+            auto chunk_size = min_chunk_size_;
+            while (chunk_size < size)
+                chunk_size *= 2;
+            return chunk_size;
+        }
+
+        auto acquire(std::size_t size) noexcept -> char *
+        {
+            const auto chunk_size = chunkSize(size);
+            ASSERT(chunk_size <= max_chunk_size_, "BufferPool request too large: " + std::to_string(size));
+
+            auto &free_list = free_lists_[classIndex(chunk_size)];
+            if (UNLIKELY(free_list.empty()))
+                grow(chunk_size, free_list);
+
+            auto chunk = free_list.back();
+            free_list.pop_back();
+            bytes_in_use_ += chunk_size;
+            return chunk;
+        }
+
+        //size must be the value passed to, or returned by chunkSize() for, the matching acquire()
+        auto release(char *chunk, std::size_t size) noexcept
+        {
+            const auto chunk_size = chunkSize(size);
+            free_lists_[classIndex(chunk_size)].push_back(chunk);
+            bytes_in_use_ -= chunk_size;
+        }
+
+        auto bytesReserved() const noexcept
+        {
+            return bytes_reserved_;
+        }
+
+        auto bytesInUse() const noexcept
+        {
+            return bytes_in_use_;
+        }
+
+        auto maxChunkSize() const noexcept
+        {
+            return max_chunk_size_;
+        }
+
+    private:
+        auto classIndex(std::size_t chunk_size) const noexcept -> size_t
+        {
+            size_t index = 0;
+            for (auto size = min_chunk_size_; size < chunk_size; size *= 2)
+                ++index;
+            return index;
+        }
+
+        auto grow(std::size_t chunk_size, std::vector<char *> &free_list) noexcept -> void
+        {
+            const auto num_chunks = std::max<size_t>(1, slab_size_ / chunk_size);
+            auto slab = new char[num_chunks * chunk_size];
+            ASSERT(slab != nullptr, "BufferPool failed to allocate slab of chunk size: " + std::to_string(chunk_size));
+
+            //take the page faults now rather than on the first recv into a fresh chunk
+            if (prefault_)
+                memset(slab, 0, num_chunks * chunk_size);
+
+            slabs_.push_back(slab);
+            bytes_reserved_ += num_chunks * chunk_size;
+            for (size_t i = num_chunks; i > 0; --i)
+                free_list.push_back(slab + (i - 1) * chunk_size);
+        }
+
+        const size_t min_chunk_size_;
+        const size_t max_chunk_size_;
+        const size_t slab_size_;
+        const bool prefault_;
+
+        std::vector<std::vector<char *>> free_lists_;
+        std::vector<char *> slabs_;
+        size_t bytes_reserved_ = 0;
+        size_t bytes_in_use_ = 0;
+    };
+}
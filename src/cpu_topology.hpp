@@ -0,0 +1,355 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <dirent.h>
+
+#include "macros.h"
+
+namespace common
+{
+    //sentinel used everywhere a thread should not be pinned, same as createAndStartThread(-1, ...)
+    constexpr int UNPINNED_CORE = -1;
+
+    //parse kernel cpu list format, e.g. "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+    inline auto parseCpuList(const std::string &list) noexcept -> std::vector<int>
+    {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+
+        while (std::getline(ss, range, ','))
+        {
+            if (range.empty() || range == "\n")
+                continue;
+
+            const auto dash = range.find('-');
+            const int first = std::atoi(range.substr(0, dash).c_str());
+            const int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash + 1).c_str());
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+
+        return cpus;
+    }
+
+    //first line of a sysfs attribute, empty if the file does not exist (e.g. no nohz_full support)
+    inline auto readSysfsLine(const std::string &path) noexcept -> std::string
+    {
+        std::ifstream file(path);
+        std::string line;
+        if (file.is_open())
+            std::getline(file, line);
+        return line;
+    }
+
+    struct CpuInfo
+    {
+        int cpu_id_ = UNPINNED_CORE;
+        int core_id_ = -1;              //physical core id, unique only within a socket
+        int socket_id_ = -1;            //physical_package_id
+        int numa_node_ = -1;
+        int l2_id_ = -1;                //lowest cpu id sharing this cpu's L2, identifies the L2 domain
+        std::vector<int> siblings_;     //SMT siblings, includes cpu_id_ itself
+        bool isolated_ = false;         //isolcpus=
+        bool nohz_full_ = false;        //nohz_full=
+
+        //physical core key which is unique across sockets
+        auto physicalCore() const noexcept
+        {
+            return siblings_.empty() ? cpu_id_ : siblings_.front();
+        }
+    };
+
+    //Snapshot of /sys/devices/system/cpu taken once at startup, never on the critical path.
+    class CpuTopology final
+    {
+    public:
+        explicit CpuTopology(const std::string &sysfs_root = "/sys/devices/system/cpu")
+        {
+            const auto online = parseCpuList(readSysfsLine(sysfs_root + "/online"));
+            const auto isolated = parseCpuList(readSysfsLine(sysfs_root + "/isolated"));
+            const auto nohz_full = parseCpuList(readSysfsLine(sysfs_root + "/nohz_full"));
+
+            for (const auto cpu_id : online)
+            {
+                const auto cpu_dir = sysfs_root + "/cpu" + std::to_string(cpu_id);
+
+                CpuInfo info;
+                info.cpu_id_ = cpu_id;
+                info.core_id_ = readInt(cpu_dir + "/topology/core_id");
+                info.socket_id_ = readInt(cpu_dir + "/topology/physical_package_id");
+                info.siblings_ = parseCpuList(readSysfsLine(cpu_dir + "/topology/thread_siblings_list"));
+                info.numa_node_ = findNumaNode(cpu_dir);
+                info.l2_id_ = findL2Domain(cpu_dir, cpu_id);
+                info.isolated_ = std::find(isolated.begin(), isolated.end(), cpu_id) != isolated.end();
+                info.nohz_full_ = std::find(nohz_full.begin(), nohz_full.end(), cpu_id) != nohz_full.end();
+
+                if (info.siblings_.empty())
+                    info.siblings_.push_back(cpu_id);
+
+                cpus_.push_back(info);
+            }
+
+            ASSERT(!cpus_.empty(), "CpuTopology found no online cpus under: " + sysfs_root);
+        }
+
+        auto cpus() const noexcept -> const std::vector<CpuInfo> &
+        {
+            return cpus_;
+        }
+
+        auto find(int cpu_id) const noexcept -> const CpuInfo *
+        {
+            for (const auto &cpu : cpus_)
+                if (cpu.cpu_id_ == cpu_id)
+                    return &cpu;
+            return nullptr;
+        }
+
+        auto numSockets() const noexcept
+        {
+            return countDistinct([](const CpuInfo &cpu) { return cpu.socket_id_; });
+        }
+
+        auto numNumaNodes() const noexcept
+        {
+            return countDistinct([](const CpuInfo &cpu) { return cpu.numa_node_; });
+        }
+
+        auto numPhysicalCores() const noexcept
+        {
+            return countDistinct([](const CpuInfo &cpu) { return cpu.physicalCore(); });
+        }
+
+        auto toString() const
+        {
+            std::stringstream ss;
+            ss << "CpuTopology[cpus:" << cpus_.size()
+               << " physical_cores:" << numPhysicalCores()
+               << " sockets:" << numSockets()
+               << " numa_nodes:" << numNumaNodes() << "]\n";
+
+            for (const auto &cpu : cpus_)
+            {
+                ss << "  cpu:" << cpu.cpu_id_
+                   << " core:" << cpu.core_id_
+                   << " socket:" << cpu.socket_id_
+                   << " numa:" << cpu.numa_node_
+                   << " l2:" << cpu.l2_id_
+                   << " siblings:";
+                for (size_t i = 0; i < cpu.siblings_.size(); ++i)
+                    ss << (i ? "," : "") << cpu.siblings_[i];
+                ss << (cpu.isolated_ ? " isolated" : "")
+                   << (cpu.nohz_full_ ? " nohz_full" : "") << "\n";
+            }
+
+            return ss.str();
+        }
+
+    private:
+        static auto readInt(const std::string &path) noexcept -> int
+        {
+            const auto line = readSysfsLine(path);
+            return line.empty() ? -1 : std::atoi(line.c_str());
+        }
+
+        //cpuN/nodeK symlink exists when the kernel is built with NUMA support
+        static auto findNumaNode(const std::string &cpu_dir) noexcept -> int
+        {
+            int node = 0;
+            if (auto dir = opendir(cpu_dir.c_str()))
+            {
+                while (auto entry = readdir(dir))
+                {
+                    if (!strncmp(entry->d_name, "node", 4) && isdigit(entry->d_name[4]))
+                    {
+                        node = std::atoi(entry->d_name + 4);
+                        break;
+                    }
+                }
+                closedir(dir);
+            }
+            return node;
+        }
+
+        static auto findL2Domain(const std::string &cpu_dir, int cpu_id) noexcept -> int
+        {
+            for (int index = 0;; ++index)
+            {
+                const auto cache_dir = cpu_dir + "/cache/index" + std::to_string(index);
+                const auto level = readSysfsLine(cache_dir + "/level");
+                if (level.empty())
+                    break;
+
+                if (std::atoi(level.c_str()) == 2)
+                {
+                    const auto shared = parseCpuList(readSysfsLine(cache_dir + "/shared_cpu_list"));
+                    return shared.empty() ? cpu_id : shared.front();
+                }
+            }
+            return cpu_id;
+        }
+
+        template <typename F>
+        auto countDistinct(F key) const noexcept -> size_t
+        {
+            std::vector<int> seen;
+            for (const auto &cpu : cpus_)
+                if (std::find(seen.begin(), seen.end(), key(cpu)) == seen.end())
+                    seen.push_back(key(cpu));
+            return seen.size();
+        }
+
+        std::vector<CpuInfo> cpus_;
+    };
+
+    struct CoreAssignment
+    {
+        std::string role_;
+        int cpu_id_ = UNPINNED_CORE;
+        bool shares_core_ = false;      //had to fall back to an SMT sibling of another role
+        bool shares_l2_ = false;        //had to fall back to a cpu sharing L2 with another role
+    };
+
+    //Assigns named roles (network reactor, strategy, logger, ...) to cpus in priority order.
+    //The first role gets the best cpu: isolated, own physical core, own L2. Later roles fall back
+    //step by step to shared L2, non-isolated cpus and finally SMT siblings. The physical core of
+    //cpu0 is avoided since it takes most housekeeping interrupts. If nothing is left a role gets
+    //UNPINNED_CORE.
+    class CorePlacementPlanner final
+    {
+    public:
+        explicit CorePlacementPlanner(const CpuTopology &topology) : topology_(topology) {}
+
+        CorePlacementPlanner() = delete;
+        CorePlacementPlanner(const CorePlacementPlanner &) = delete;
+        CorePlacementPlanner(const CorePlacementPlanner &&) = delete;
+        CorePlacementPlanner &operator=(const CorePlacementPlanner &) = delete;
+        CorePlacementPlanner &operator=(const CorePlacementPlanner &&) = delete;
+
+        auto plan(const std::vector<std::string> &roles) -> const std::vector<CoreAssignment> &
+        {
+            assignments_.clear();
+
+            for (const auto &role : roles)
+            {
+                CoreAssignment assignment{role};
+
+                //strictest pass first, relax one constraint at a time: L2 before isolation before SMT
+                for (int pass = 0; pass < 5 && assignment.cpu_id_ == UNPINNED_CORE; ++pass)
+                {
+                    const bool need_isolated = (pass <= 1) && hasIsolated();
+                    const bool need_own_l2 = (pass == 0 || pass == 2);
+                    const bool need_own_core = (pass <= 3);
+
+                    for (const auto &cpu : topology_.cpus())
+                    {
+                        if (isTaken(cpu.cpu_id_) || (need_isolated && !cpu.isolated_))
+                            continue;
+                        if (isHousekeeping(cpu) && (need_own_core || cpu.cpu_id_ == 0))
+                            continue;
+
+                        const bool shares_core = coreTaken(cpu);
+                        const bool shares_l2 = l2Taken(cpu);
+                        if ((need_own_core && shares_core) || (need_own_l2 && shares_l2))
+                            continue;
+
+                        assignment.cpu_id_ = cpu.cpu_id_;
+                        assignment.shares_core_ = shares_core;
+                        assignment.shares_l2_ = shares_l2;
+                        break;
+                    }
+                }
+
+                assignments_.push_back(assignment);
+            }
+
+            return assignments_;
+        }
+
+        //core id to pass to createAndStartThread() / setThreadCore(), UNPINNED_CORE if role unknown
+        auto coreFor(const std::string &role) const noexcept -> int
+        {
+            for (const auto &assignment : assignments_)
+                if (assignment.role_ == role)
+                    return assignment.cpu_id_;
+            return UNPINNED_CORE;
+        }
+
+        auto toString() const
+        {
+            std::stringstream ss;
+            ss << "CorePlacement[roles:" << assignments_.size() << "]\n";
+
+            for (const auto &assignment : assignments_)
+            {
+                ss << "  " << assignment.role_ << " -> ";
+                const auto cpu = topology_.find(assignment.cpu_id_);
+                if (!cpu)
+                {
+                    ss << "unpinned\n";
+                    continue;
+                }
+
+                ss << "cpu:" << cpu->cpu_id_
+                   << " socket:" << cpu->socket_id_
+                   << " numa:" << cpu->numa_node_
+                   << (cpu->isolated_ ? " isolated" : " not-isolated")
+                   << (assignment.shares_l2_ ? " shared-l2" : "")
+                   << (assignment.shares_core_ ? " shared-core" : "") << "\n";
+            }
+
+            return ss.str();
+        }
+
+    private:
+        auto hasIsolated() const noexcept -> bool
+        {
+            for (const auto &cpu : topology_.cpus())
+                if (cpu.isolated_)
+                    return true;
+            return false;
+        }
+
+        //cpu0 and its SMT siblings take most housekeeping interrupts, unless it is the only cpu
+        auto isHousekeeping(const CpuInfo &cpu) const noexcept -> bool
+        {
+            const auto cpu0 = topology_.find(0);
+            return topology_.cpus().size() > 1 && cpu0 && cpu0->physicalCore() == cpu.physicalCore();
+        }
+
+        auto isTaken(int cpu_id) const noexcept -> bool
+        {
+            for (const auto &assignment : assignments_)
+                if (assignment.cpu_id_ == cpu_id)
+                    return true;
+            return false;
+        }
+
+        auto coreTaken(const CpuInfo &cpu) const noexcept -> bool
+        {
+            for (const auto sibling : cpu.siblings_)
+                if (isTaken(sibling))
+                    return true;
+            return false;
+        }
+
+        auto l2Taken(const CpuInfo &cpu) const noexcept -> bool
+        {
+            for (const auto &assignment : assignments_)
+            {
+                const auto other = topology_.find(assignment.cpu_id_);
+                if (other && other->l2_id_ == cpu.l2_id_)
+                    return true;
+            }
+            return false;
+        }
+
+        const CpuTopology &topology_;
+        std::vector<CoreAssignment> assignments_;
+    };
+}
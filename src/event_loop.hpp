@@ -0,0 +1,369 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "thread_utils.hpp"
+#include "logger.hpp"
+#include "lf_queue.hpp"
+#include "latency_histogram.hpp"
+#include "timer_wheel.hpp"
+#include "tcp_server.hpp"
+#include "tcp_client.hpp"
+#include "mcast_socket.hpp"
+
+namespace common {
+    //sources are visited in this order every iteration, registration order within a priority
+    enum class EventPriority : uint8_t {
+        HIGH = 0,
+        NORMAL = 1,
+        LOW = 2
+    };
+
+    inline auto eventPriorityToString(EventPriority priority) {
+        switch (priority) {
+            case EventPriority::HIGH: return "HIGH";
+            case EventPriority::NORMAL: return "NORMAL";
+            case EventPriority::LOW: return "LOW";
+        }
+        return "UNKNOWN";
+    }
+
+    struct EventLoopCfg {
+        //core the loop thread is pinned to by start(), -1 to leave it unpinned
+        int core_id_ = -1;
+        //work items per iteration across all sources (queue messages, datagrams, fired timers, busy socket polls).
+        //sources behind the one that used it up wait for the next iteration, they stay ready
+        size_t work_budget_ = 256;
+        //spin on epoll_wait() with timeout 0, or sleep in it while idle until a source fd, wake() or the idle timeout
+        bool spin_ = true;
+        //longest sleep while timers or always polled sources are waiting
+        int idle_timeout_ms_ = 1;
+        size_t max_timers_ = 64 * 1024;
+        Nanos timer_tick_ = NANOS_TO_MICROS;
+        EventPriority timer_priority_ = EventPriority::HIGH;
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << "EventLoopCfg[core:" << core_id_ << " work_budget:" << work_budget_ << " spin:" << spin_
+               << " idle_timeout_ms:" << idle_timeout_ms_ << " max_timers:" << max_timers_ << " timer_tick_ns:" << timer_tick_
+               << " timer_priority:" << eventPriorityToString(timer_priority_) << "]";
+            return ss.str();
+        }
+    };
+
+    struct EventSource {
+        std::string name_;
+        EventPriority priority_;
+        //registered with the loop's epoll set, -1 for none
+        int fd_;
+        //polled every iteration, otherwise only when fd_ is readable or the previous poll did work
+        bool always_poll_;
+        //poll_(ready, budget): ready is false for an always polled source whose fd_ did not fire. Does up to budget
+        //items of work and returns how many; a source that works in fixed batches may overshoot the budget.
+        std::function<size_t(bool ready, size_t budget)> poll_;
+        bool ready_ = false;
+
+        size_t polls_ = 0;
+        size_t work_ = 0;
+        //iterations it was ready but the budget was used up by higher priority sources
+        size_t starved_ = 0;
+    };
+
+    //written by the loop thread only, read them after stop() or from the loop thread
+    struct EventLoopStats {
+        size_t iterations_ = 0;
+        size_t busy_iterations_ = 0;
+        size_t budget_exhausted_ = 0;
+        size_t wakeups_ = 0;
+        //duration of iterations that did work, from epoll_wait() returning to the last source polled
+        LatencyHistogram busy_iteration_ns_;
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << "EventLoopStats[iterations:" << iterations_ << " busy:" << busy_iterations_
+               << " budget_exhausted:" << budget_exhausted_ << " wakeups:" << wakeups_
+               << " busy_iteration_ns " << busy_iteration_ns_.toString() << "]";
+            return ss.str();
+        }
+    };
+
+    //One deterministic loop per core: an epoll set with every source fd (nested epoll fds for TCPServer / TCPClient,
+    //socket fds, eventfds) decides which sources have work, then ready sources are polled in priority order until the
+    //iteration's work budget is spent. LFQueue consumers, timers and clients with deadlines are polled every iteration.
+    //Everything added to a loop belongs to its thread from start() on; other threads talk to it only through LFQueues
+    //and eventfds, and wake() a sleeping loop. Register sources before start() or from the loop thread; one added by a
+    //source's poll_ joins the loop once the current iteration is done.
+    class EventLoop final {
+    public:
+        EventLoop(Logger &logger, const EventLoopCfg &cfg)
+            : cfg_(cfg), timers_(cfg.max_timers_, cfg.timer_tick_, tsc_.nanos()), logger_(logger) {
+            efd_ = epoll_create(1);
+            ASSERT(efd_ >= 0, "epoll_create() failed error:" + std::string(std::strerror(errno)));
+            wake_fd_ = eventfd(0, EFD_NONBLOCK);
+            ASSERT(wake_fd_ >= 0, "eventfd() failed error:" + std::string(std::strerror(errno)));
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            ASSERT(epoll_ctl(efd_, EPOLL_CTL_ADD, wake_fd_, &ev) != -1, "epoll_ctl() failed. error:" + std::string(std::strerror(errno)));
+
+            timer_source_ = addSource("timers", cfg_.timer_priority_, -1, true, [this](bool, size_t) {
+                return timers_.tick(tsc_.nanos());
+            });
+        }
+
+        ~EventLoop() {
+            stop();
+            for (auto fd : owned_fds_)
+                close(fd);
+            close(wake_fd_);
+            close(efd_);
+            for (auto source : sources_)
+                delete source;
+        }
+
+        EventLoop() = delete;
+        EventLoop(const EventLoop &) = delete;
+        EventLoop(const EventLoop &&) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &&) = delete;
+
+        auto addSource(const std::string &name, EventPriority priority, int fd, bool always_poll, std::function<size_t(bool, size_t)> poll) -> EventSource * {
+            auto source = new EventSource{name, priority, fd, always_poll, std::move(poll)};
+            if (fd >= 0) {
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.ptr = reinterpret_cast<void *>(source);
+                ASSERT(epoll_ctl(efd_, EPOLL_CTL_ADD, fd, &ev) != -1, "epoll_ctl() failed. error:" + std::string(std::strerror(errno)));
+            }
+            //runOnce() is iterating sources_, inserting would invalidate its iterators
+            if (polling_)
+                pending_sources_.push_back(source);
+            else
+                insertSource(source);
+            logger_.log("%:% %() % added source:% priority:% fd:% always_poll:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_),
+                        name, eventPriorityToString(priority), fd, always_poll);
+            return source;
+        }
+
+        //a listening server: its epoll fd wakes the loop, one work item per poll that found something to do.
+        //Server is TCPServer or a StaticTCPServer, whose sendAndRecv() dispatches statically
+        template<typename Server>
+        auto addTCPServer(const std::string &name, Server &server, EventPriority priority = EventPriority::NORMAL) -> EventSource * {
+            ASSERT(server.efd_ >= 0, "addTCPServer() needs a listening server.");
+            return addSource(name, priority, server.efd_, false, [&server](bool, size_t) -> size_t {
+                const auto empty_polls = server.empty_polls_;
+                server.poll();
+                server.sendAndRecv();
+                return server.empty_polls_ == empty_polls;
+            });
+        }
+
+        //polled every iteration for its connect timeouts and backoffs, its epoll fd wakes a sleeping loop
+        auto addTCPClient(const std::string &name, TCPClient &client, EventPriority priority = EventPriority::NORMAL) -> EventSource * {
+            return addSource(name, priority, client.epollFd(), true, [&client](bool, size_t) {
+                const auto events = client.poll();
+                client.sendAndRecv();
+                return events;
+            });
+        }
+
+        //one recvmmsg() batch when readable, queued datagrams flushed every iteration
+        auto addMcastSocket(const std::string &name, McastSocket &socket, EventPriority priority = EventPriority::NORMAL) -> EventSource * {
+            return addSource(name, priority, socket.fd_, true, [&socket](bool ready, size_t) -> size_t {
+                const auto n = ready ? socket.recv() : 0;
+                if (socket.pendingSendDatagrams())
+                    socket.flush();
+                if (socket.tx_timestamps_ && ready)
+                    socket.readTxTimestamps();
+                return n > 0 ? n : 0;
+            });
+        }
+
+        //the consumer side of an LFQueue, handler(const T &) per element up to the budget. A producer that wants a
+        //sleeping loop to react right away calls wake() after updateWriteIndex().
+        template<typename T, typename F>
+        auto addQueue(const std::string &name, LFQueue<T> &queue, F &&handler, EventPriority priority = EventPriority::NORMAL) -> EventSource * {
+            return addSource(name, priority, -1, true, [&queue, handler = std::forward<F>(handler)](bool, size_t budget) mutable {
+                size_t done = 0;
+                for (auto next = queue.getNextToRead(); done < budget && queue.size() && next; next = queue.getNextToRead()) {
+                    handler(*next);
+                    queue.updateReadIndex();
+                    ++done;
+                }
+                return done;
+            });
+        }
+
+        //an eventfd owned by the loop: any thread eventfd_write()s to the returned fd, handler gets the summed count
+        auto addEventFd(const std::string &name, std::function<void(uint64_t count)> handler, EventPriority priority = EventPriority::NORMAL) -> int {
+            const int fd = eventfd(0, EFD_NONBLOCK);
+            ASSERT(fd >= 0, "eventfd() failed error:" + std::string(std::strerror(errno)));
+            owned_fds_.push_back(fd);
+            addSource(name, priority, fd, false, [fd, handler = std::move(handler)](bool, size_t) -> size_t {
+                eventfd_t count = 0;
+                if (eventfd_read(fd, &count) != 0 || !count)
+                    return 0;
+                handler(count);
+                return 1;
+            });
+            return fd;
+        }
+
+        //interrupts a sleeping epoll_wait(), safe from any thread
+        auto wake() noexcept -> void {
+            eventfd_write(wake_fd_, 1);
+        }
+
+        //loop thread only
+        auto timers() noexcept -> TimerWheel & {
+            return timers_;
+        }
+
+        //the loop's clock, on the getCurrentNanos() timeline
+        auto now() const noexcept {
+            return tsc_.nanos();
+        }
+
+        //One iteration: collect ready fds, then poll ready and always polled sources by priority within the budget.
+        //Returns the work done.
+        auto runOnce() noexcept -> size_t {
+            const int timeout = (cfg_.spin_ || last_work_) ? 0 : idleTimeout();
+            const auto n = epoll_wait(efd_, events_.data(), static_cast<int>(events_.size()), timeout);
+            const auto start = rdtsc();
+            for (int i = 0; i < n; ++i) {
+                auto source = reinterpret_cast<EventSource *>(events_[i].data.ptr);
+                if (!source) {
+                    eventfd_t count;
+                    eventfd_read(wake_fd_, &count);
+                    ++stats_.wakeups_;
+                    continue;
+                }
+                source->ready_ = true;
+            }
+
+            auto budget = cfg_.work_budget_;
+            size_t work = 0;
+            polling_ = true;
+            for (auto source : sources_) {
+                if (!source->ready_ && !source->always_poll_)
+                    continue;
+                if (UNLIKELY(!budget)) {
+                    ++source->starved_;
+                    continue;
+                }
+                const auto done = source->poll_(source->ready_, budget);
+                ++source->polls_;
+                source->work_ += done;
+                //a source that did work is polled again until it reports none, its fd may not fire again for it
+                source->ready_ = done > 0;
+                budget -= std::min(done, budget);
+                work += done;
+            }
+            polling_ = false;
+            if (UNLIKELY(!pending_sources_.empty())) {
+                for (auto source : pending_sources_)
+                    insertSource(source);
+                pending_sources_.clear();
+            }
+
+            ++stats_.iterations_;
+            if (!budget)
+                ++stats_.budget_exhausted_;
+            if (work) {
+                ++stats_.busy_iterations_;
+                stats_.busy_iteration_ns_.record(static_cast<uint64_t>(tsc_.ticksToNanos(rdtsc() - start)));
+            }
+            last_work_ = work;
+            return work;
+        }
+
+        auto run() noexcept -> void {
+            logger_.log("%:% %() % running %\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), cfg_.toString());
+            while (running_.load(std::memory_order_relaxed))
+                runOnce();
+        }
+
+        //run() on a thread pinned to cfg_.core_id_
+        auto start() -> void {
+            running_ = true;
+            thread_ = createAndStartThread(cfg_.core_id_, "common/EventLoop", [this]() { run(); });
+            ASSERT(thread_ != nullptr, "Failed to start EventLoop thread.");
+        }
+
+        auto stop() -> void {
+            running_ = false;
+            if (thread_) {
+                wake();
+                thread_->join();
+                delete thread_;
+                thread_ = nullptr;
+            }
+        }
+
+        auto stats() const noexcept -> const EventLoopStats & {
+            return stats_;
+        }
+
+        auto sources() const noexcept -> const std::vector<EventSource *> & {
+            return sources_;
+        }
+
+        auto sourcesToString() const {
+            std::stringstream ss;
+            for (auto source : sources_)
+                ss << "EventSource[" << source->name_ << " priority:" << eventPriorityToString(source->priority_) << " polls:" << source->polls_
+                   << " work:" << source->work_ << " starved:" << source->starved_ << "]\n";
+            return ss.str();
+        }
+
+    private:
+        //by priority, after the sources already registered with the same priority
+        auto insertSource(EventSource *source) -> void {
+            const auto pos = std::upper_bound(sources_.begin(), sources_.end(), source->priority_, [](auto p, auto s) { return p < s->priority_; });
+            sources_.insert(pos, source);
+            if (events_.size() < sources_.size() + 1)
+                events_.resize(sources_.size() + 1);
+        }
+
+        //sleep until a fd fires while only fd driven sources exist, bounded while timers or polled sources wait
+        auto idleTimeout() const noexcept -> int {
+            if (timers_.pending())
+                return cfg_.idle_timeout_ms_;
+            for (auto source : sources_)
+                if (source->always_poll_ && source != timer_source_)
+                    return cfg_.idle_timeout_ms_;
+            return -1;
+        }
+
+        const EventLoopCfg cfg_;
+        TSCClock tsc_;
+        TimerWheel timers_;
+        int efd_ = -1;
+        int wake_fd_ = -1;
+        std::vector<int> owned_fds_;
+        std::vector<epoll_event> events_ = std::vector<epoll_event>(2);
+        std::vector<EventSource *> sources_;
+        //added while runOnce() polls sources_, merged in after
+        std::vector<EventSource *> pending_sources_;
+        bool polling_ = false;
+        EventSource *timer_source_ = nullptr;
+        size_t last_work_ = 0;
+        EventLoopStats stats_;
+
+        std::atomic<bool> running_ = {false};
+        std::thread *thread_ = nullptr;
+        std::string time_str_;
+        Logger &logger_;
+    };
+}
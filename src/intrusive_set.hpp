@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+
+#include "macros.h"
+
+namespace common
+{
+    constexpr size_t NotInSet = std::numeric_limits<size_t>::max();
+
+    //Unordered set of T* with O(1) add / remove / contains and no hashing.
+    //Each element stores its own position in the set in the member pointed to by Slot (NotInSet when absent),
+    //removal swaps the last element into the hole. An element can be in as many sets as it has slot members.
+    template<typename T, size_t T::*Slot>
+    class IntrusiveSet final
+    {
+    public:
+        explicit IntrusiveSet(std::size_t capacity)
+        {
+            items_.reserve(capacity);
+        }
+
+        IntrusiveSet() = delete;
+        IntrusiveSet(const IntrusiveSet &) = delete;
+        IntrusiveSet(const IntrusiveSet &&) = delete;
+        IntrusiveSet &operator=(const IntrusiveSet &) = delete;
+        IntrusiveSet &operator=(const IntrusiveSet &&) = delete;
+
+        auto contains(const T *elem) const noexcept
+        {
+            return elem->*Slot != NotInSet;
+        }
+
+        //false if already present
+        auto add(T *elem) noexcept
+        {
+            if (elem->*Slot != NotInSet)
+                return false;
+
+            elem->*Slot = items_.size();
+            items_.push_back(elem);
+            return true;
+        }
+
+        //false if not present. Safe while iterating backwards: only the element at the back moves.
+        auto remove(T *elem) noexcept
+        {
+            const auto slot = elem->*Slot;
+            if (slot == NotInSet)
+                return false;
+
+            ASSERT(slot < items_.size() && items_[slot] == elem, "IntrusiveSet slot corrupted.");
+            auto last = items_.back();
+            items_[slot] = last;
+            last->*Slot = slot;
+            items_.pop_back();
+            elem->*Slot = NotInSet;
+            return true;
+        }
+
+        auto clear() noexcept
+        {
+            for (auto elem : items_)
+                elem->*Slot = NotInSet;
+            items_.clear();
+        }
+
+        auto operator[](std::size_t index) const noexcept
+        {
+            return items_[index];
+        }
+
+        auto front() const noexcept
+        {
+            return items_.front();
+        }
+
+        auto size() const noexcept
+        {
+            return items_.size();
+        }
+
+        auto empty() const noexcept
+        {
+            return items_.empty();
+        }
+
+        auto begin() const noexcept
+        {
+            return items_.begin();
+        }
+
+        auto end() const noexcept
+        {
+            return items_.end();
+        }
+
+    private:
+        std::vector<T *> items_;
+    };
+}
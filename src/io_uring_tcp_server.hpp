@@ -0,0 +1,594 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "tcp_socket.hpp"
+#include "memory_pool.hpp"
+#include "buffer_pool.hpp"
+#include "intrusive_set.hpp"
+#include "timer_wheel.hpp"
+#include "tcp_server.hpp"
+
+
+namespace common {
+    //submission queue entries, the completion queue is 4 times larger since multishot requests post many completions
+    constexpr unsigned IoUringEntries = 4096;
+    //provided receive buffers shared by all connections, a power of two
+    constexpr unsigned IoUringBufferCount = 1024;
+    constexpr size_t IoUringBufferSize = 16 * 1024;
+
+    //raw io_uring syscalls, no liburing dependency
+    inline auto ioUringSetup(unsigned entries, io_uring_params *params) noexcept -> int {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    inline auto ioUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept -> int {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    inline auto ioUringRegister(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) noexcept -> int {
+        return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+    }
+
+    //io_uring state of one accepted TCPSocket. The kernel reads a send's bytes whenever it gets to issue it, so sends
+    //go out of staging_, a copy of the socket's ring bytes: send() may grow and free the ring meanwhile.
+    struct IoUringConnection {
+        TCPSocket *socket_ = nullptr;
+        char *staging_ = nullptr;
+        size_t staging_size_ = 0;
+        //bytes in staging_ and, of those, sent
+        size_t staged_ = 0;
+        size_t staged_sent_ = 0;
+        bool send_inflight_ = false;
+        bool recv_armed_ = false;
+        bool closing_ = false;
+        //when the oldest bytes not handed to the recv callback yet were reaped
+        Nanos rx_time_ = 0;
+    };
+
+    //TCPServer with the same callback API on an io_uring instead of epoll and non-blocking syscalls:
+    // - one multishot accept on the listener and one multishot recv per connection stay armed, each posting a
+    //   completion per accepted socket / received chunk without being submitted again.
+    // - receives land in a ring of provided buffers registered with the kernel and are copied to the socket's
+    //   rcv_buffer_, so recv callbacks and MessageFramer see the same TCPSocket as with TCPServer.
+    // - everything queued by poll() and sendAndRecv() goes to the kernel in one io_uring_enter(), which also reaps
+    //   completions: about two syscalls per loop iteration however many sockets were active.
+    //Differences to TCPServer: recv_callback_ runs once per socket and sendAndRecv() with everything received since
+    //the last one, rx_time is when the completion was reaped (no kernel timestamps), and there are no zero-copy sends
+    //or send timestamps. Needs Linux 6.0+ for multishot recv.
+    struct IoUringTCPServer {
+    public:
+        //completion user_data: the connection with the operation in the low bits, nullptr for the listener
+        enum Op : uint64_t {
+            OpAccept = 0,
+            OpRecv = 1,
+            OpSend = 2,
+            OpProvide = 3
+        };
+        static constexpr uint64_t OpMask = 3;
+        //provided buffer groups: the registered ring, or buffers handed over one by one with IORING_OP_PROVIDE_BUFFERS
+        static constexpr uint16_t BufRingGroup = 0;
+        static constexpr uint16_t ProvideGroup = 1;
+
+        int ring_fd_ = -1;
+        TCPSocket listener_socket_;
+        //all accepted sockets / sockets with bytes for the recv callback / unsent bytes queued by callbacks / peer gone,
+        //closed by sendAndRecv() once the recv callback has seen what arrived before
+        IntrusiveSet<TCPSocket, &TCPSocket::socket_slot_> sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::receive_slot_> receive_sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::send_slot_> send_sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::disconnected_slot_> disconnected_sockets_;
+        std::function<void(TCPSocket *s, Nanos rx_time)> recv_callback_;
+        std::function<void()> recv_finished_callback_;
+        //called once a connection is accepted, and right before a closed connection is freed
+        std::function<void(TCPSocket *s)> accept_callback_;
+        std::function<void(TCPSocket *s)> disconnect_callback_;
+        std::string time_str_;
+        Logger &logger_;
+
+        const size_t initial_buffer_size_;
+        BufferPool buffer_pool_;
+        MemoryPool<TCPSocket> socket_pool_;
+        MemoryPool<IoUringConnection> connection_pool_;
+        //indexed by fd
+        std::vector<IoUringConnection *> connections_;
+
+        //poll() calls, io_uring_enter() calls, completions reaped, chunks received into provided buffers, multishot
+        //recvs re-armed after running out of provided buffers
+        size_t polls_ = 0;
+        size_t enters_ = 0;
+        size_t completions_ = 0;
+        size_t buffers_selected_ = 0;
+        size_t buffers_exhausted_ = 0;
+        //if set, ticked with getCurrentNanos() at the start of every poll()
+        TimerWheel *timer_wheel_ = nullptr;
+
+        auto defaultRecvCallback(common::TCPSocket *socket, Nanos rx_time) noexcept {
+            logger_.log("%:% %() % IoUringTCPServer::defaultRecvCallback() socket:% len:% rx:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, socket->next_rcv_valid_index_, rx_time);
+        }
+
+        auto defaultRecvFinishedCallback() noexcept {
+            logger_.log("%:% %() % IoUringTCPServer::defaultRecvFinishedCallback()\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_));
+        }
+
+        explicit IoUringTCPServer(Logger &logger, size_t max_connections = TCPServerMaxConnections, size_t initial_buffer_size = TCPInitialBufferSize, size_t max_buffer_size = TCPBufferSize,
+                                  unsigned entries = IoUringEntries, unsigned buffer_count = IoUringBufferCount, size_t buffer_size = IoUringBufferSize)
+            : listener_socket_(logger), sockets_(max_connections), receive_sockets_(max_connections), send_sockets_(max_connections),
+              disconnected_sockets_(max_connections), logger_(logger), initial_buffer_size_(initial_buffer_size), buffer_pool_(initial_buffer_size, max_buffer_size),
+              socket_pool_(max_connections), connection_pool_(max_connections), buffer_count_(buffer_count), buffer_size_(buffer_size) {
+            ASSERT(buffer_count && !(buffer_count & (buffer_count - 1)) && buffer_count <= 32768, "IoUringTCPServer buffer count must be a power of two up to 32768.");
+            recv_callback_ = [this](auto socket, auto rx_time) {
+                defaultRecvCallback(socket, rx_time);
+            };
+            recv_finished_callback_ = [this]() {
+                defaultRecvFinishedCallback();
+            };
+            accept_callback_ = [](auto) {};
+            disconnect_callback_ = [](auto) {};
+            setupRing(entries);
+            setupBuffers();
+        }
+
+        ~IoUringTCPServer() {
+            //closing the ring cancels every request still armed, the sockets can go after it
+            destroy();
+            close(ring_fd_);
+            for (auto socket : sockets_) {
+                auto connection = connections_[socket->fd_];
+                releaseStaging(connection);
+                connection_pool_.deallocate(connection);
+                socket_pool_.deallocate(socket);
+            }
+            munmap(buffers_, static_cast<size_t>(buffer_count_) * buffer_size_);
+            munmap(buf_ring_, buffer_count_ * sizeof(io_uring_buf));
+            munmap(sqes_, sqes_size_);
+            if (cq_ring_ != sq_ring_)
+                munmap(cq_ring_, cq_ring_size_);
+            munmap(sq_ring_, sq_ring_size_);
+        }
+
+        IoUringTCPServer() = delete;
+        IoUringTCPServer(const IoUringTCPServer &) = delete;
+        IoUringTCPServer(const IoUringTCPServer &&) = delete;
+        IoUringTCPServer &operator=(const IoUringTCPServer &) = delete;
+        IoUringTCPServer &operator=(const IoUringTCPServer &&) = delete;
+
+        /*Functions*/
+
+        auto destroy() noexcept -> void {
+            listener_socket_.destroy();
+        }
+
+        //reuse_port lets several servers listen on the same port. The multishot accept goes out with the next poll().
+        auto listen(const std::string &iface, int port, bool reuse_port = false) -> void {
+            destroy();
+            ASSERT(listener_socket_.connect("", iface, port, true, reuse_port) >= 0, "Listener socket failed to connect. iface:" + iface + " port:" + std::to_string(port) + " error:" + std::string(std::strerror(errno)));
+            armAccept();
+        }
+
+        //Submit what is queued and reap every completion: accepted sockets are set up, received chunks copied to
+        //their socket, finished sends continue with the rest of the socket's ring.
+        auto poll() noexcept -> void {
+            if (timer_wheel_)
+                timer_wheel_->tick(getCurrentNanos());
+
+            ++polls_;
+            enter(IORING_ENTER_GETEVENTS);
+
+            const auto now = getCurrentNanos();
+            auto head = *cq_head_;
+            const auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const auto cqe = cqes_[head & cq_mask_];
+                ++completions_;
+                auto connection = reinterpret_cast<IoUringConnection *>(cqe.user_data & ~static_cast<uint64_t>(OpMask));
+                switch (cqe.user_data & OpMask) {
+                    case OpAccept:
+                        onAccept(cqe);
+                        break;
+                    case OpRecv:
+                        onRecv(connection, cqe, now);
+                        break;
+                    case OpSend:
+                        onSend(connection, cqe);
+                        break;
+                    case OpProvide:
+                        logger_.log("%:% %() % IORING_OP_PROVIDE_BUFFERS failed errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), strerror(-cqe.res));
+                        break;
+                }
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            if (buf_group_ == BufRingGroup)
+                __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+        }
+
+        //false once received data goes through IORING_OP_PROVIDE_BUFFERS instead of the buffer ring, see useProvideBuffers()
+        auto usesBufRing() const noexcept {
+            return buf_group_ == BufRingGroup;
+        }
+
+        auto sendAndRecv() noexcept -> void {
+            sendAndRecvWith([](TCPSocket *socket, Nanos rx_time) { socket->recv_callback_(socket, rx_time); }, recv_finished_callback_);
+        }
+
+        //Callbacks for the sockets poll() received into, then sends for whatever they queued, all submitted together.
+        template<typename RecvHandler, typename RecvFinishedHandler>
+        auto sendAndRecvWith(RecvHandler &&on_recv, RecvFinishedHandler &&on_recv_finished) noexcept -> void {
+            const auto recv = !receive_sockets_.empty();
+            for (auto i = receive_sockets_.size(); i-- > 0;) {
+                auto socket = receive_sockets_[i];
+                receive_sockets_.remove(socket);
+                on_recv(socket, connections_[socket->fd_]->rx_time_);
+                if (UNLIKELY(socket->send_disconnected_ || socket->recv_disconnected_))
+                    startClose(connections_[socket->fd_]);
+            }
+            if (recv)
+                on_recv_finished();
+            while (!disconnected_sockets_.empty())
+                startClose(connections_[disconnected_sockets_.front()->fd_]);
+
+            for (auto i = send_sockets_.size(); i-- > 0;) {
+                auto socket = send_sockets_[i];
+                send_sockets_.remove(socket);
+                auto connection = connections_[socket->fd_];
+                if (UNLIKELY(socket->send_disconnected_))
+                    startClose(connection);
+                else
+                    flush(connection);
+            }
+
+            if (sqe_tail_ != submitted_)
+                enter(0);
+        }
+
+    private:
+        auto setupRing(unsigned entries) noexcept -> void {
+            //single issuer with deferred task work runs completions only inside io_uring_enter(GETEVENTS) on this
+            //thread, no interrupts of the polling thread. Older kernels get the plain ring.
+            const unsigned flag_sets[] = {IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL, IORING_SETUP_SUBMIT_ALL, 0};
+            io_uring_params params{};
+            for (auto flags : flag_sets) {
+                params = {};
+                params.flags = flags | IORING_SETUP_CQSIZE;
+                params.cq_entries = entries * 4;
+                if ((ring_fd_ = ioUringSetup(entries, &params)) >= 0)
+                    break;
+            }
+            ASSERT(ring_fd_ >= 0, "io_uring_setup() failed. error:" + std::string(std::strerror(errno)));
+
+            sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+            sq_ring_ = static_cast<char *>(mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING));
+            ASSERT(sq_ring_ != MAP_FAILED, "io_uring submission ring mmap() failed. error:" + std::string(std::strerror(errno)));
+            cq_ring_ = sq_ring_;
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+                cq_ring_ = static_cast<char *>(mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING));
+                ASSERT(cq_ring_ != MAP_FAILED, "io_uring completion ring mmap() failed. error:" + std::string(std::strerror(errno)));
+            }
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+            ASSERT(sqes_ != MAP_FAILED, "io_uring sqe mmap() failed. error:" + std::string(std::strerror(errno)));
+
+            sq_entries_ = params.sq_entries;
+            sq_head_ = reinterpret_cast<unsigned *>(sq_ring_ + params.sq_off.head);
+            sq_tail_ = reinterpret_cast<unsigned *>(sq_ring_ + params.sq_off.tail);
+            sq_mask_ = *reinterpret_cast<unsigned *>(sq_ring_ + params.sq_off.ring_mask);
+            //sqe i always sits in slot i
+            auto sq_array = reinterpret_cast<unsigned *>(sq_ring_ + params.sq_off.array);
+            for (unsigned i = 0; i < sq_entries_; ++i)
+                sq_array[i] = i;
+            sqe_tail_ = submitted_ = *sq_tail_;
+
+            cq_head_ = reinterpret_cast<unsigned *>(cq_ring_ + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned *>(cq_ring_ + params.cq_off.tail);
+            cq_mask_ = *reinterpret_cast<unsigned *>(cq_ring_ + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe *>(cq_ring_ + params.cq_off.cqes);
+        }
+
+        //register the provided buffer ring and hand it every buffer
+        auto setupBuffers() noexcept -> void {
+            buf_ring_ = static_cast<io_uring_buf_ring *>(mmap(nullptr, buffer_count_ * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+            buffers_ = static_cast<char *>(mmap(nullptr, static_cast<size_t>(buffer_count_) * buffer_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+            ASSERT(buf_ring_ != MAP_FAILED && buffers_ != MAP_FAILED, "io_uring buffer mmap() failed. error:" + std::string(std::strerror(errno)));
+
+            io_uring_buf_reg reg{};
+            reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+            reg.ring_entries = buffer_count_;
+            reg.bgid = BufRingGroup;
+            ASSERT(ioUringRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) == 0, "io_uring provided buffer ring registration failed. error:" + std::string(std::strerror(errno)));
+
+            for (unsigned bid = 0; bid < buffer_count_; ++bid)
+                recycleBuffer(static_cast<uint16_t>(bid));
+            __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+        }
+
+        //Some kernels register the ring but answer every buffer select from it with ENOBUFS. Seen before any buffer
+        //was ever selected, hand all of them over with IORING_OP_PROVIDE_BUFFERS instead, ahead of the re-armed recv.
+        auto useProvideBuffers() noexcept -> void {
+            logger_.log("%:% %() % provided buffer ring unusable, falling back to IORING_OP_PROVIDE_BUFFERS\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_));
+            buf_group_ = ProvideGroup;
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = static_cast<int>(buffer_count_);
+            sqe->addr = reinterpret_cast<uint64_t>(buffers_);
+            sqe->len = static_cast<uint32_t>(buffer_size_);
+            sqe->buf_group = ProvideGroup;
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+            sqe->user_data = OpProvide;
+        }
+
+        //back to the kernel: published with the ring tail at the end of poll(), or submitted with the next enter()
+        auto recycleBuffer(uint16_t bid) noexcept -> void {
+            if (UNLIKELY(buf_group_ != BufRingGroup)) {
+                auto sqe = getSqe();
+                sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+                sqe->fd = 1;
+                sqe->addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(bid) * buffer_size_);
+                sqe->len = static_cast<uint32_t>(buffer_size_);
+                sqe->off = bid;
+                sqe->buf_group = ProvideGroup;
+                sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+                sqe->user_data = OpProvide;
+                return;
+            }
+            auto &buf = buf_ring_->bufs[buf_tail_ & (buffer_count_ - 1)];
+            buf.addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(bid) * buffer_size_);
+            buf.len = static_cast<uint32_t>(buffer_size_);
+            buf.bid = bid;
+            ++buf_tail_;
+        }
+
+        //submit queued entries, with IORING_ENTER_GETEVENTS also run deferred completions
+        auto enter(unsigned flags) noexcept -> void {
+            const auto to_submit = sqe_tail_ - submitted_;
+            __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+            ++enters_;
+            const auto n = ioUringEnter(ring_fd_, to_submit, 0, flags);
+            if (n >= 0) {
+                submitted_ += n;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                logger_.log("%:% %() % io_uring_enter() failed errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), strerror(errno));
+            }
+        }
+
+        //next free sqe, zeroed. A full submission ring is flushed to the kernel first.
+        auto getSqe() noexcept -> io_uring_sqe * {
+            while (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+                enter(0);
+            auto sqe = &sqes_[sqe_tail_ & sq_mask_];
+            ++sqe_tail_;
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        auto armAccept() noexcept -> void {
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = listener_socket_.fd_;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->user_data = OpAccept;
+        }
+
+        auto armRecv(IoUringConnection *connection) noexcept -> void {
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = connection->socket_->fd_;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = buf_group_;
+            sqe->user_data = reinterpret_cast<uint64_t>(connection) | OpRecv;
+            connection->recv_armed_ = true;
+        }
+
+        auto onAccept(const io_uring_cqe &cqe) noexcept -> void {
+            //the multishot accept stops on errors, keep it armed while listening
+            if (!(cqe.flags & IORING_CQE_F_MORE) && listener_socket_.fd_ >= 0)
+                armAccept();
+            if (cqe.res < 0) {
+                logger_.log("%:% %() % accept failed errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), strerror(-cqe.res));
+                return;
+            }
+
+            const int fd = cqe.res;
+            if (UNLIKELY(socket_pool_.isFull() || connection_pool_.isFull())) {
+                logger_.log("%:% %() % connection limit reached, refusing socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd);
+                close(fd);
+                return;
+            }
+            ASSERT(disableNagle(fd), "Failed to set no-delay on socket:" + std::to_string(fd));
+            logger_.log("%:% %() % accepted socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd);
+
+            TCPSocket *socket = socket_pool_.allocate(logger_, &buffer_pool_, initial_buffer_size_, buffer_pool_.maxChunkSize());
+            socket->fd_ = fd;
+            socket->recv_callback_ = recv_callback_;
+            socket->send_set_ = &send_sockets_;
+            auto connection = connection_pool_.allocate();
+            connection->socket_ = socket;
+            connection->staging_ = buffer_pool_.acquire(initial_buffer_size_);
+            connection->staging_size_ = buffer_pool_.chunkSize(initial_buffer_size_);
+            if (static_cast<size_t>(fd) >= connections_.size())
+                connections_.resize(fd + 1, nullptr);
+            connections_[fd] = connection;
+
+            sockets_.add(socket);
+            armRecv(connection);
+            accept_callback_(socket);
+        }
+
+        auto onRecv(IoUringConnection *connection, const io_uring_cqe &cqe, Nanos now) noexcept -> void {
+            auto socket = connection->socket_;
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                ++buffers_selected_;
+                const auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                const auto len = static_cast<size_t>(std::max(cqe.res, 0));
+                while (socket->rcv_buffer_size_ - socket->next_rcv_valid_index_ < len && socket->rcv_buffer_size_ < socket->max_buffer_size_)
+                    socket->growRcvBuffer();
+
+                if (UNLIKELY(connection->closing_)) {
+                    //dropped, the socket is being shut down
+                } else if (LIKELY(socket->rcv_buffer_size_ - socket->next_rcv_valid_index_ >= len)) {
+                    memcpy(socket->rcv_buffer_ + socket->next_rcv_valid_index_, buffers_ + static_cast<size_t>(bid) * buffer_size_, len);
+                    socket->next_rcv_valid_index_ += len;
+                    logger_.log("%:% %() % read socket:% len:% utime:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, socket->next_rcv_valid_index_, now);
+                    if (!receive_sockets_.contains(socket)) {
+                        connection->rx_time_ = now;
+                        receive_sockets_.add(socket);
+                    }
+                } else {
+                    //the stream cannot be paused without holding provided buffers, cut the reader off as send() would
+                    logger_.log("%:% %() % receive buffer overflow, cutting off socket:% unconsumed:% len:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, socket->next_rcv_valid_index_, len);
+                    socket->recv_disconnected_ = true;
+                    startClose(connection);
+                }
+                recycleBuffer(bid);
+            }
+
+            if (cqe.flags & IORING_CQE_F_MORE)
+                return;
+            connection->recv_armed_ = false;
+            if (connection->closing_) {
+                maybeFree(connection);
+            } else if (cqe.res == -ENOBUFS) {
+                //every provided buffer was in use, this poll() recycled them
+                ++buffers_exhausted_;
+                if (UNLIKELY(buf_group_ == BufRingGroup && !buffers_selected_))
+                    useProvideBuffers();
+                armRecv(connection);
+            } else if (cqe.res > 0) {
+                armRecv(connection);
+            } else {
+                //0 is EOF. Bytes from this poll() may still wait for the recv callback, close after it
+                if (cqe.res < 0)
+                    logger_.log("%:% %() % recv failed socket:% errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, strerror(-cqe.res));
+                socket->recv_disconnected_ = true;
+                disconnected_sockets_.add(socket);
+            }
+        }
+
+        auto onSend(IoUringConnection *connection, const io_uring_cqe &cqe) noexcept -> void {
+            auto socket = connection->socket_;
+            connection->send_inflight_ = false;
+            if (UNLIKELY(cqe.res < 0)) {
+                if (!connection->closing_)
+                    logger_.log("%:% %() % send failed socket:% errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, strerror(-cqe.res));
+                socket->send_disconnected_ = true;
+                startClose(connection);
+                return;
+            }
+            connection->staged_sent_ += cqe.res;
+            logger_.log("%:% %() % send socket:% len:% pending:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, cqe.res,
+                        connection->staged_ - connection->staged_sent_ + socket->pendingRingBytes());
+            if (connection->closing_)
+                maybeFree(connection);
+            else
+                flush(connection);
+        }
+
+        //One send in flight per connection: the rest of the staged bytes, or the next piece of the socket's ring.
+        auto flush(IoUringConnection *connection) noexcept -> void {
+            if (connection->send_inflight_ || connection->closing_)
+                return;
+            auto socket = connection->socket_;
+            if (connection->staged_sent_ == connection->staged_) {
+                connection->staged_ = connection->staged_sent_ = 0;
+                const auto len = std::min(socket->pendingRingBytes(), connection->staging_size_);
+                if (!len)
+                    return;
+                const auto offset = socket->send_head_ % socket->send_buffer_size_;
+                const auto first = std::min(len, socket->send_buffer_size_ - offset);
+                memcpy(connection->staging_, socket->send_buffer_ + offset, first);
+                memcpy(connection->staging_ + first, socket->send_buffer_, len - first);
+                socket->send_head_ += len;
+                if (!socket->pendingRingBytes())
+                    socket->send_head_ = socket->send_tail_ = 0;
+                connection->staged_ = len;
+
+                if (socket->above_high_watermark_ && socket->pendingSendBytes() <= socket->send_low_watermark_) {
+                    socket->above_high_watermark_ = false;
+                    socket->send_watermark_callback_(socket, false);
+                }
+            }
+
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = socket->fd_;
+            sqe->addr = reinterpret_cast<uint64_t>(connection->staging_ + connection->staged_sent_);
+            sqe->len = static_cast<uint32_t>(connection->staged_ - connection->staged_sent_);
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = reinterpret_cast<uint64_t>(connection) | OpSend;
+            connection->send_inflight_ = true;
+        }
+
+        //Shut the socket down, which completes its armed recv and in-flight send. It is freed once both came back.
+        auto startClose(IoUringConnection *connection) noexcept -> void {
+            if (connection->closing_)
+                return;
+            auto socket = connection->socket_;
+            logger_.log("%:% %() % closing socket:% pending_send:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_,
+                        connection->staged_ - connection->staged_sent_ + socket->pendingSendBytes());
+            connection->closing_ = true;
+            shutdown(socket->fd_, SHUT_RDWR);
+            receive_sockets_.remove(socket);
+            send_sockets_.remove(socket);
+            disconnected_sockets_.remove(socket);
+            maybeFree(connection);
+        }
+
+        auto maybeFree(IoUringConnection *connection) noexcept -> void {
+            if (connection->recv_armed_ || connection->send_inflight_)
+                return;
+            auto socket = connection->socket_;
+            disconnect_callback_(socket);
+            sockets_.remove(socket);
+            receive_sockets_.remove(socket);
+            send_sockets_.remove(socket);
+            disconnected_sockets_.remove(socket);
+            connections_[socket->fd_] = nullptr;
+            releaseStaging(connection);
+            connection_pool_.deallocate(connection);
+            socket_pool_.deallocate(socket);
+        }
+
+        auto releaseStaging(IoUringConnection *connection) noexcept -> void {
+            buffer_pool_.release(connection->staging_, connection->staging_size_);
+            connection->staging_ = nullptr;
+        }
+
+        const unsigned buffer_count_;
+        const size_t buffer_size_;
+
+        char *sq_ring_ = nullptr;
+        char *cq_ring_ = nullptr;
+        size_t sq_ring_size_ = 0;
+        size_t cq_ring_size_ = 0;
+        io_uring_sqe *sqes_ = nullptr;
+        size_t sqes_size_ = 0;
+        unsigned sq_entries_ = 0;
+        unsigned *sq_head_ = nullptr;
+        unsigned *sq_tail_ = nullptr;
+        unsigned sq_mask_ = 0;
+        //sqes handed out / taken by the kernel
+        unsigned sqe_tail_ = 0;
+        unsigned submitted_ = 0;
+        unsigned *cq_head_ = nullptr;
+        unsigned *cq_tail_ = nullptr;
+        unsigned cq_mask_ = 0;
+        io_uring_cqe *cqes_ = nullptr;
+
+        io_uring_buf_ring *buf_ring_ = nullptr;
+        char *buffers_ = nullptr;
+        uint16_t buf_tail_ = 0;
+        uint16_t buf_group_ = BufRingGroup;
+    };
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+
+namespace common {
+    //Log-linear histogram of non-negative samples, e.g. latencies in ns: 16 linear sub-buckets per power of two, so a
+    //percentile is within 1/16 of the true value while min / max / mean are exact. Fixed size, record() is O(1) and
+    //never allocates. Samples of 2^40 and above share the last bucket. Not thread-safe, merge() per-thread copies.
+    class LatencyHistogram final {
+    public:
+        static constexpr size_t SubBucketBits = 4;
+        static constexpr size_t SubBuckets = 1UL << SubBucketBits;
+        static constexpr size_t MaxBits = 40;
+        static constexpr size_t NumBuckets = (MaxBits - SubBucketBits + 1) * SubBuckets;
+
+        auto record(uint64_t value, uint64_t count = 1) noexcept -> void {
+            counts_[index(value)] += count;
+            count_ += count;
+            sum_ += static_cast<double>(value) * count;
+            min_ = std::min(min_, value);
+            max_ = std::max(max_, value);
+        }
+
+        //Coordinated omission correction for a sender that meant to issue a request every expected_interval: a
+        //value that stalled the sender also stands for the requests it should have sent meanwhile, which would have
+        //waited value - interval, value - 2 * interval, ... So a stall shows up in the percentiles by how long it lasted.
+        auto recordCorrected(uint64_t value, uint64_t expected_interval) noexcept -> void {
+            record(value);
+            if (!expected_interval)
+                return;
+            for (auto missed = value; missed > expected_interval;) {
+                missed -= expected_interval;
+                record(missed);
+            }
+        }
+
+        auto merge(const LatencyHistogram &other) noexcept -> void {
+            for (size_t i = 0; i < NumBuckets; ++i)
+                counts_[i] += other.counts_[i];
+            count_ += other.count_;
+            sum_ += other.sum_;
+            min_ = std::min(min_, other.min_);
+            max_ = std::max(max_, other.max_);
+        }
+
+        auto reset() noexcept -> void {
+            *this = LatencyHistogram();
+        }
+
+        //upper end of the bucket holding the p-th sample, p in [0, 1]
+        auto percentile(double p) const noexcept -> uint64_t {
+            if (!count_)
+                return 0;
+            const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * static_cast<double>(count_) + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < NumBuckets; ++i) {
+                seen += counts_[i];
+                if (seen >= rank)
+                    return std::min(std::max(upperBound(i), min_), max_);
+            }
+            return max_;
+        }
+
+        auto count() const noexcept {
+            return count_;
+        }
+
+        auto min() const noexcept -> uint64_t {
+            return count_ ? min_ : 0;
+        }
+
+        auto max() const noexcept {
+            return max_;
+        }
+
+        auto mean() const noexcept -> double {
+            return count_ ? sum_ / static_cast<double>(count_) : 0;
+        }
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << "count:" << count_ << " min:" << min() << " p50:" << percentile(0.5) << " p90:" << percentile(0.9)
+               << " p99:" << percentile(0.99) << " p99.9:" << percentile(0.999) << " p99.99:" << percentile(0.9999)
+               << " max:" << max_ << " mean:" << static_cast<uint64_t>(mean());
+            return ss.str();
+        }
+
+    private:
+        static auto index(uint64_t value) noexcept -> size_t {
+            if (value < SubBuckets)
+                return value;
+            const size_t msb = 63 - __builtin_clzl(value);
+            if (msb >= MaxBits)
+                return NumBuckets - 1;
+            const auto shift = msb - SubBucketBits;
+            return (shift + 1) * SubBuckets + ((value >> shift) - SubBuckets);
+        }
+
+        static auto upperBound(size_t index) noexcept -> uint64_t {
+            if (index < SubBuckets)
+                return index;
+            const auto shift = index / SubBuckets - 1;
+            return ((SubBuckets + index % SubBuckets + 1) << shift) - 1;
+        }
+
+        uint64_t counts_[NumBuckets] = {};
+        uint64_t count_ = 0;
+        double sum_ = 0;
+        uint64_t min_ = std::numeric_limits<uint64_t>::max();
+        uint64_t max_ = 0;
+    };
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <string>
+
+#include "macros.h"
+
+namespace common
+{
+    //One producer, a fixed set of consumers that each read every element at their own pace. The ring is
+    //preallocated like LFQueue's, but an element is written once and shared: every consumer has its own read
+    //sequence, and the producer only reuses a slot once the slowest consumer has moved past it (gating). The
+    //producer learns the slowest sequence by scanning the consumers only when its cached copy says the ring is full,
+    //consumers read the producer's cursor only when their cached copy says they caught up. readBatch() hands a
+    //consumer everything published so far and moves its sequence once for the whole batch.
+    //Sequences count from 0 and never wrap; the size must be a power of two so a slot is sequence & mask.
+    template<typename T>
+    class LFMulticastQueue final
+    {
+    public:
+        //sequence of a removed consumer, never the minimum
+        static constexpr uint64_t Removed = std::numeric_limits<uint64_t>::max();
+
+        LFMulticastQueue(std::size_t num_elems, std::size_t num_consumers)
+            : store_(num_elems, T()), mask_(num_elems - 1), consumers_(num_consumers)
+        {
+            ASSERT(num_elems && !(num_elems & (num_elems - 1)), "LFMulticastQueue size must be a power of two, not " + std::to_string(num_elems));
+            ASSERT(num_consumers, "LFMulticastQueue needs at least one consumer.");
+        }
+
+        LFMulticastQueue() = delete;
+        LFMulticastQueue(const LFMulticastQueue&) = delete;
+        LFMulticastQueue(const LFMulticastQueue&&) = delete;
+        LFMulticastQueue &operator=(const LFMulticastQueue &) = delete;
+        LFMulticastQueue &operator=(const LFMulticastQueue &&) = delete;
+
+        /* producer */
+
+        //slot to write the next element into, nullptr while that would overrun the slowest consumer
+        auto getNextToWriteTo() noexcept -> T *
+        {
+            if (UNLIKELY(next_write_ - gate_cache_ > mask_))
+            {
+                gate_cache_ = minConsumerSequence();
+                if (next_write_ - gate_cache_ > mask_)
+                    return nullptr;
+            }
+            return &store_[next_write_ & mask_];
+        }
+
+        //publish the element written to getNextToWriteTo() to every consumer
+        auto updateWriteIndex() noexcept
+        {
+            cursor_.store(++next_write_, std::memory_order_release);
+        }
+
+        /* consumer, consumer is an index in [0, num_consumers) and each one is read by one thread */
+
+        auto getNextToRead(std::size_t consumer) noexcept -> const T *
+        {
+            auto &cursor = consumers_[consumer];
+            const auto sequence = cursor.sequence_.load(std::memory_order_relaxed);
+            if (sequence == cursor.cursor_cache_)
+            {
+                cursor.cursor_cache_ = cursor_.load(std::memory_order_acquire);
+                if (sequence == cursor.cursor_cache_)
+                    return nullptr;
+            }
+            return &store_[sequence & mask_];
+        }
+
+        //done with the element from getNextToRead(), the producer may reuse its slot once every consumer is
+        auto updateReadIndex(std::size_t consumer) noexcept
+        {
+            auto &cursor = consumers_[consumer];
+            cursor.sequence_.store(cursor.sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        //handler(const T &) for up to max_elems published elements in order, then one sequence update for all of
+        //them. Returns the number handled. The slots stay reserved while the handler runs.
+        template<typename Handler>
+        auto readBatch(std::size_t consumer, Handler &&handler, std::size_t max_elems = std::numeric_limits<std::size_t>::max()) noexcept -> std::size_t
+        {
+            auto &cursor = consumers_[consumer];
+            const auto sequence = cursor.sequence_.load(std::memory_order_relaxed);
+            if (sequence == cursor.cursor_cache_)
+                cursor.cursor_cache_ = cursor_.load(std::memory_order_acquire);
+            const auto count = static_cast<std::size_t>(std::min<uint64_t>(cursor.cursor_cache_ - sequence, max_elems));
+            for (std::size_t i = 0; i < count; ++i)
+                handler(store_[(sequence + i) & mask_]);
+            if (count)
+                cursor.sequence_.store(sequence + count, std::memory_order_release);
+            return count;
+        }
+
+        //elements published but not yet read by consumer
+        auto size(std::size_t consumer) const noexcept
+        {
+            return cursor_.load(std::memory_order_acquire) - consumers_[consumer].sequence_.load(std::memory_order_acquire);
+        }
+
+        //Stop gating on a consumer that is gone (e.g. a recorder that died), so it cannot stall the producer.
+        //Called from the consumer's thread, or once it stopped reading.
+        auto removeConsumer(std::size_t consumer) noexcept
+        {
+            consumers_[consumer].sequence_.store(Removed, std::memory_order_release);
+        }
+
+        auto numConsumers() const noexcept
+        {
+            return consumers_.size();
+        }
+
+        auto capacity() const noexcept
+        {
+            return store_.size();
+        }
+
+    private:
+        auto minConsumerSequence() const noexcept -> uint64_t
+        {
+            auto min_sequence = next_write_;
+            for (const auto &cursor : consumers_)
+                min_sequence = std::min(min_sequence, cursor.sequence_.load(std::memory_order_acquire));
+            return min_sequence;
+        }
+
+        //every consumer's read sequence on its own cache line, with the cursor it last saw next to it
+        struct alignas(64) ConsumerCursor
+        {
+            std::atomic<uint64_t> sequence_ = {0};
+            uint64_t cursor_cache_ = 0;
+        };
+
+        std::vector<T> store_;
+        const uint64_t mask_;
+        std::vector<ConsumerCursor> consumers_;
+        //producer side: published sequence, next sequence and the slowest consumer as last seen
+        alignas(64) std::atomic<uint64_t> cursor_ = {0};
+        alignas(64) uint64_t next_write_ = 0;
+        uint64_t gate_cache_ = 0;
+    };
+}
@@ -102,11 +102,12 @@ namespace common
             }
         }
 
-        explicit Logger(const std::string &file_name) : file_name_(file_name), queue_(LOG_QUEUE_SIZE)
+        //core_id is usually CorePlacementPlanner::coreFor("logger"), -1 leaves the thread unpinned
+        explicit Logger(const std::string &file_name, int core_id = -1) : file_name_(file_name), queue_(LOG_QUEUE_SIZE)
         {
             file_.open(file_name);
             ASSERT(file_.is_open(), "Could not open log file: " + file_name);
-            logger_thread_ = createAndStartThread(-1, "common/Logger", [this]()
+            logger_thread_ = createAndStartThread(core_id, "common/Logger", [this]()
                                                   { flushQueue(); });
 
             ASSERT(logger_thread_ != nullptr, "Failed to start Logger thread.");
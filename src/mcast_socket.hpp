@@ -0,0 +1,245 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <sys/uio.h>
+#include "socket_utils.hpp"
+#include "logger.hpp"
+
+namespace common {
+    //largest datagram a packet slot holds, longer ones are truncated by the kernel and dropped
+    constexpr size_t McastPacketSize = 2048;
+    //packet slots on each side, i.e. the most datagrams moved by one recvmmsg() / sendmmsg()
+    constexpr size_t McastBatchSize = 64;
+
+    //UDP multicast socket moving datagrams in batches through preallocated packet slots.
+    //Received datagrams are handed to recv_callback_ in place: data points into a receive slot and is only valid
+    //during the callback. send() copies into a send slot, flush() hands all queued slots to one sendmmsg().
+    struct McastSocket {
+        int fd_ = -1;
+        size_t packet_size_ = McastPacketSize;
+        size_t batch_size_ = McastBatchSize;
+        //interface ip for IP_MULTICAST_IF and memberships
+        std::string iface_ip_;
+
+        //receive slots: one packet buffer, iovec, control buffer and mmsghdr each, wired together once
+        std::vector<char> rcv_packets_;
+        std::vector<iovec> rcv_iovs_;
+        std::vector<char> rcv_ctrl_;
+        std::vector<mmsghdr> rcv_msgs_;
+
+        //send slots [send_head_, send_tail_) are queued, reset to 0 once everything went out
+        std::vector<char> send_packets_;
+        std::vector<iovec> send_iovs_;
+        std::vector<mmsghdr> send_msgs_;
+        size_t send_head_ = 0;
+        size_t send_tail_ = 0;
+
+        //handed to recv_callback_, truncated datagrams only count in datagrams_dropped_
+        size_t datagrams_received_ = 0;
+        size_t datagrams_sent_ = 0;
+        size_t datagrams_dropped_ = 0;
+        size_t recv_calls_ = 0;
+        size_t send_calls_ = 0;
+
+        std::function<void(McastSocket *s, const char *data, size_t len, Nanos rx_time)> recv_callback_;
+        //send timestamps, see enableTxTimestamps(): the datagram-th datagram sent left for the device at tx_time
+        std::function<void(McastSocket *s, uint64_t datagram, Nanos tx_time)> tx_timestamp_callback_;
+        bool tx_timestamps_ = false;
+        //datagrams_sent_ when timestamps were enabled and the last datagram number reported, to undo the 32 bit key wrap
+        uint64_t tx_key_base_ = 0;
+        uint64_t last_tx_datagram_ = 0;
+        std::string time_str_;
+        Logger &logger_;
+
+        static constexpr size_t CtrlSize = TimestampCtrlSize;
+
+        auto defaultRecvCallback(McastSocket *socket, const char *, size_t len, Nanos rx_time) noexcept
+        {
+            logger_.log("%:% %() % McastSocket::defaultRecvCallback() socket:% len:% rx:%\n", __FILE__, __LINE__, __FUNCTION__,
+            getCurrentTimeStr(&time_str_), socket->fd_, len, rx_time);
+        }
+
+        explicit McastSocket(Logger &logger, size_t packet_size = McastPacketSize, size_t batch_size = McastBatchSize)
+            : packet_size_(packet_size), batch_size_(batch_size),
+              rcv_packets_(packet_size * batch_size), rcv_iovs_(batch_size), rcv_ctrl_(CtrlSize * batch_size), rcv_msgs_(batch_size),
+              send_packets_(packet_size * batch_size), send_iovs_(batch_size), send_msgs_(batch_size), logger_(logger) {
+            ASSERT(packet_size && batch_size, "McastSocket packet size and batch size must be > 0.");
+            for (size_t i = 0; i < batch_size_; ++i) {
+                rcv_iovs_[i] = {rcv_packets_.data() + i * packet_size_, packet_size_};
+                rcv_msgs_[i] = {};
+                rcv_msgs_[i].msg_hdr.msg_iov = &rcv_iovs_[i];
+                rcv_msgs_[i].msg_hdr.msg_iovlen = 1;
+                rcv_msgs_[i].msg_hdr.msg_control = rcv_ctrl_.data() + i * CtrlSize;
+
+                send_iovs_[i] = {send_packets_.data() + i * packet_size_, 0};
+                send_msgs_[i] = {};
+                send_msgs_[i].msg_hdr.msg_iov = &send_iovs_[i];
+                send_msgs_[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            recv_callback_ = [this](auto socket, auto data, auto len, auto rx_time) {
+                defaultRecvCallback(socket, data, len, rx_time);
+            };
+            tx_timestamp_callback_ = [](auto, auto, auto) {};
+        }
+
+        ~McastSocket() {
+            destroy();
+        }
+
+        McastSocket() = delete;
+        McastSocket(const McastSocket &) = delete;
+        McastSocket(const McastSocket &&) = delete;
+        McastSocket &operator=(const McastSocket &) = delete;
+        McastSocket &operator=(const McastSocket &&) = delete;
+
+        auto destroy() noexcept -> void {
+            if (fd_ != -1)
+                close(fd_);
+            fd_ = -1;
+            send_head_ = send_tail_ = 0;
+            tx_timestamps_ = false;
+        }
+
+        //Listening sockets bind ip:port's port on all addresses and receive the groups they join(), the others
+        //send to the group ip:port out of iface, with loopback delivery so local members see the packets too.
+        auto init(const std::string &ip, const std::string &iface, int port, bool is_listening) -> int {
+            destroy();
+            iface_ip_ = getIfaceIP(iface);
+            fd_ = createSocket(logger_, SocketCfg{ip, iface, port, true, is_listening, true, false});
+            if (!is_listening) {
+                ASSERT(setMcastInterface(fd_, iface_ip_), "setMcastInterface() failed. errno:" + std::string(strerror(errno)));
+                ASSERT(setMcastLoop(fd_, true), "setMcastLoop() failed. errno:" + std::string(strerror(errno)));
+            }
+            return fd_;
+        }
+
+        auto join(const std::string &ip) noexcept -> bool {
+            return common::join(fd_, ip, iface_ip_);
+        }
+
+        auto leave(const std::string &ip) noexcept -> bool {
+            return common::leave(fd_, ip, iface_ip_);
+        }
+
+        //Ask for a software send timestamp of every datagram, numbered in the order sent since construction.
+        //They are read back from the error queue by readTxTimestamps() and reported to tx_timestamp_callback_.
+        auto enableTxTimestamps() noexcept -> bool {
+            if (!setTxTimestamping(fd_))
+                return false;
+            tx_key_base_ = last_tx_datagram_ = datagrams_sent_;
+            tx_timestamps_ = true;
+            return true;
+        }
+
+        auto readTxTimestamps() noexcept -> void {
+            ErrQueueEntry entry;
+            while (recvErrQueue(fd_, &entry)) {
+                if (entry.origin_ != SO_EE_ORIGIN_TIMESTAMPING || !entry.tx_time_)
+                    continue;
+                const auto relative = last_tx_datagram_ - tx_key_base_;
+                last_tx_datagram_ += static_cast<uint32_t>(entry.lo_ - static_cast<uint32_t>(relative));
+                tx_timestamp_callback_(this, last_tx_datagram_, entry.tx_time_);
+            }
+        }
+
+        auto pendingSendDatagrams() const noexcept -> size_t {
+            return send_tail_ - send_head_;
+        }
+
+        //Queue one datagram, flushing first when every send slot is taken. False if it is too large or the slots
+        //are still full after the flush - like the network, the datagram is dropped rather than blocking.
+        auto send(const void *data, size_t len) noexcept -> bool {
+            if (UNLIKELY(len > packet_size_)) {
+                ++datagrams_dropped_;
+                return false;
+            }
+
+            if (UNLIKELY(send_tail_ == batch_size_)) {
+                flush();
+                if (send_tail_ == batch_size_) {
+                    ++datagrams_dropped_;
+                    return false;
+                }
+            }
+
+            auto &iov = send_iovs_[send_tail_++];
+            memcpy(iov.iov_base, data, len);
+            iov.iov_len = len;
+            return true;
+        }
+
+        //All queued datagrams in as few sendmmsg() calls as the kernel allows, whatever is left on EAGAIN stays queued.
+        auto flush() noexcept -> void {
+            while (pendingSendDatagrams()) {
+                const auto n = sendmmsg(fd_, &send_msgs_[send_head_], pendingSendDatagrams(), MSG_DONTWAIT | MSG_NOSIGNAL);
+                ++send_calls_;
+                if (UNLIKELY(n <= 0)) {
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n < 0 && !wouldBlock()) {
+                        //e.g. ECONNREFUSED / ENETUNREACH for the datagram at send_head_, skip it so the rest can go
+                        logger_.log("%:% %() % sendmmsg() failed socket:% errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, strerror(errno));
+                        ++send_head_;
+                        ++datagrams_dropped_;
+                        continue;
+                    }
+                    break;
+                }
+
+                send_head_ += n;
+                datagrams_sent_ += n;
+            }
+
+            if (!pendingSendDatagrams()) {
+                send_head_ = send_tail_ = 0;
+            } else if (send_head_) {
+                //keep the queued datagrams at the front so send() always has the slots after send_tail_
+                for (size_t i = send_head_; i < send_tail_; ++i) {
+                    memcpy(send_iovs_[i - send_head_].iov_base, send_iovs_[i].iov_base, send_iovs_[i].iov_len);
+                    send_iovs_[i - send_head_].iov_len = send_iovs_[i].iov_len;
+                }
+                send_tail_ -= send_head_;
+                send_head_ = 0;
+            }
+        }
+
+        //One recvmmsg() for up to batch_size_ datagrams, each handed to recv_callback_ with its nanosecond kernel timestamp.
+        //Returns the number of datagrams received, <= 0 if there were none.
+        auto recv() noexcept -> int {
+            for (size_t i = 0; i < batch_size_; ++i)
+                rcv_msgs_[i].msg_hdr.msg_controllen = CtrlSize;
+
+            const auto n = recvmmsg(fd_, rcv_msgs_.data(), batch_size_, MSG_DONTWAIT, nullptr);
+            ++recv_calls_;
+            if (n <= 0)
+                return n;
+
+            const auto user_time = getCurrentNanos();
+            for (int i = 0; i < n; ++i) {
+                auto &hdr = rcv_msgs_[i].msg_hdr;
+                if (UNLIKELY(hdr.msg_flags & MSG_TRUNC)) {
+                    logger_.log("%:% %() % truncated datagram dropped socket:% packet_size:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, packet_size_);
+                    ++datagrams_dropped_;
+                    continue;
+                }
+
+                const auto kernel_time = getRxTimestamp(&hdr);
+                ++datagrams_received_;
+                recv_callback_(this, static_cast<const char *>(rcv_iovs_[i].iov_base), rcv_msgs_[i].msg_len, kernel_time);
+            }
+
+            logger_.log("%:% %() % read socket:% datagrams:% utime:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, n, user_time);
+            return n;
+        }
+
+        auto sendAndRecv() noexcept -> bool {
+            const auto n_rcv = recv();
+            flush();
+            if (tx_timestamps_)
+                readTxTimestamps();
+            return (n_rcv > 0);
+        }
+    };
+}
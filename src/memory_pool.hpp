@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <utility>
 
 #include "macros.h"
 
@@ -13,7 +14,8 @@ namespace common
     class MemoryPool final
     {
         public:
-            explicit MemoryPool(std::size_t num_elems): store_ (num_elems, {T(), true})
+            //blocks hold raw storage, T is only constructed by allocate(), so T need not be default constructible or copyable
+            explicit MemoryPool(std::size_t num_elems): store_ (num_elems)
             {
                 ASSERT(reinterpret_cast<const ObjectBlock *>(&(store_[0].object_)) == &(store_[0]), "T object should be first member of ObjectBlock.");
             }
@@ -37,19 +39,24 @@ namespace common
                     }
                     if (UNLIKELY(initial_free_index == next_free_index_))
                     {
-                        ASSERT(initial_free_index != next_free_index_, "Memory Pool is out of space.");
+                        //pool is full, next_free_index_ is moved to the next block given back in deallocate()
+                        return;
                     }
                 }
             }
 
+            auto isFull() const noexcept
+            {
+                return !store_[next_free_index_].is_free_;
+            }
+
             template<typename... Args>
-            T *allocate(Args... args) noexcept
+            T *allocate(Args&&... args) noexcept
             {
                 auto obj_block = &(store_[next_free_index_]);
-                ASSERT(obj_block->is_free_, "Expected free ObjectBlock at index: " + std::to_string(next_free_index_));
+                ASSERT(obj_block->is_free_, "Memory Pool is out of space, expected free ObjectBlock at index: " + std::to_string(next_free_index_));
 
-                T *ret = &(obj_block->object_);
-                ret = new(ret) T(args...);
+                T *ret = new(obj_block->object_) T(std::forward<Args>(args)...);
                 obj_block->is_free_ = false;
 
                 UpdateNextFreeIndex();
@@ -62,13 +69,16 @@ namespace common
                 ASSERT(elem_index >= 0 && static_cast<size_t>(elem_index) < store_.size(), "Element subjected to deallocation did not belong to this Memory Pool.");
                 ASSERT(!store_[elem_index].is_free_, "Expected current issued ObjectBlock at index: " + std::to_string(elem_index));
 
+                elem->~T();
                 store_[elem_index].is_free_ = true;
+                if (UNLIKELY(isFull()))
+                    next_free_index_ = elem_index;
             }
 
         private:
             struct ObjectBlock
             {
-                T object_;
+                alignas(T) unsigned char object_[sizeof(T)];
                 bool is_free_ = true;
             };
             std::vector<ObjectBlock> store_;
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "macros.h"
+#include "tcp_socket.hpp"
+
+namespace common {
+    //Frames are a LengthT body length in host byte order followed by the body. Lengths above MaxBodySize are treated
+    //as a corrupt stream. Messages are views of the body inside the receive buffer.
+    template<typename LengthT = uint32_t, size_t MaxBodySize = TCPBufferSize / 2>
+    struct LengthPrefixedCodec {
+        static_assert(std::is_unsigned_v<LengthT>, "LengthPrefixedCodec length must be an unsigned integer.");
+        using Message = std::string_view;
+        static constexpr size_t HeaderSize = sizeof(LengthT);
+
+        //bytes needed for the frame at data: the header size while it is incomplete, 0 for a corrupt length
+        static auto frameSize(const char *data, size_t available) noexcept -> size_t {
+            if (available < HeaderSize)
+                return HeaderSize;
+            LengthT body_len;
+            memcpy(&body_len, data, HeaderSize);
+            return body_len <= MaxBodySize ? HeaderSize + body_len : 0;
+        }
+
+        static auto message(const char *frame, size_t frame_size) noexcept -> Message {
+            return {frame + HeaderSize, frame_size - HeaderSize};
+        }
+
+        static constexpr auto encodedSize(size_t body_len) noexcept -> size_t {
+            return HeaderSize + body_len;
+        }
+
+        //writes the header, returns where the body goes
+        static auto encodeHeader(char *frame, size_t body_len) noexcept -> char * {
+            const auto len = static_cast<LengthT>(body_len);
+            memcpy(frame, &len, HeaderSize);
+            return frame + HeaderSize;
+        }
+    };
+
+    //Frames are one T each, e.g. a packed wire struct. Messages are references into the receive buffer: frames start
+    //at multiples of sizeof(T) from the buffer start, which is aligned for any T up to max_align_t.
+    template<typename T>
+    struct FixedSizeCodec {
+        static_assert(std::is_trivially_copyable_v<T>, "FixedSizeCodec needs a trivially copyable message type.");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "FixedSizeCodec message type is over-aligned.");
+        using Message = const T &;
+
+        static auto frameSize(const char *, size_t) noexcept -> size_t {
+            return sizeof(T);
+        }
+
+        static auto message(const char *frame, size_t) noexcept -> Message {
+            return *reinterpret_cast<const T *>(frame);
+        }
+
+        static constexpr auto encodedSize(size_t) noexcept -> size_t {
+            return sizeof(T);
+        }
+
+        static auto encodeHeader(char *frame, size_t) noexcept -> char * {
+            return frame;
+        }
+    };
+
+    //Splits a TCPSocket's byte stream into Codec frames. Hook onRecv() into the socket's / server's recv_callback_:
+    //complete messages go to message_callback_ as views into rcv_buffer_, valid during the callback only, and a
+    //trailing partial frame stays where it is. The partial frame is only moved to the front of the buffer when the
+    //rest of it would not fit behind it, and a fully consumed buffer is rewound without copying anything.
+    //Encoders write frames straight into the send ring via sendReserve() / sendCommit().
+    template<typename Codec>
+    class MessageFramer final {
+    public:
+        using Message = typename Codec::Message;
+
+        std::function<void(TCPSocket *s, Message msg, Nanos rx_time)> message_callback_;
+        size_t messages_received_ = 0;
+        size_t compactions_ = 0;
+        size_t framing_errors_ = 0;
+        //frames encoded into a copy because the ring tail had no contiguous room
+        size_t encode_copies_ = 0;
+
+        explicit MessageFramer(Logger &logger) : logger_(logger) {
+            message_callback_ = [](auto, auto, auto) {};
+        }
+
+        MessageFramer() = delete;
+        MessageFramer(const MessageFramer &) = delete;
+        MessageFramer(const MessageFramer &&) = delete;
+        MessageFramer &operator=(const MessageFramer &) = delete;
+        MessageFramer &operator=(const MessageFramer &&) = delete;
+
+        //for TCPSocket::recv_callback_ / TCPServer::recv_callback_
+        auto recvCallback() noexcept {
+            return [this](TCPSocket *socket, Nanos rx_time) { onRecv(socket, rx_time); };
+        }
+
+        //Deliver every complete frame received so far. A corrupt frame, or one that can never fit the socket's
+        //max_buffer_size_, marks the socket recv_disconnected_.
+        auto onRecv(TCPSocket *socket, Nanos rx_time) noexcept -> size_t {
+            return onRecvWith(socket, rx_time, message_callback_);
+        }
+
+        //onRecv() calling handler(TCPSocket *, Message, Nanos rx_time) per message instead of message_callback_,
+        //resolved at compile time so it inlines into the framing loop
+        template<typename Handler>
+        auto onRecvWith(TCPSocket *socket, Nanos rx_time, Handler &&handler) noexcept -> size_t {
+            const auto data = socket->rcv_buffer_;
+            const auto valid = socket->next_rcv_valid_index_;
+            auto read = socket->rcv_read_index_;
+            size_t needed = 0;
+            size_t delivered = 0;
+
+            while (read < valid) {
+                const auto available = valid - read;
+                const auto frame_size = Codec::frameSize(data + read, available);
+                //a frame larger than the buffer can grow would fill it and stall the socket with no room to read into
+                if (UNLIKELY(!frame_size || frame_size > socket->max_buffer_size_)) {
+                    logger_.log("%:% %() % framing error, closing socket:% offset:% frame_size:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, read, frame_size);
+                    ++framing_errors_;
+                    socket->recv_disconnected_ = true;
+                    read = valid;
+                    break;
+                }
+                if (frame_size > available) {
+                    needed = frame_size;
+                    break;
+                }
+
+                handler(socket, Codec::message(data + read, frame_size), rx_time);
+                read += frame_size;
+                ++delivered;
+            }
+            messages_received_ += delivered;
+
+            if (read == valid) {
+                socket->rcv_read_index_ = socket->next_rcv_valid_index_ = 0;
+            } else if (read && needed - (valid - read) > socket->rcv_buffer_size_ - valid) {
+                //the rest of the partial frame does not fit behind it, move it to the front
+                memmove(data, data + read, valid - read);
+                socket->next_rcv_valid_index_ = valid - read;
+                socket->rcv_read_index_ = 0;
+                ++compactions_;
+            } else {
+                socket->rcv_read_index_ = read;
+            }
+            return delivered;
+        }
+
+        //Queue one frame with a body_len byte body written by write_body(char *body) in place in the send ring.
+        //If the ring tail has no contiguous room the frame is encoded into a scratch buffer and copied by send().
+        template<typename F>
+        auto sendWith(TCPSocket *socket, size_t body_len, F &&write_body) noexcept -> bool {
+            const auto frame_size = Codec::encodedSize(body_len);
+            if (auto frame = socket->sendReserve(frame_size); LIKELY(frame != nullptr)) {
+                write_body(Codec::encodeHeader(frame, body_len));
+                socket->sendCommit(frame_size);
+                return true;
+            }
+
+            ++encode_copies_;
+            if (scratch_.size() < frame_size)
+                scratch_.resize(frame_size);
+            write_body(Codec::encodeHeader(scratch_.data(), body_len));
+            return socket->send(scratch_.data(), frame_size);
+        }
+
+        auto send(TCPSocket *socket, const void *body, size_t body_len) noexcept -> bool {
+            return sendWith(socket, body_len, [body, body_len](char *dst) { memcpy(dst, body, body_len); });
+        }
+
+    private:
+        std::vector<char> scratch_;
+        std::string time_str_;
+        Logger &logger_;
+    };
+}
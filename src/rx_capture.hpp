@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "logger.hpp"
+
+namespace common {
+    constexpr uint64_t RxCaptureMagic = 0x31505943584c4352ULL;
+    constexpr uint32_t RxCaptureVersion = 1;
+    //file size a capture starts at, doubled whenever it fills up
+    constexpr size_t RxCaptureInitialSize = 64 * 1024 * 1024;
+
+    enum class RxRecordType : uint16_t {
+        //len_ bytes read from connection_id_, they follow the record
+        DATA = 0,
+        //the server's recv_finished_callback_ ran: the end of one sendAndRecv() worth of reads
+        RECV_FINISHED = 1
+    };
+
+    //Start of the file. end_ is the offset past the last complete record, published after the record is written,
+    //so a reader (or the file left by a crash) never sees a torn record.
+    struct RxCaptureFileHeader {
+        uint64_t magic_;
+        uint32_t version_;
+        uint32_t header_size_;
+        std::atomic<uint64_t> end_;
+        Nanos start_time_;
+    };
+
+    //One record, 8 byte aligned; the payload is padded to the next multiple of 8.
+    struct RxCaptureRecord {
+        //kernel receive time (0 when the socket carried none) and when the application read the chunk
+        Nanos kernel_time_;
+        Nanos user_time_;
+        uint32_t connection_id_;
+        RxRecordType type_;
+        uint16_t reserved_;
+        uint32_t len_;
+        uint32_t reserved2_;
+    };
+
+    inline constexpr auto rxRecordSize(size_t len) noexcept -> size_t {
+        return sizeof(RxCaptureRecord) + ((len + 7) & ~size_t{7});
+    }
+
+    //Append-only capture of received chunks in a memory-mapped file, written by the one thread that reads the
+    //sockets (see TCPSocket::rx_capture_ and TCPServer::rx_capture_). append() is two memcpy() and a release store;
+    //the file is pre-sized and its pages faulted in up front, so the hot path makes no syscall until the file fills
+    //up and is doubled. A chunk that cannot be written (disk full) is counted in dropped_ and capturing goes on.
+    class RxCapture final {
+    public:
+        RxCapture(Logger &logger, const std::string &path, size_t initial_size = RxCaptureInitialSize) : path_(path), logger_(logger) {
+            fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            ASSERT(fd_ >= 0, "Could not open capture file: " + path + " error:" + std::string(std::strerror(errno)));
+            ASSERT(map(std::max(initial_size, sizeof(RxCaptureFileHeader) + rxRecordSize(0))), "Could not map capture file: " + path + " error:" + std::string(std::strerror(errno)));
+            header_->magic_ = RxCaptureMagic;
+            header_->version_ = RxCaptureVersion;
+            header_->header_size_ = sizeof(RxCaptureFileHeader);
+            header_->start_time_ = getCurrentNanos();
+            end_ = sizeof(RxCaptureFileHeader);
+            header_->end_.store(end_, std::memory_order_release);
+        }
+
+        //the file is cut back to the records written
+        ~RxCapture() {
+            if (base_) {
+                msync(base_, end_, MS_ASYNC);
+                munmap(base_, size_);
+            }
+            if (ftruncate(fd_, static_cast<off_t>(end_)) != 0)
+                logger_.log("%:% %() % ftruncate() failed capture:% error:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), path_, strerror(errno));
+            close(fd_);
+        }
+
+        RxCapture() = delete;
+        RxCapture(const RxCapture &) = delete;
+        RxCapture(const RxCapture &&) = delete;
+        RxCapture &operator=(const RxCapture &) = delete;
+        RxCapture &operator=(const RxCapture &&) = delete;
+
+        auto append(uint32_t connection_id, Nanos kernel_time, Nanos user_time, const char *data, size_t len) noexcept -> void {
+            const auto record_size = rxRecordSize(len);
+            if (UNLIKELY(end_ + record_size > size_) && !grow(end_ + record_size)) {
+                ++dropped_;
+                return;
+            }
+            const RxCaptureRecord record{kernel_time, user_time, connection_id, RxRecordType::DATA, 0, static_cast<uint32_t>(len), 0};
+            memcpy(base_ + end_, &record, sizeof(record));
+            memcpy(base_ + end_ + sizeof(record), data, len);
+            publish(record_size);
+            bytes_ += len;
+        }
+
+        auto appendRecvFinished(Nanos user_time) noexcept -> void {
+            const auto record_size = rxRecordSize(0);
+            if (UNLIKELY(end_ + record_size > size_) && !grow(end_ + record_size)) {
+                ++dropped_;
+                return;
+            }
+            const RxCaptureRecord record{0, user_time, 0, RxRecordType::RECV_FINISHED, 0, 0, 0};
+            memcpy(base_ + end_, &record, sizeof(record));
+            publish(record_size);
+        }
+
+        auto records() const noexcept {
+            return records_;
+        }
+
+        auto bytes() const noexcept {
+            return bytes_;
+        }
+
+        auto dropped() const noexcept {
+            return dropped_;
+        }
+
+        auto path() const noexcept -> const std::string & {
+            return path_;
+        }
+
+    private:
+        auto publish(size_t record_size) noexcept -> void {
+            end_ += record_size;
+            ++records_;
+            header_->end_.store(end_, std::memory_order_release);
+        }
+
+        //size the file and map it whole, with its pages faulted in; fallocate() so a full disk fails here and not
+        //as SIGBUS on a later store
+        auto map(size_t size) noexcept -> bool {
+            if (const auto error = posix_fallocate(fd_, 0, static_cast<off_t>(size))) {
+                errno = error;
+                return false;
+            }
+            auto base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, 0);
+            if (base == MAP_FAILED)
+                return false;
+            if (base_)
+                munmap(base_, size_);
+            base_ = static_cast<char *>(base);
+            size_ = size;
+            header_ = reinterpret_cast<RxCaptureFileHeader *>(base_);
+            return true;
+        }
+
+        auto grow(size_t needed) noexcept -> bool {
+            auto size = size_;
+            while (size < needed)
+                size *= 2;
+            logger_.log("%:% %() % growing capture:% size:% -> %\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), path_, size_, size);
+            if (map(size))
+                return true;
+            logger_.log("%:% %() % could not grow capture:% error:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), path_, strerror(errno));
+            return false;
+        }
+
+        const std::string path_;
+        int fd_ = -1;
+        char *base_ = nullptr;
+        size_t size_ = 0;
+        RxCaptureFileHeader *header_ = nullptr;
+        //writer's copy of header_->end_
+        size_t end_ = 0;
+        size_t records_ = 0;
+        size_t bytes_ = 0;
+        size_t dropped_ = 0;
+        std::string time_str_;
+        Logger &logger_;
+    };
+
+    //Read side of a capture file: maps it read-only and walks the complete records. A file still being written is
+    //read up to the end_ it had when opened.
+    class RxCaptureReader final {
+    public:
+        explicit RxCaptureReader(const std::string &path) {
+            fd_ = open(path.c_str(), O_RDONLY);
+            ASSERT(fd_ >= 0, "Could not open capture file: " + path + " error:" + std::string(std::strerror(errno)));
+            struct stat st;
+            ASSERT(fstat(fd_, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(RxCaptureFileHeader), "Not a capture file: " + path);
+            size_ = st.st_size;
+            auto base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            ASSERT(base != MAP_FAILED, "Could not map capture file: " + path + " error:" + std::string(std::strerror(errno)));
+            base_ = static_cast<const char *>(base);
+            header_ = reinterpret_cast<const RxCaptureFileHeader *>(base_);
+            ASSERT(header_->magic_ == RxCaptureMagic && header_->version_ == RxCaptureVersion, "Not a version " + std::to_string(RxCaptureVersion) + " capture file: " + path);
+            end_ = std::min<size_t>(header_->end_.load(std::memory_order_acquire), size_);
+            rewind();
+        }
+
+        ~RxCaptureReader() {
+            munmap(const_cast<char *>(base_), size_);
+            close(fd_);
+        }
+
+        RxCaptureReader() = delete;
+        RxCaptureReader(const RxCaptureReader &) = delete;
+        RxCaptureReader(const RxCaptureReader &&) = delete;
+        RxCaptureReader &operator=(const RxCaptureReader &) = delete;
+        RxCaptureReader &operator=(const RxCaptureReader &&) = delete;
+
+        //the next record, its payload at data(record); nullptr past the last one
+        auto next() noexcept -> const RxCaptureRecord * {
+            if (offset_ + sizeof(RxCaptureRecord) > end_)
+                return nullptr;
+            auto record = reinterpret_cast<const RxCaptureRecord *>(base_ + offset_);
+            if (UNLIKELY(offset_ + rxRecordSize(record->len_) > end_))
+                return nullptr;
+            offset_ += rxRecordSize(record->len_);
+            return record;
+        }
+
+        static auto data(const RxCaptureRecord *record) noexcept -> const char * {
+            return reinterpret_cast<const char *>(record + 1);
+        }
+
+        auto rewind() noexcept -> void {
+            offset_ = header_->header_size_;
+        }
+
+        auto startTime() const noexcept {
+            return header_->start_time_;
+        }
+
+    private:
+        int fd_ = -1;
+        const char *base_ = nullptr;
+        size_t size_ = 0;
+        size_t end_ = 0;
+        size_t offset_ = 0;
+        const RxCaptureFileHeader *header_ = nullptr;
+    };
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "logger.hpp"
+#include "tcp_socket.hpp"
+#include "memory_pool.hpp"
+#include "rx_capture.hpp"
+
+namespace common {
+    enum class ReplaySpeed : uint8_t {
+        //chunks are handed over with the gaps they were read with
+        RECORDED = 0,
+        //back to back, for profiling the callbacks
+        MAX = 1
+    };
+
+    //Feeds an RxCapture file back into recv callbacks without any socket: every captured connection gets a TCPSocket
+    //(fd_ -1) whose rcv_buffer_ receives the chunks in capture order, the callback is called with the recorded kernel
+    //time, and each RECV_FINISHED record calls recv_finished_callback_. Bytes the callbacks left in rcv_buffer_ stay
+    //there like on a live socket, so framing code sees the same buffer states. Replies the callbacks send() are
+    //counted and discarded.
+    class RxReplay final {
+    public:
+        std::function<void(TCPSocket *s, Nanos rx_time)> recv_callback_;
+        std::function<void()> recv_finished_callback_;
+        uint64_t chunks_ = 0;
+        uint64_t bytes_ = 0;
+        uint64_t recv_finished_ = 0;
+        uint64_t sent_bytes_ = 0;
+        //chunks that did not fit rcv_buffer_ at max_buffer_size, the live socket could not have read them either
+        uint64_t truncated_bytes_ = 0;
+
+        RxReplay(Logger &logger, const std::string &path, size_t initial_buffer_size = TCPInitialBufferSize, size_t max_buffer_size = TCPBufferSize)
+            : reader_(path), sockets_(maxConnectionId(reader_) + 1, nullptr), socket_pool_(sockets_.size()), logger_(logger) {
+            for (auto record = reader_.next(); record; record = reader_.next()) {
+                if (record->type_ != RxRecordType::DATA || sockets_[record->connection_id_])
+                    continue;
+                auto socket = socket_pool_.allocate(logger_, nullptr, initial_buffer_size, max_buffer_size);
+                socket->capture_id_ = record->connection_id_;
+                sockets_[record->connection_id_] = socket;
+            }
+            reader_.rewind();
+
+            recv_callback_ = [](auto, auto) {};
+            recv_finished_callback_ = []() {};
+        }
+
+        ~RxReplay() {
+            for (auto socket : sockets_)
+                if (socket)
+                    socket_pool_.deallocate(socket);
+        }
+
+        RxReplay() = delete;
+        RxReplay(const RxReplay &) = delete;
+        RxReplay(const RxReplay &&) = delete;
+        RxReplay &operator=(const RxReplay &) = delete;
+        RxReplay &operator=(const RxReplay &&) = delete;
+
+        //the replay socket of a captured connection id, nullptr if it never read anything
+        auto socket(uint32_t connection_id) noexcept -> TCPSocket * {
+            return connection_id < sockets_.size() ? sockets_[connection_id] : nullptr;
+        }
+
+        auto replay(ReplaySpeed speed) noexcept -> uint64_t {
+            return replayWith([this](TCPSocket *socket, Nanos rx_time) { recv_callback_(socket, rx_time); }, [this]() { recv_finished_callback_(); }, speed);
+        }
+
+        //replay() calling on_recv(TCPSocket *, Nanos rx_time) and on_recv_finished() directly, resolved at compile
+        //time like StaticTCPServer. Runs the whole capture from the start on empty receive buffers; returns the chunks replayed.
+        template<typename RecvHandler, typename RecvFinishedHandler>
+        auto replayWith(RecvHandler &&on_recv, RecvFinishedHandler &&on_recv_finished, ReplaySpeed speed) noexcept -> uint64_t {
+            reader_.rewind();
+            for (auto socket : sockets_)
+                if (socket)
+                    socket->rcv_read_index_ = socket->next_rcv_valid_index_ = 0;
+            const auto chunks_before = chunks_;
+            Nanos first_time = 0;
+            Nanos replay_start = 0;
+
+            for (auto record = reader_.next(); record; record = reader_.next()) {
+                if (speed == ReplaySpeed::RECORDED) {
+                    if (!replay_start) {
+                        first_time = record->user_time_;
+                        replay_start = getCurrentNanos();
+                    }
+                    while (getCurrentNanos() - replay_start < record->user_time_ - first_time) {}
+                }
+
+                if (record->type_ == RxRecordType::RECV_FINISHED) {
+                    ++recv_finished_;
+                    on_recv_finished();
+                    continue;
+                }
+
+                auto socket = sockets_[record->connection_id_];
+                const auto len = deliver(socket, RxCaptureReader::data(record), record->len_);
+                ++chunks_;
+                bytes_ += len;
+                if (len)
+                    on_recv(socket, record->kernel_time_);
+                discardSends(socket);
+            }
+
+            logger_.log("%:% %() % replayed chunks:% bytes:% recv_finished:% sent_bytes:% truncated_bytes:%\n", __FILE__, __LINE__, __FUNCTION__,
+                        getCurrentTimeStr(&time_str_), chunks_ - chunks_before, bytes_, recv_finished_, sent_bytes_, truncated_bytes_);
+            return chunks_ - chunks_before;
+        }
+
+    private:
+        //connection ids are small and dense (accept order), one socket slot per id
+        static auto maxConnectionId(RxCaptureReader &reader) noexcept -> uint32_t {
+            uint32_t max_id = 0;
+            for (auto record = reader.next(); record; record = reader.next())
+                if (record->type_ == RxRecordType::DATA)
+                    max_id = std::max(max_id, record->connection_id_);
+            reader.rewind();
+            return max_id;
+        }
+
+        //append a chunk behind the bytes the callbacks left, growing the buffer like recvWith() would have
+        auto deliver(TCPSocket *socket, const char *data, size_t len) noexcept -> size_t {
+            while (socket->next_rcv_valid_index_ + len > socket->rcv_buffer_size_ && socket->rcv_buffer_size_ < socket->max_buffer_size_)
+                socket->growRcvBuffer();
+            const auto fits = std::min(len, socket->rcv_buffer_size_ - socket->next_rcv_valid_index_);
+            memcpy(socket->rcv_buffer_ + socket->next_rcv_valid_index_, data, fits);
+            socket->next_rcv_valid_index_ += fits;
+            truncated_bytes_ += len - fits;
+            return fits;
+        }
+
+        //there is no peer: whatever the callback queued is dropped, so the ring never fills up
+        auto discardSends(TCPSocket *socket) noexcept -> void {
+            sent_bytes_ += socket->pendingRingBytes();
+            socket->send_head_ = socket->send_tail_ = 0;
+        }
+
+        RxCaptureReader reader_;
+        std::vector<TCPSocket *> sockets_;
+        MemoryPool<TCPSocket> socket_pool_;
+        std::string time_str_;
+        Logger &logger_;
+    };
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace common {
+    //"Latest value wins" slot for one writer and any number of readers. The writer never waits: it makes the
+    //version odd, copies the value in, and makes it even again. A reader copies the value out between two loads of
+    //an even, unchanged version and retries otherwise, so it gets a torn-free snapshot and only ever reads the
+    //slot's cache lines, never writes them. Unlike LFQueue a reader skips every intermediate update.
+    //No pointers and lock-free atomics only, so a slot can live in shared memory mapped at different addresses
+    //(see SharedMemoryObject). T must be trivially copyable; large T make readers retry more under heavy writing.
+    template<typename T>
+    class alignas(64) SeqlockSlot final {
+        static_assert(std::is_trivially_copyable_v<T>, "SeqlockSlot values are copied with memcpy().");
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "SeqlockSlot needs a lock-free 64 bit atomic to work across processes.");
+
+    public:
+        SeqlockSlot() = default;
+        SeqlockSlot(const SeqlockSlot &) = delete;
+        SeqlockSlot(const SeqlockSlot &&) = delete;
+        SeqlockSlot &operator=(const SeqlockSlot &) = delete;
+        SeqlockSlot &operator=(const SeqlockSlot &&) = delete;
+
+        //single writer only
+        auto write(const T &value) noexcept -> void {
+            const auto version = version_.load(std::memory_order_relaxed);
+            version_.store(version + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            memcpy(&value_, &value, sizeof(T));
+            version_.store(version + 2, std::memory_order_release);
+        }
+
+        //One attempt: false if a write was in progress or completed meanwhile, *value may then be torn.
+        auto tryRead(T *value, uint64_t *version = nullptr) const noexcept -> bool {
+            const auto before = version_.load(std::memory_order_acquire);
+            if (before & 1)
+                return false;
+            memcpy(value, &value_, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version)
+                *version = before;
+            return version_.load(std::memory_order_relaxed) == before;
+        }
+
+        //spins until a consistent snapshot is read, i.e. at most for the length of one write()
+        auto read(uint64_t *version = nullptr) const noexcept -> T {
+            T value;
+            while (!tryRead(&value, version)) {}
+            return value;
+        }
+
+        //Snapshot only if something was written since the version last_version, which is updated. Lets a reader
+        //polling many slots skip the copy of the unchanged ones.
+        auto readIfChanged(T *value, uint64_t *last_version) const noexcept -> bool {
+            if (version_.load(std::memory_order_acquire) == *last_version)
+                return false;
+            uint64_t version = 0;
+            while (!tryRead(value, &version)) {}
+            if (version == *last_version)
+                return false;
+            *last_version = version;
+            return true;
+        }
+
+        //even, grows by 2 per write(); 0 means never written
+        auto version() const noexcept -> uint64_t {
+            return version_.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::atomic<uint64_t> version_ = {0};
+        T value_{};
+    };
+
+    //Fixed array of SeqlockSlots, e.g. top-of-book per instrument or risk limits per account, each on its own cache
+    //lines so updates to one entry do not disturb readers of another. Fixed size and no heap, so the whole table can
+    //be placed in shared memory. Same single-writer rule, per table; indices are not range checked.
+    template<typename T, size_t N>
+    class SeqlockTable final {
+    public:
+        SeqlockTable() = default;
+        SeqlockTable(const SeqlockTable &) = delete;
+        SeqlockTable(const SeqlockTable &&) = delete;
+        SeqlockTable &operator=(const SeqlockTable &) = delete;
+        SeqlockTable &operator=(const SeqlockTable &&) = delete;
+
+        auto write(size_t index, const T &value) noexcept -> void {
+            slots_[index].write(value);
+        }
+
+        auto read(size_t index, uint64_t *version = nullptr) const noexcept -> T {
+            return slots_[index].read(version);
+        }
+
+        auto readIfChanged(size_t index, T *value, uint64_t *last_version) const noexcept -> bool {
+            return slots_[index].readIfChanged(value, last_version);
+        }
+
+        auto slot(size_t index) noexcept -> SeqlockSlot<T> & {
+            return slots_[index];
+        }
+
+        auto slot(size_t index) const noexcept -> const SeqlockSlot<T> & {
+            return slots_[index];
+        }
+
+        static constexpr auto size() noexcept {
+            return N;
+        }
+
+    private:
+        std::array<SeqlockSlot<T>, N> slots_;
+    };
+}
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sstream>
+
+#include "macros.h"
+#include "thread_utils.hpp"
+#include "lf_queue.hpp"
+#include "logger.hpp"
+#include "tcp_server.hpp"
+
+namespace common {
+    //bytes of received data carried by one ShardEvent, larger reads are split over several events
+    constexpr size_t ShardEventPayloadSize = 256;
+
+    enum class ShardEventType : uint8_t {
+        CONNECTED = 0,
+        DATA = 1,
+        DISCONNECTED = 2
+    };
+
+    //Per-connection event handed from a shard thread to the strategy thread, and replies going the other way.
+    //fd_ and connection_id_ identify the connection within its shard: the kernel reuses fds, connection ids are
+    //never reused, so a reply to a connection that has gone is dropped rather than sent to its fd's next owner.
+    struct ShardEvent {
+        ShardEventType type_ = ShardEventType::DATA;
+        size_t shard_id_ = 0;
+        int fd_ = -1;
+        uint64_t connection_id_ = 0;
+        Nanos rx_time_ = 0;
+        uint32_t len_ = 0;
+        char data_[ShardEventPayloadSize];
+    };
+
+    //written by the shard thread only, read from anywhere
+    struct ShardStats {
+        std::atomic<size_t> connections_ = {0};
+        std::atomic<size_t> accepted_ = {0};
+        std::atomic<size_t> closed_ = {0};
+        std::atomic<size_t> recv_callbacks_ = {0};
+        std::atomic<size_t> bytes_received_ = {0};
+        std::atomic<size_t> events_handed_off_ = {0};
+        std::atomic<size_t> handoff_queue_full_ = {0};
+        std::atomic<size_t> replies_sent_ = {0};
+        std::atomic<size_t> replies_dropped_ = {0};
+        std::atomic<size_t> loop_iterations_ = {0};
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << "ShardStats[connections:" << connections_
+               << " accepted:" << accepted_
+               << " closed:" << closed_
+               << " recv_callbacks:" << recv_callbacks_
+               << " bytes_received:" << bytes_received_
+               << " handed_off:" << events_handed_off_
+               << " handoff_full:" << handoff_queue_full_
+               << " replies:" << replies_sent_
+               << " replies_dropped:" << replies_dropped_
+               << " loops:" << loop_iterations_
+               << "]";
+            return ss.str();
+        }
+    };
+
+    //One reactor: its own Logger (Logger's queue is single producer), TCPServer with its own epoll set and
+    //SO_REUSEPORT listener, and a pinned thread running poll() / sendAndRecv().
+    struct TCPServerShard {
+        const size_t shard_id_;
+        const int core_id_;
+        Logger logger_;
+        TCPServer server_;
+        ShardStats stats_;
+
+        //either recv_callback_ runs on the shard thread, or - with a handoff queue - received bytes are copied
+        //into ShardEvents for the strategy thread, which answers through replies_.
+        std::function<void(TCPSocket *s, Nanos rx_time)> recv_callback_;
+        LFQueue<ShardEvent> *handoff_ = nullptr;
+        LFQueue<ShardEvent> *replies_ = nullptr;
+        size_t queue_size_ = 0;
+
+        //an open connection as seen by the shard thread, indexed by fd
+        struct Connection {
+            TCPSocket *socket_ = nullptr;
+            uint64_t id_ = 0;
+            //bytes left in rcv_buffer_ because the handoff queue was full, retried every loop iteration
+            bool handoff_pending_ = false;
+            Nanos rx_time_ = 0;
+        };
+
+        //fd -> connection, to route replies from the strategy thread
+        std::vector<Connection> connections_;
+        uint64_t next_connection_id_ = 0;
+        //sockets with bytes the handoff queue had no room for. Their fd may not fire again (edge triggered) nor
+        //their buffer take another read, so only this retry moves them on.
+        std::vector<TCPSocket *> handoff_retry_;
+        //CONNECTED / DISCONNECTED events and a closed connection's last bytes are never dropped: what the handoff
+        //queue has no room for waits here, in order, and nothing else is handed off until [backlog_head_, end) is out
+        std::vector<ShardEvent> backlog_;
+        size_t backlog_head_ = 0;
+        std::thread *thread_ = nullptr;
+        std::atomic<bool> running_ = {false};
+
+        TCPServerShard(size_t shard_id, int core_id, const std::string &log_file, size_t max_connections, size_t handoff_queue_size)
+            : shard_id_(shard_id), core_id_(core_id), logger_(log_file), server_(logger_, max_connections), queue_size_(handoff_queue_size) {
+            if (handoff_queue_size) {
+                handoff_ = new LFQueue<ShardEvent>(handoff_queue_size + 1);
+                replies_ = new LFQueue<ShardEvent>(handoff_queue_size + 1);
+            }
+
+            server_.recv_callback_ = [this](auto socket, auto rx_time) {
+                onRecv(socket, rx_time);
+            };
+            server_.accept_callback_ = [this](auto socket) {
+                onAccept(socket);
+            };
+            server_.disconnect_callback_ = [this](auto socket) {
+                onDisconnect(socket);
+            };
+        }
+
+        ~TCPServerShard() {
+            delete handoff_; handoff_ = nullptr;
+            delete replies_; replies_ = nullptr;
+        }
+
+        TCPServerShard() = delete;
+        TCPServerShard(const TCPServerShard &) = delete;
+        TCPServerShard(const TCPServerShard &&) = delete;
+        TCPServerShard &operator=(const TCPServerShard &) = delete;
+        TCPServerShard &operator=(const TCPServerShard &&) = delete;
+
+        auto handoffFull() noexcept -> bool {
+            if (UNLIKELY(handoff_->size() >= queue_size_)) {
+                stats_.handoff_queue_full_.store(stats_.handoff_queue_full_ + 1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        auto fillEvent(ShardEvent *event, ShardEventType type, const TCPSocket *socket, Nanos rx_time, const char *data, size_t len) noexcept -> void {
+            event->type_ = type;
+            event->shard_id_ = shard_id_;
+            event->fd_ = socket->fd_;
+            event->connection_id_ = connections_[socket->fd_].id_;
+            event->rx_time_ = rx_time;
+            event->len_ = static_cast<uint32_t>(len);
+            if (len)
+                memcpy(event->data_, data, len);
+        }
+
+        //false if the queue is full or events are backlogged, which go first
+        auto pushEvent(ShardEventType type, const TCPSocket *socket, Nanos rx_time, const char *data, size_t len) noexcept -> bool {
+            if (UNLIKELY(backlog_head_ != backlog_.size()) || handoffFull())
+                return false;
+
+            fillEvent(handoff_->getNextToWriteTo(), type, socket, rx_time, data, len);
+            handoff_->updateWriteIndex();
+            stats_.events_handed_off_.store(stats_.events_handed_off_ + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        //handed off now or later, never dropped
+        auto pushOrBacklog(ShardEventType type, const TCPSocket *socket, Nanos rx_time, const char *data, size_t len) noexcept -> void {
+            if (pushEvent(type, socket, rx_time, data, len))
+                return;
+            backlog_.emplace_back();
+            fillEvent(&backlog_.back(), type, socket, rx_time, data, len);
+        }
+
+        //Backlogged events in order while the queue has room. A connection's slot is reset once its DISCONNECTED
+        //is out, unless its fd already belongs to a new connection.
+        auto drainBacklog() noexcept -> void {
+            for (; backlog_head_ != backlog_.size() && !handoffFull(); ++backlog_head_) {
+                const auto &event = backlog_[backlog_head_];
+                *handoff_->getNextToWriteTo() = event;
+                handoff_->updateWriteIndex();
+                stats_.events_handed_off_.store(stats_.events_handed_off_ + 1, std::memory_order_relaxed);
+                if (event.type_ == ShardEventType::DISCONNECTED && connections_[event.fd_].id_ == event.connection_id_)
+                    connections_[event.fd_] = {};
+            }
+            if (backlog_head_ == backlog_.size()) {
+                backlog_.clear();
+                backlog_head_ = 0;
+            }
+        }
+
+        auto onAccept(TCPSocket *socket) noexcept -> void {
+            if (static_cast<size_t>(socket->fd_) >= connections_.size())
+                connections_.resize(socket->fd_ + 1);
+            connections_[socket->fd_] = {socket, ++next_connection_id_, false, 0};
+
+            stats_.accepted_.store(stats_.accepted_ + 1, std::memory_order_relaxed);
+            stats_.connections_.store(server_.sockets_.size(), std::memory_order_relaxed);
+            if (handoff_)
+                pushOrBacklog(ShardEventType::CONNECTED, socket, 0, nullptr, 0);
+        }
+
+        auto onDisconnect(TCPSocket *socket) noexcept -> void {
+            auto &connection = connections_[socket->fd_];
+            if (connection.handoff_pending_) {
+                connection.handoff_pending_ = false;
+                handoff_retry_.erase(std::find(handoff_retry_.begin(), handoff_retry_.end(), socket));
+            }
+
+            stats_.closed_.store(stats_.closed_ + 1, std::memory_order_relaxed);
+            stats_.connections_.store(server_.sockets_.size() - 1, std::memory_order_relaxed);
+            //the socket is freed after this: the bytes still waiting are copied out, then DISCONNECTED follows them
+            if (handoff_) {
+                for (size_t consumed = 0; consumed < socket->next_rcv_valid_index_; consumed += ShardEventPayloadSize)
+                    pushOrBacklog(ShardEventType::DATA, socket, connection.rx_time_, socket->rcv_buffer_ + consumed,
+                                  std::min(ShardEventPayloadSize, socket->next_rcv_valid_index_ - consumed));
+                socket->next_rcv_valid_index_ = 0;
+                pushOrBacklog(ShardEventType::DISCONNECTED, socket, 0, nullptr, 0);
+            }
+            //no more replies, the id stays until a backlogged DISCONNECTED is out
+            connection.socket_ = nullptr;
+            if (backlog_head_ == backlog_.size())
+                connection = {};
+        }
+
+        auto onRecv(TCPSocket *socket, Nanos rx_time) noexcept -> void {
+            stats_.recv_callbacks_.store(stats_.recv_callbacks_ + 1, std::memory_order_relaxed);
+            stats_.bytes_received_.store(stats_.bytes_received_ + socket->next_rcv_valid_index_, std::memory_order_relaxed);
+
+            if (!handoff_) {
+                if (recv_callback_)
+                    recv_callback_(socket, rx_time);
+                else
+                    socket->next_rcv_valid_index_ = 0;
+                return;
+            }
+
+            auto &connection = connections_[socket->fd_];
+            connection.rx_time_ = rx_time;
+            if (!handOff(socket, rx_time) && !connection.handoff_pending_) {
+                connection.handoff_pending_ = true;
+                handoff_retry_.push_back(socket);
+            }
+        }
+
+        //Hand off whole payload chunks; if the queue fills up the rest stays in rcv_buffer_ for the retry.
+        //True once rcv_buffer_ is empty.
+        auto handOff(TCPSocket *socket, Nanos rx_time) noexcept -> bool {
+            size_t consumed = 0;
+            while (consumed < socket->next_rcv_valid_index_) {
+                const auto len = std::min(ShardEventPayloadSize, socket->next_rcv_valid_index_ - consumed);
+                if (!pushEvent(ShardEventType::DATA, socket, rx_time, socket->rcv_buffer_ + consumed, len))
+                    break;
+                consumed += len;
+            }
+            memmove(socket->rcv_buffer_, socket->rcv_buffer_ + consumed, socket->next_rcv_valid_index_ - consumed);
+            socket->next_rcv_valid_index_ -= consumed;
+            return !socket->next_rcv_valid_index_;
+        }
+
+        auto retryHandoffs() noexcept -> void {
+            if (backlog_head_ != backlog_.size()) {
+                drainBacklog();
+                if (backlog_head_ != backlog_.size())
+                    return;
+            }
+            for (auto i = handoff_retry_.size(); i-- > 0;) {
+                auto socket = handoff_retry_[i];
+                auto &connection = connections_[socket->fd_];
+                if (!handOff(socket, connection.rx_time_))
+                    continue;
+                connection.handoff_pending_ = false;
+                handoff_retry_[i] = handoff_retry_.back();
+                handoff_retry_.pop_back();
+            }
+        }
+
+        //replies from the strategy thread, dropped if the connection has gone away in the meantime
+        auto drainReplies() noexcept -> void {
+            for (auto next = replies_->getNextToRead(); replies_->size() && next; next = replies_->getNextToRead()) {
+                if (next->fd_ >= 0 && static_cast<size_t>(next->fd_) < connections_.size() && connections_[next->fd_].socket_ &&
+                    connections_[next->fd_].id_ == next->connection_id_) {
+                    connections_[next->fd_].socket_->send(next->data_, next->len_);
+                    stats_.replies_sent_.store(stats_.replies_sent_ + 1, std::memory_order_relaxed);
+                } else {
+                    stats_.replies_dropped_.store(stats_.replies_dropped_ + 1, std::memory_order_relaxed);
+                }
+                replies_->updateReadIndex();
+            }
+        }
+
+        auto run() noexcept -> void {
+            while (running_.load(std::memory_order_relaxed)) {
+                server_.poll();
+                if (replies_)
+                    drainReplies();
+                if (!handoff_retry_.empty() || backlog_head_ != backlog_.size())
+                    retryHandoffs();
+                server_.sendAndRecv();
+                stats_.loop_iterations_.store(stats_.loop_iterations_ + 1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    //N independent reactors on one port. Every shard has its own SO_REUSEPORT listener, so the kernel spreads
+    //incoming connections across them and a connection stays on one shard (and one core) for its lifetime.
+    //Set per-shard callbacks through shard(i) before start().
+    class ShardedTCPServer final {
+    public:
+        //one shard per entry of core_ids, log files are log_prefix + "_shard<i>.log"
+        ShardedTCPServer(const std::string &log_prefix, const std::vector<int> &core_ids, size_t max_connections_per_shard, size_t handoff_queue_size = 0) {
+            ASSERT(!core_ids.empty(), "ShardedTCPServer needs at least one shard.");
+            for (size_t i = 0; i < core_ids.size(); ++i)
+                shards_.push_back(new TCPServerShard(i, core_ids[i], log_prefix + "_shard" + std::to_string(i) + ".log", max_connections_per_shard, handoff_queue_size));
+        }
+
+        ~ShardedTCPServer() {
+            stop();
+            for (auto shard : shards_)
+                delete shard;
+        }
+
+        ShardedTCPServer() = delete;
+        ShardedTCPServer(const ShardedTCPServer &) = delete;
+        ShardedTCPServer(const ShardedTCPServer &&) = delete;
+        ShardedTCPServer &operator=(const ShardedTCPServer &) = delete;
+        ShardedTCPServer &operator=(const ShardedTCPServer &&) = delete;
+
+        auto listen(const std::string &iface, int port) -> void {
+            for (auto shard : shards_)
+                shard->server_.listen(iface, port, true);
+        }
+
+        auto start() -> void {
+            for (auto shard : shards_) {
+                shard->running_ = true;
+                shard->thread_ = createAndStartThread(shard->core_id_, "common/TCPServerShard-" + std::to_string(shard->shard_id_), [shard]() { shard->run(); });
+                ASSERT(shard->thread_ != nullptr, "Failed to start TCPServerShard " + std::to_string(shard->shard_id_));
+            }
+        }
+
+        auto stop() -> void {
+            for (auto shard : shards_) {
+                shard->running_ = false;
+                if (shard->thread_) {
+                    shard->thread_->join();
+                    delete shard->thread_;
+                    shard->thread_ = nullptr;
+                }
+            }
+        }
+
+        auto numShards() const noexcept {
+            return shards_.size();
+        }
+
+        auto shard(size_t shard_id) noexcept -> TCPServerShard & {
+            return *shards_[shard_id];
+        }
+
+        //strategy thread only: one SPSC queue per shard, nullptr without a handoff queue
+        auto handoffQueue(size_t shard_id) noexcept {
+            return shards_[shard_id]->handoff_;
+        }
+
+        //strategy thread only: queue a reply for the connection fd / connection_id of a received ShardEvent, false if
+        //the reply queue is full. The shard drops it if that connection has closed since.
+        auto send(size_t shard_id, int fd, uint64_t connection_id, const void *data, size_t len) noexcept -> bool {
+            auto shard = shards_[shard_id];
+            ASSERT(shard->replies_ != nullptr && len <= ShardEventPayloadSize, "ShardedTCPServer::send() needs a handoff queue and len <= ShardEventPayloadSize.");
+            if (UNLIKELY(shard->replies_->size() >= shard->queue_size_))
+                return false;
+
+            auto event = shard->replies_->getNextToWriteTo();
+            event->type_ = ShardEventType::DATA;
+            event->shard_id_ = shard_id;
+            event->fd_ = fd;
+            event->connection_id_ = connection_id;
+            event->len_ = static_cast<uint32_t>(len);
+            memcpy(event->data_, data, len);
+            shard->replies_->updateWriteIndex();
+            return true;
+        }
+
+    private:
+        std::vector<TCPServerShard *> shards_;
+    };
+}
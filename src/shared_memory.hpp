@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "macros.h"
+
+namespace common {
+    enum class SharedMemoryMode : uint8_t {
+        //create (or replace) the object, construct T in it and unlink the name again on destruction
+        CREATE = 0,
+        OPEN_READ_WRITE = 1,
+        //mapped PROT_READ, e.g. for processes that only read a SeqlockTable and must not write its cache lines
+        OPEN_READ_ONLY = 2
+    };
+
+    //One T in a POSIX shared memory object (/dev/shm/<name>), mapped whole. T must hold no pointers and only
+    //lock-free atomics, like SeqlockSlot / SeqlockTable, since every process maps it at its own address.
+    //Openers must come after the creator has constructed T; a size mismatch (different T or build) is fatal.
+    template<typename T>
+    class SharedMemoryObject final {
+        static_assert(std::is_standard_layout_v<T>, "shared memory objects must be standard layout.");
+
+    public:
+        SharedMemoryObject(const std::string &name, SharedMemoryMode mode) : name_(name), mode_(mode) {
+            const auto create = (mode == SharedMemoryMode::CREATE);
+            const auto read_only = (mode == SharedMemoryMode::OPEN_READ_ONLY);
+            fd_ = shm_open(name.c_str(), create ? O_CREAT | O_RDWR | O_TRUNC : (read_only ? O_RDONLY : O_RDWR), 0600);
+            ASSERT(fd_ >= 0, "shm_open() failed name:" + name + " error:" + std::string(std::strerror(errno)));
+            if (create)
+                ASSERT(ftruncate(fd_, sizeof(T)) == 0, "ftruncate() failed name:" + name + " error:" + std::string(std::strerror(errno)));
+
+            struct stat st;
+            ASSERT(fstat(fd_, &st) == 0 && static_cast<size_t>(st.st_size) == sizeof(T),
+                   "shared memory object " + name + " is not " + std::to_string(sizeof(T)) + " bytes.");
+            auto base = mmap(nullptr, sizeof(T), read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            ASSERT(base != MAP_FAILED, "mmap() failed name:" + name + " error:" + std::string(std::strerror(errno)));
+            object_ = create ? new(base) T() : static_cast<T *>(base);
+        }
+
+        ~SharedMemoryObject() {
+            if (mode_ == SharedMemoryMode::CREATE)
+                object_->~T();
+            munmap(object_, sizeof(T));
+            close(fd_);
+            if (mode_ == SharedMemoryMode::CREATE)
+                shm_unlink(name_.c_str());
+        }
+
+        SharedMemoryObject() = delete;
+        SharedMemoryObject(const SharedMemoryObject &) = delete;
+        SharedMemoryObject(const SharedMemoryObject &&) = delete;
+        SharedMemoryObject &operator=(const SharedMemoryObject &) = delete;
+        SharedMemoryObject &operator=(const SharedMemoryObject &&) = delete;
+
+        auto get() noexcept -> T * {
+            return object_;
+        }
+
+        auto operator->() noexcept -> T * {
+            return object_;
+        }
+
+        auto operator*() noexcept -> T & {
+            return *object_;
+        }
+
+    private:
+        const std::string name_;
+        const SharedMemoryMode mode_;
+        int fd_ = -1;
+        T *object_ = nullptr;
+    };
+}
@@ -13,23 +13,17 @@
 #include <ifaddrs.h>
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #include "macros.h"
 
 #include "logger.hpp"
 
-#include "tcp_socket.hpp"
+#include "socket_utils.hpp"
 
 namespace common {
-    struct SocketCfg {
-        std::string ip_;
-        std::string iface_;
-        int port_ = -1;
-        bool is_udp_ = false;
-        bool is_listening_ = false;
-        bool needs_so_timestamp_ =  false;
-
-        auto toString() const {
+    auto SocketCfg::toString() const -> std::string {
         std::stringstream ss;
         ss << "SocketCfg[ip:" << ip_
         << " iface:" << iface_
@@ -37,17 +31,15 @@ namespace common {
         << " is_udp:" << is_udp_
         << " is_listening:" << is_listening_
         << " needs_SO_timestamp:" << needs_so_timestamp_
+        << " reuse_port:" << reuse_port_
+        << " needs_tx_timestamp:" << needs_tx_timestamp_
         << "]";
 
         return ss.str();
-        }
-    };
-
-    /// Represents the maximum number of pending / unaccepted TCP connections.
-    constexpr int MaxTCPServerBacklog = 1024;
+    }
 
     /// Convert interface name "eth0" to ip "123.123.123.123".
-    inline auto getIfaceIP(const std::string &iface) -> std::string {
+    auto getIfaceIP(const std::string &iface) -> std::string {
         char buf[NI_MAXHOST] = {'\0'};
         ifaddrs *ifaddr = nullptr;
 
@@ -65,7 +57,7 @@ namespace common {
     }
 
     /// Sockets will not block on read, but instead return immediately if data is not available.
-    inline auto setNonBlocking(int fd) -> bool {
+    auto setNonBlocking(int fd) -> bool {
         const auto flags = fcntl(fd, F_GETFL, 0);
         if (flags & O_NONBLOCK)
         return true;
@@ -73,25 +65,178 @@ namespace common {
     }
 
     /// Disable Nagle's algorithm and associated delays.
-    inline auto disableNagle(int fd) -> bool {
+    auto disableNagle(int fd) -> bool {
         int one = 1;
         return (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<void *>(&one), sizeof(one)) != -1);
     }
 
     /// Allow software receive timestamps on incoming packets.
-    inline auto setSOTimestamp(int fd) -> bool {
+    auto setSOTimestamp(int fd) -> bool {
         int one = 1;
         return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, reinterpret_cast<void *>(&one), sizeof(one)) != -1);
     }
 
+    /// Allow nanosecond software receive timestamps on incoming packets (SCM_TIMESTAMPNS).
+    auto setSOTimestampNS(int fd) -> bool {
+        int one = 1;
+        return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, reinterpret_cast<void *>(&one), sizeof(one)) != -1);
+    }
+
+    /// Software send timestamps: one entry per send call is queued on the socket error queue once the packet leaves
+    /// for the device, keyed by OPT_ID (datagram counter for UDP, stream offset of the last byte for TCP, both
+    /// counted from this call). OPT_TSONLY keeps the payload out of the error queue.
+    /// TCP keys count from the bytes written so far with OPT_ID_TCP (Linux 6.2+, not in older uapi headers), older
+    /// kernels count from the bytes acknowledged so far, the same thing as long as nothing is in flight.
+    auto setTxTimestamping(int fd) -> bool {
+        constexpr int sof_timestamping_opt_id_tcp = 1 << 16;
+        int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        int flags_tcp = flags | sof_timestamping_opt_id_tcp;
+        return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, reinterpret_cast<void *>(&flags_tcp), sizeof(flags_tcp)) != -1) ||
+               (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, reinterpret_cast<void *>(&flags), sizeof(flags)) != -1);
+    }
+
+    /// Kernel receive time of a message read with recvmsg() / recvmmsg(), 0 if it carries none.
+    /// Walks every cmsg, SCM_TIMESTAMPNS and SCM_TIMESTAMPING are preferred over the microsecond SCM_TIMESTAMP.
+    auto getRxTimestamp(msghdr *msg) -> Nanos {
+        Nanos rx_time = 0;
+        for (auto cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS && cmsg->cmsg_len >= CMSG_LEN(sizeof(timespec))) {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                return ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+            }
+            if (cmsg->cmsg_type == SCM_TIMESTAMPING && cmsg->cmsg_len >= CMSG_LEN(sizeof(scm_timestamping))) {
+                scm_timestamping ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                if (ts.ts[0].tv_sec || ts.ts[0].tv_nsec)
+                    return ts.ts[0].tv_sec * NANOS_TO_SECS + ts.ts[0].tv_nsec;
+            }
+            if (cmsg->cmsg_type == SCM_TIMESTAMP && cmsg->cmsg_len >= CMSG_LEN(sizeof(timeval))) {
+                timeval tv;
+                memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+                rx_time = tv.tv_sec * NANOS_TO_SECS + tv.tv_usec * NANOS_TO_MICROS;
+            }
+        }
+        return rx_time;
+    }
+
+    /// Dequeue one entry from the socket error queue into entry. False once the queue is empty.
+    auto recvErrQueue(int fd, ErrQueueEntry *entry) -> bool {
+        char ctrl[TimestampCtrlSize];
+        msghdr msg{};
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        *entry = {};
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return false;
+
+        Nanos stamp = 0;
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING && cmsg->cmsg_len >= CMSG_LEN(sizeof(scm_timestamping))) {
+                scm_timestamping ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                stamp = ts.ts[0].tv_sec * NANOS_TO_SECS + ts.ts[0].tv_nsec;
+            } else if (((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) &&
+                       cmsg->cmsg_len >= CMSG_LEN(sizeof(sock_extended_err))) {
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    entry->origin_ = SO_EE_ORIGIN_TIMESTAMPING;
+                    entry->lo_ = entry->hi_ = err.ee_data;
+                } else if (err.ee_errno == 0 && err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                    entry->origin_ = SO_EE_ORIGIN_ZEROCOPY;
+                    entry->lo_ = err.ee_info;
+                    entry->hi_ = err.ee_data;
+                    entry->zerocopy_copied_ = (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+                }
+            }
+        }
+
+        if (entry->origin_ == SO_EE_ORIGIN_TIMESTAMPING)
+            entry->tx_time_ = stamp;
+        return true;
+    }
+
+    /// Pending socket error (SO_ERROR), 0 if there is none. Reading it clears it.
+    auto getSocketError(int fd) -> int {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<void *>(&error), &len) == -1)
+            return errno;
+        return error;
+    }
+
+    /// Allow MSG_ZEROCOPY sends on this socket, completions arrive on the error queue.
+    auto setZeroCopy(int fd) -> bool {
+        int one = 1;
+        return (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, reinterpret_cast<void *>(&one), sizeof(one)) != -1);
+    }
+
+    /// Ask the kernel to busy-poll the device queue for up to busy_poll_usecs on blocking reads / epoll instead of
+    /// waiting for an interrupt, and to prefer busy polling over softirq processing. With enable false both are
+    /// turned off again and the NAPI budget is left alone. Raising SO_BUSY_POLL above net.core.busy_read needs
+    /// CAP_NET_ADMIN, so callers should treat failure as "not permitted here".
+    auto setBusyPoll(int fd, bool enable, int busy_poll_usecs, [[maybe_unused]] int budget) -> bool {
+        int usecs = enable ? busy_poll_usecs : 0;
+        auto ok = (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, reinterpret_cast<void *>(&usecs), sizeof(usecs)) != -1);
+#ifdef SO_PREFER_BUSY_POLL
+        int prefer = enable ? 1 : 0;
+        ok = (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, reinterpret_cast<void *>(&prefer), sizeof(prefer)) != -1) && ok;
+#endif
+#ifdef SO_BUSY_POLL_BUDGET
+        if (enable)
+            ok = (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, reinterpret_cast<void *>(&budget), sizeof(budget)) != -1) && ok;
+#endif
+        return ok;
+    }
+
+    /// Check errno to see if a call would have blocked on a non-blocking socket.
+    auto wouldBlock() -> bool {
+        return (errno == EWOULDBLOCK || errno == EINPROGRESS);
+    }
+
+    /// Set TTL on multicast packets sent from this socket.
+    auto setMcastTTL(int fd, int mcast_ttl) -> bool {
+        return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, reinterpret_cast<void *>(&mcast_ttl), sizeof(mcast_ttl)) != -1);
+    }
+
+    /// Set TTL on non-multicast packets sent from this socket.
+    auto setTTL(int fd, int ttl) -> bool {
+        return (setsockopt(fd, IPPROTO_IP, IP_TTL, reinterpret_cast<void *>(&ttl), sizeof(ttl)) != -1);
+    }
+
+    /// Send multicast packets from this socket out of the interface with the specified ip, e.g. "127.0.0.1" for loopback.
+    auto setMcastInterface(int fd, const std::string &iface_ip) -> bool {
+        const in_addr addr{inet_addr(iface_ip.c_str())};
+        return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)) != -1);
+    }
+
+    /// Deliver multicast packets sent from this socket to members on the same host as well.
+    auto setMcastLoop(int fd, bool loop) -> bool {
+        const unsigned char value = loop ? 1 : 0;
+        return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof(value)) != -1);
+    }
+
     /// Add / Join membership / subscription to the multicast stream specified and on the interface specified.
-    inline auto join(int fd, const std::string &ip) -> bool {
-        const ip_mreq mreq{{inet_addr(ip.c_str())}, {htonl(INADDR_ANY)}};
+    /// An empty iface_ip lets the kernel pick the interface from the routing table.
+    auto join(int fd, const std::string &ip, const std::string &iface_ip) -> bool {
+        const ip_mreq mreq{{inet_addr(ip.c_str())}, {iface_ip.empty() ? htonl(INADDR_ANY) : inet_addr(iface_ip.c_str())}};
         return (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != -1);
     }
 
+    /// Drop membership of the multicast stream joined with join().
+    auto leave(int fd, const std::string &ip, const std::string &iface_ip) -> bool {
+        const ip_mreq mreq{{inet_addr(ip.c_str())}, {iface_ip.empty() ? htonl(INADDR_ANY) : inet_addr(iface_ip.c_str())}};
+        return (setsockopt(fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq)) != -1);
+    }
+
     /// Create a TCP / UDP socket to either connect to or listen for data on or listen for connections on the specified interface and IP:port information.
-    [[nodiscard]] inline auto createSocket(Logger &logger, const SocketCfg& socket_cfg) -> int {
+    /// Connecting TCP sockets are returned while the connect is still in progress, -1 if it failed right away.
+    auto createSocket(Logger &logger, const SocketCfg& socket_cfg) -> int {
         std::string time_str;
 
         const auto ip = socket_cfg.ip_.empty() ? getIfaceIP(socket_cfg.iface_) : socket_cfg.ip_;
@@ -117,14 +262,23 @@ namespace common {
                 ASSERT(disableNagle(socket_fd), "disableNagle() failed. errno:" + std::string(strerror(errno)));
             }
 
-            if (!socket_cfg.is_listening_) { // establish connection to specified address.
-                ASSERT(connect(socket_fd, rp->ai_addr, rp->ai_addrlen) != 1, "connect() failed. errno:" + std::string(strerror(errno)));
+            if (!socket_cfg.is_listening_) { // start connecting, a non-blocking TCP connect() completes later (EINPROGRESS).
+                if (connect(socket_fd, rp->ai_addr, rp->ai_addrlen) == -1 && errno != EINPROGRESS) {
+                    logger.log("%:% %() % connect() failed. errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str), strerror(errno));
+                    close(socket_fd);
+                    socket_fd = -1;
+                    continue;
+                }
             }
 
             if (socket_cfg.is_listening_) { // allow re-using the address in the call to bind()
                 ASSERT(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&one), sizeof(one)) == 0, "setsockopt() SO_REUSEADDR failed. errno:" + std::string(strerror(errno)));
             }
 
+            if (socket_cfg.reuse_port_) { // let several sockets bind the same port, the kernel spreads connections across them.
+                ASSERT(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char *>(&one), sizeof(one)) == 0, "setsockopt() SO_REUSEPORT failed. errno:" + std::string(strerror(errno)));
+            }
+
             if (socket_cfg.is_listening_) {
                 // bind to the specified port number.
                 const sockaddr_in addr{AF_INET, htons(socket_cfg.port_), {htonl(INADDR_ANY)}, {}};
@@ -135,11 +289,16 @@ namespace common {
                 ASSERT(listen(socket_fd, MaxTCPServerBacklog) == 0, "listen() failed. errno:" + std::string(strerror(errno)));
             }
 
-            if (socket_cfg.needs_so_timestamp_) { // enable software receive timestamps.
-                ASSERT(setSOTimestamp(socket_fd), "setSOTimestamp() failed. errno:" + std::string(strerror(errno)));
+            if (socket_cfg.needs_so_timestamp_) { // enable nanosecond software receive timestamps.
+                ASSERT(setSOTimestampNS(socket_fd), "setSOTimestampNS() failed. errno:" + std::string(strerror(errno)));
+            }
+
+            if (socket_cfg.needs_tx_timestamp_) { // enable software send timestamps on the error queue.
+                ASSERT(setTxTimestamping(socket_fd), "setTxTimestamping() failed. errno:" + std::string(strerror(errno)));
             }
         }
 
+        freeaddrinfo(result);
         return socket_fd;
     }
 }
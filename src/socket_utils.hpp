@@ -14,32 +14,60 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <fcntl.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #include "macros.h"
 #include "logger.hpp"
 
 namespace common 
 {
-    /*
-    constexpr int MaxTCPServerBacklog = 1024;
-    auto getIfaceIP(const std::string &iface) -> std::string;
-    auto setNonBlocking(int fd) -> bool;
-    auto setNoDelay(int fd) -> bool;
-    auto setSOTimestamp(int fd) -> bool;
-    auto wouldBlock() -> bool;
-    auto setMcastTTL(int fd, int ttl) noexcept -> bool;
-    auto join(int fd, const std::string &ip, const std::string &iface, int port) -> bool;
-    auto createSocket(common::Logger &logger, const std::string &t_ip, const std::string &iface, int port, bool is_udp, bool is_blocking, bool is_listening, int ttl, bool needs_so_timestamp) -> int;
-    */
+    struct SocketCfg {
+        std::string ip_;
+        std::string iface_;
+        int port_ = -1;
+        bool is_udp_ = false;
+        bool is_listening_ = false;
+        bool needs_so_timestamp_ =  false;
+        bool reuse_port_ = false;   // SO_REUSEPORT, several listeners on one port with kernel load balancing.
+        bool needs_tx_timestamp_ = false; // SO_TIMESTAMPING software send timestamps, read back from the error queue.
+
+        auto toString() const -> std::string;
+    };
 
     constexpr int MaxTCPServerBacklog = 1024;
+
+    //one socket error queue entry, see recvErrQueue()
+    struct ErrQueueEntry {
+        //SO_EE_ORIGIN_TIMESTAMPING or SO_EE_ORIGIN_ZEROCOPY, 0 for anything else
+        uint8_t origin_ = 0;
+        //send timestamp: lo_ == hi_ is the OPT_ID key. zerocopy: [lo_, hi_] are the completed MSG_ZEROCOPY send calls.
+        uint32_t lo_ = 0;
+        uint32_t hi_ = 0;
+        //the kernel copied the data after all (e.g. loopback), zerocopy gained nothing for these calls
+        bool zerocopy_copied_ = false;
+        Nanos tx_time_ = 0;
+    };
+    //control buffer large enough for every timestamp cmsg we enable, on the receive path and on the error queue
+    constexpr size_t TimestampCtrlSize = CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(timespec)) +
+                                         CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in));
     auto getIfaceIP(const std::string &iface) -> std::string;
     auto setNonBlocking(int fd) -> bool;
-    auto setNoDelay(int fd) -> bool;
+    auto disableNagle(int fd) -> bool;
     auto setSOTimestamp(int fd) -> bool;
+    auto setSOTimestampNS(int fd) -> bool;
+    auto setTxTimestamping(int fd) -> bool;
+    auto getRxTimestamp(msghdr *msg) -> Nanos;
+    auto recvErrQueue(int fd, ErrQueueEntry *entry) -> bool;
+    auto setZeroCopy(int fd) -> bool;
+    auto getSocketError(int fd) -> int;
+    auto setBusyPoll(int fd, bool enable, int busy_poll_usecs, int budget) -> bool;
     auto wouldBlock() -> bool;
     auto setMcastTTL(int fd, int ttl) -> bool;
     auto setTTL(int fd, int ttl) -> bool;
-    auto join(int fd, const std::string &ip, const std::string &iface, int port) -> bool;
-    auto createSocket(common::Logger &logger, const std::string &t_ip, const std::string &iface, int port, bool is_udp, bool is_blocking, bool is_listening, int ttl, bool needs_so_timestamp) -> int;
-    }
\ No newline at end of file
+    auto setMcastInterface(int fd, const std::string &iface_ip) -> bool;
+    auto setMcastLoop(int fd, bool loop) -> bool;
+    auto join(int fd, const std::string &ip, const std::string &iface_ip = "") -> bool;
+    auto leave(int fd, const std::string &ip, const std::string &iface_ip = "") -> bool;
+    auto createSocket(common::Logger &logger, const SocketCfg &socket_cfg) -> int;
+}
\ No newline at end of file
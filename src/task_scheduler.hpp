@@ -0,0 +1,334 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <type_traits>
+
+#include "macros.h"
+#include "thread_utils.hpp"
+#include "lf_queue.hpp"
+#include "memory_pool.hpp"
+#include "ws_deque.hpp"
+
+namespace common
+{
+    //Inline storage for a task's callable, large enough for a lambda capturing a handful of pointers.
+    constexpr size_t TASK_STORAGE_SIZE = 64;
+
+    struct Task
+    {
+        alignas(std::max_align_t) char storage_[TASK_STORAGE_SIZE];
+        void (*invoke_)(void *) = nullptr;
+        void (*destroy_)(void *) = nullptr;
+        bool completed_ = false;    //written by whichever worker ran the task, accessed through std::atomic_ref
+
+        template<typename F>
+        auto emplace(F &&func) noexcept
+        {
+            using Func = std::decay_t<F>;
+            static_assert(sizeof(Func) <= TASK_STORAGE_SIZE, "Task callable does not fit in TASK_STORAGE_SIZE.");
+            static_assert(alignof(Func) <= alignof(std::max_align_t), "Task callable is over-aligned.");
+
+            new(storage_) Func(std::forward<F>(func));
+            invoke_ = [](void *p) { (*reinterpret_cast<Func *>(p))(); };
+            destroy_ = [](void *p) { reinterpret_cast<Func *>(p)->~Func(); };
+            std::atomic_ref<bool>(completed_).store(false, std::memory_order_relaxed);
+        }
+
+        auto run() noexcept
+        {
+            invoke_(storage_);
+            destroy_(storage_);
+            std::atomic_ref<bool>(completed_).store(true, std::memory_order_release);
+        }
+
+        auto isCompleted() noexcept
+        {
+            return std::atomic_ref<bool>(completed_).load(std::memory_order_acquire);
+        }
+    };
+
+    //Task storage owned by one thread. MemoryPool is single threaded, so a task executed (and possibly
+    //stolen) elsewhere is only flagged completed_ and given back to the pool lazily by its owner.
+    class TaskArena final
+    {
+    public:
+        explicit TaskArena(std::size_t num_tasks) : pool_(num_tasks), capacity_(num_tasks)
+        {
+            in_flight_.reserve(num_tasks);
+        }
+
+        TaskArena() = delete;
+        TaskArena(const TaskArena &) = delete;
+        TaskArena(const TaskArena &&) = delete;
+        TaskArena &operator=(const TaskArena &) = delete;
+        TaskArena &operator=(const TaskArena &&) = delete;
+
+        //nullptr when every task is still in flight
+        template<typename F>
+        auto allocate(F &&func) noexcept -> Task *
+        {
+            //amortised O(1): only sweep once half of the arena is outstanding
+            if (in_flight_.size() >= capacity_ / 2)
+                reclaim();
+            if (UNLIKELY(in_flight_.size() == capacity_))
+                return nullptr;
+
+            auto task = pool_.allocate();
+            task->emplace(std::forward<F>(func));
+            in_flight_.push_back(task);
+            return task;
+        }
+
+        //give a task that was never handed to a worker straight back
+        auto release(Task *task) noexcept
+        {
+            task->destroy_(task->storage_);
+            in_flight_.pop_back();
+            pool_.deallocate(task);
+        }
+
+        auto reclaim() noexcept
+        {
+            size_t kept = 0;
+            for (auto task : in_flight_)
+            {
+                if (task->isCompleted())
+                    pool_.deallocate(task);
+                else
+                    in_flight_[kept++] = task;
+            }
+            in_flight_.resize(kept);
+        }
+
+        auto outstanding() const noexcept
+        {
+            return in_flight_.size();
+        }
+
+    private:
+        MemoryPool<Task> pool_;
+        std::vector<Task *> in_flight_;
+        const size_t capacity_;
+    };
+
+    struct TaskSchedulerStats
+    {
+        size_t executed_ = 0;
+        size_t stolen_ = 0;
+        size_t failed_steals_ = 0;
+    };
+
+    //Pool of pinned workers for non latency-critical work (risk recomputation, snapshotting, log compression).
+    //submit() is called by one external thread (e.g. the strategy thread), spawn() by tasks already running
+    //on a worker. Each worker owns a Chase-Lev deque, drains its inbound queue into it, and steals from the
+    //other workers when it runs dry. Neither path allocates: tasks come from per-thread TaskArenas.
+    class TaskScheduler final
+    {
+    public:
+        TaskScheduler(const std::vector<int> &core_ids, std::size_t tasks_per_worker, std::size_t inbound_capacity)
+            : submit_arena_(inbound_capacity * core_ids.size()), inbound_capacity_(inbound_capacity)
+        {
+            ASSERT(!core_ids.empty(), "TaskScheduler needs at least one worker.");
+
+            for (size_t i = 0; i < core_ids.size(); ++i)
+                workers_.push_back(new Worker(i, tasks_per_worker, inbound_capacity));
+
+            for (size_t i = 0; i < core_ids.size(); ++i)
+            {
+                workers_[i]->thread_ = createAndStartThread(core_ids[i], "common/TaskWorker-" + std::to_string(i),
+                                                            [this, i]() { run(workers_[i]); });
+                ASSERT(workers_[i]->thread_ != nullptr, "Failed to start TaskScheduler worker " + std::to_string(i));
+            }
+        }
+
+        ~TaskScheduler()
+        {
+            running_ = false;
+            for (auto worker : workers_)
+            {
+                worker->thread_->join();
+                delete worker->thread_;
+            }
+
+            for (auto worker : workers_)
+            {
+                //anything still queued is dropped without running
+                for (auto next = worker->inbound_.getNextToRead(); worker->inbound_.size() && next; next = worker->inbound_.getNextToRead())
+                {
+                    (*next)->destroy_((*next)->storage_);
+                    worker->inbound_.updateReadIndex();
+                }
+                while (auto task = worker->deque_.pop())
+                    task->destroy_(task->storage_);
+                delete worker;
+            }
+        }
+
+        TaskScheduler() = delete;
+        TaskScheduler(const TaskScheduler &) = delete;
+        TaskScheduler(const TaskScheduler &&) = delete;
+        TaskScheduler &operator=(const TaskScheduler &) = delete;
+        TaskScheduler &operator=(const TaskScheduler &&) = delete;
+
+        //external producer thread only. false if the arena or every inbound queue is full
+        template<typename F>
+        auto submit(F &&func) noexcept -> bool
+        {
+            auto task = submit_arena_.allocate(std::forward<F>(func));
+            if (UNLIKELY(!task))
+                return false;
+
+            for (size_t attempt = 0; attempt < workers_.size(); ++attempt)
+            {
+                auto worker = workers_[next_worker_];
+                next_worker_ = (next_worker_ + 1) % workers_.size();
+
+                if (worker->inbound_.size() < inbound_capacity_)
+                {
+                    *(worker->inbound_.getNextToWriteTo()) = task;
+                    worker->inbound_.updateWriteIndex();
+                    return true;
+                }
+            }
+
+            submit_arena_.release(task);
+            return false;
+        }
+
+        //from inside a running task only: pushes onto the current worker's own deque, runs inline if that is full
+        template<typename F>
+        static auto spawn(F &&func) noexcept
+        {
+            auto worker = current_worker_;
+            ASSERT(worker != nullptr, "TaskScheduler::spawn() called outside of a worker thread.");
+
+            auto task = worker->arena_.allocate(std::forward<F>(func));
+            if (UNLIKELY(!task))
+            {
+                std::forward<F>(func)();
+                return;
+            }
+            if (UNLIKELY(!worker->deque_.push(task)))
+                execute(worker, task);
+        }
+
+        auto numWorkers() const noexcept
+        {
+            return workers_.size();
+        }
+
+        //racy snapshot, fine for reporting
+        auto stats() const noexcept
+        {
+            TaskSchedulerStats total;
+            for (auto worker : workers_)
+            {
+                total.executed_ += worker->executed_.load(std::memory_order_relaxed);
+                total.stolen_ += worker->stolen_.load(std::memory_order_relaxed);
+                total.failed_steals_ += worker->failed_steals_.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        struct Worker
+        {
+            Worker(size_t index, size_t tasks_per_worker, size_t inbound_capacity)
+                : index_(index), deque_(tasks_per_worker), arena_(tasks_per_worker), inbound_(inbound_capacity + 1) {}
+
+            const size_t index_;
+            WSDeque<Task> deque_;
+            TaskArena arena_;
+            LFQueue<Task *> inbound_;   //one extra slot, a full LFQueue would read as empty
+            std::thread *thread_ = nullptr;
+            uint64_t rng_state_ = 0x9E3779B97F4A7C15ULL;
+
+            std::atomic<size_t> executed_ = {0};
+            std::atomic<size_t> stolen_ = {0};
+            std::atomic<size_t> failed_steals_ = {0};
+        };
+
+        static auto execute(Worker *worker, Task *task) noexcept -> void
+        {
+            task->run();
+            worker->executed_.store(worker->executed_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        //drain the SPSC inbound queue into the deque so the tasks become stealable
+        auto drainInbound(Worker *worker) noexcept
+        {
+            for (auto next = worker->inbound_.getNextToRead(); worker->inbound_.size() && next; next = worker->inbound_.getNextToRead())
+            {
+                auto task = *next;
+                worker->inbound_.updateReadIndex();
+                if (UNLIKELY(!worker->deque_.push(task)))
+                    execute(worker, task);
+            }
+        }
+
+        auto trySteal(Worker *worker) noexcept -> Task *
+        {
+            if (workers_.size() == 1)
+                return nullptr;
+
+            //xorshift64 victim selection, then a linear sweep over the others
+            auto &x = worker->rng_state_;
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+
+            const auto start = x % workers_.size();
+            for (size_t i = 0; i < workers_.size(); ++i)
+            {
+                auto victim = workers_[(start + i) % workers_.size()];
+                if (victim == worker)
+                    continue;
+
+                if (auto task = victim->deque_.steal())
+                {
+                    worker->stolen_.store(worker->stolen_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return task;
+                }
+            }
+            worker->failed_steals_.store(worker->failed_steals_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        auto run(Worker *worker) noexcept -> void
+        {
+            current_worker_ = worker;
+            worker->rng_state_ += worker->index_;
+
+            while (running_.load(std::memory_order_relaxed))
+            {
+                drainInbound(worker);
+
+                auto task = worker->deque_.pop();
+                if (!task)
+                    task = trySteal(worker);
+
+                if (task)
+                {
+                    execute(worker, task);
+                    continue;
+                }
+
+                worker->arena_.reclaim();
+                __builtin_ia32_pause();
+            }
+
+            current_worker_ = nullptr;
+        }
+
+        TaskArena submit_arena_;
+        const size_t inbound_capacity_;
+        size_t next_worker_ = 0;
+        std::vector<Worker *> workers_;
+        std::atomic<bool> running_ = {true};
+
+        static inline thread_local Worker *current_worker_ = nullptr;
+    };
+}
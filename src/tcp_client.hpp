@@ -0,0 +1,272 @@
+#pragma once
+
+#include <functional>
+#include <sstream>
+#include <string>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "tcp_socket.hpp"
+
+namespace common {
+    enum class TCPClientState : uint8_t {
+        DISCONNECTED = 0,
+        CONNECTING = 1,
+        CONNECTED = 2,
+        BACKOFF = 3
+    };
+
+    inline auto tcpClientStateToString(TCPClientState state) {
+        switch (state) {
+            case TCPClientState::DISCONNECTED: return "DISCONNECTED";
+            case TCPClientState::CONNECTING: return "CONNECTING";
+            case TCPClientState::CONNECTED: return "CONNECTED";
+            case TCPClientState::BACKOFF: return "BACKOFF";
+        }
+        return "UNKNOWN";
+    }
+
+    struct TCPClientCfg {
+        std::string ip_;
+        std::string iface_;
+        int port_ = -1;
+        //a connect that has not completed by then is abandoned and retried
+        Nanos connect_timeout_ = 1000 * NANO_TO_MILLIS;
+        //retry delay after a failed attempt or a dropped session, doubled per failure up to the max
+        Nanos initial_backoff_ = 10 * NANO_TO_MILLIS;
+        Nanos max_backoff_ = 5000 * NANO_TO_MILLIS;
+        //keep a second session connected, so a drop of the active one fails over without a new handshake
+        bool hot_standby_ = false;
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << "TCPClientCfg[" << ip_ << ":" << port_ << " iface:" << iface_
+               << " connect_timeout_ms:" << connect_timeout_ / NANO_TO_MILLIS
+               << " backoff_ms:" << initial_backoff_ / NANO_TO_MILLIS << "-" << max_backoff_ / NANO_TO_MILLIS
+               << " hot_standby:" << hot_standby_ << "]";
+            return ss.str();
+        }
+    };
+
+    //one session slot of a TCPClient with its own connect / backoff state
+    struct TCPClientSession {
+        TCPSocket socket_;
+        TCPClientState state_ = TCPClientState::DISCONNECTED;
+        //end of the connect timeout while CONNECTING, end of the backoff while BACKOFF
+        Nanos deadline_ = 0;
+        Nanos backoff_ = 0;
+        size_t connect_attempts_ = 0;
+        size_t connects_ = 0;
+
+        explicit TCPClientSession(Logger &logger) : socket_(logger) {}
+    };
+
+    //Non-blocking client state machine, driven by calling poll() and sendAndRecv() from the owning thread's loop:
+    //DISCONNECTED -> CONNECTING (non-blocking connect(), EINPROGRESS) -> CONNECTED on EPOLLOUT with SO_ERROR 0, or
+    //BACKOFF on error / timeout -> CONNECTING again once the backoff expired. An established session that drops goes
+    //to BACKOFF as well. With hot_standby_ a second session is kept connected and becomes the active one the moment
+    //the active session drops. No call ever blocks; a session drop costs the loop a close() and a connect().
+    class TCPClient final {
+    public:
+        std::function<void(TCPSocket *s, Nanos rx_time)> recv_callback_;
+        //a session finished its handshake (active or standby), e.g. to send a logon
+        std::function<void(TCPSocket *s)> connected_callback_;
+        //an established session dropped, right before its socket is closed
+        std::function<void(TCPSocket *s)> disconnected_callback_;
+        //s is now the session send() goes to, after the first connect and after every failover
+        std::function<void(TCPSocket *s)> active_callback_;
+        size_t failovers_ = 0;
+
+        TCPClient(Logger &logger, const TCPClientCfg &cfg)
+            : cfg_(cfg), sessions_{TCPClientSession(logger), TCPClientSession(logger)}, logger_(logger) {
+            efd_ = epoll_create(1);
+            ASSERT(efd_ >= 0, "epoll_create() failed error:" + std::string(std::strerror(errno)));
+            for (auto &session : sessions_)
+                session.socket_.recv_callback_ = [this](auto socket, auto rx_time) { recv_callback_(socket, rx_time); };
+            recv_callback_ = [](auto, auto) {};
+            connected_callback_ = [](auto) {};
+            disconnected_callback_ = [](auto) {};
+            active_callback_ = [](auto) {};
+        }
+
+        ~TCPClient() {
+            stop();
+            close(efd_);
+        }
+
+        TCPClient() = delete;
+        TCPClient(const TCPClient &) = delete;
+        TCPClient(const TCPClient &&) = delete;
+        TCPClient &operator=(const TCPClient &) = delete;
+        TCPClient &operator=(const TCPClient &&) = delete;
+
+        //start connecting the active session, and the standby one if configured
+        auto start() noexcept -> void {
+            logger_.log("%:% %() % start %\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), cfg_.toString());
+            const auto now = getCurrentNanos();
+            startConnect(sessions_[active_], now);
+            if (cfg_.hot_standby_)
+                startConnect(sessions_[active_ ^ 1], now);
+        }
+
+        auto stop() noexcept -> void {
+            for (auto &session : sessions_) {
+                session.socket_.destroy();
+                session.state_ = TCPClientState::DISCONNECTED;
+            }
+        }
+
+        auto isConnected() const noexcept {
+            return sessions_[active_].state_ == TCPClientState::CONNECTED;
+        }
+
+        auto state() const noexcept {
+            return sessions_[active_].state_;
+        }
+
+        auto activeSocket() noexcept -> TCPSocket * {
+            return &sessions_[active_].socket_;
+        }
+
+        auto session(size_t index) noexcept -> TCPClientSession & {
+            return sessions_[index];
+        }
+
+        //readable while a session has epoll events pending, e.g. to nest the client into another epoll set
+        auto epollFd() const noexcept {
+            return efd_;
+        }
+
+        //queue on the active session, false while it is not connected
+        auto send(const void *data, size_t len) noexcept -> bool {
+            auto &session = sessions_[active_];
+            return session.state_ == TCPClientState::CONNECTED && session.socket_.send(data, len);
+        }
+
+        //connect completions, socket readiness, connect timeouts and expired backoffs; returns the epoll events handled
+        auto poll() noexcept -> size_t {
+            const auto n = epoll_wait(efd_, events_, 2, 0);
+            const auto now = getCurrentNanos();
+            for (int i = 0; i < n; ++i) {
+                auto &session = *reinterpret_cast<TCPClientSession *>(events_[i].data.ptr);
+                const auto events = events_[i].events;
+
+                if (session.state_ == TCPClientState::CONNECTING) {
+                    //the connect finished one way or the other
+                    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                        const auto error = getSocketError(session.socket_.fd_);
+                        if (!error && !(events & (EPOLLERR | EPOLLHUP)))
+                            onConnected(session);
+                        else
+                            onConnectFailed(session, now, error ? strerror(error) : "EPOLLERR/EPOLLHUP");
+                    }
+                    continue;
+                }
+
+                if (session.state_ != TCPClientState::CONNECTED)
+                    continue;
+                if (events & EPOLLIN)
+                    session.socket_.readable_ = true;
+                if (events & EPOLLOUT)
+                    session.socket_.writable_ = true;
+                if (events & (EPOLLERR | EPOLLHUP))
+                    onSessionDropped(session, now);
+            }
+
+            for (auto &session : sessions_) {
+                if (session.state_ == TCPClientState::CONNECTING && now >= session.deadline_)
+                    onConnectFailed(session, now, "timeout");
+                else if (session.state_ == TCPClientState::BACKOFF && now >= session.deadline_)
+                    startConnect(session, now);
+            }
+            return n > 0 ? n : 0;
+        }
+
+        //read and flush every connected session, the standby too so it can answer heartbeats
+        auto sendAndRecv() noexcept -> void {
+            for (auto &session : sessions_) {
+                if (session.state_ != TCPClientState::CONNECTED)
+                    continue;
+                auto &socket = session.socket_;
+                while (socket.readable_ && !socket.recv_disconnected_ && socket.recv() > 0) {}
+                socket.flush();
+                if (UNLIKELY(socket.send_disconnected_ || socket.recv_disconnected_))
+                    onSessionDropped(session, getCurrentNanos());
+            }
+        }
+
+    private:
+        auto startConnect(TCPClientSession &session, Nanos now) noexcept -> void {
+            auto &socket = session.socket_;
+            ++session.connect_attempts_;
+            if (socket.connect(cfg_.ip_, cfg_.iface_, cfg_.port_, false) < 0) {
+                onConnectFailed(session, now, strerror(errno));
+                return;
+            }
+
+            epoll_event ev{};
+            ev.events = EPOLLET | EPOLLIN | EPOLLOUT;
+            ev.data.ptr = reinterpret_cast<void *>(&session);
+            ASSERT(epoll_ctl(efd_, EPOLL_CTL_ADD, socket.fd_, &ev) != -1, "epoll_ctl() failed. error:" + std::string(std::strerror(errno)));
+            socket.epollout_registered_ = true;
+            session.state_ = TCPClientState::CONNECTING;
+            session.deadline_ = now + cfg_.connect_timeout_;
+        }
+
+        auto onConnected(TCPClientSession &session) noexcept -> void {
+            session.state_ = TCPClientState::CONNECTED;
+            session.backoff_ = 0;
+            ++session.connects_;
+            logger_.log("%:% %() % connected socket:% attempts:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), session.socket_.fd_, session.connect_attempts_);
+            session.connect_attempts_ = 0;
+            connected_callback_(&session.socket_);
+
+            //the standby won the race while the active session is still down, it takes over
+            if (&session != &sessions_[active_] && sessions_[active_].state_ != TCPClientState::CONNECTED)
+                active_ ^= 1;
+            if (&session == &sessions_[active_])
+                active_callback_(&session.socket_);
+        }
+
+        auto scheduleReconnect(TCPClientSession &session, Nanos now) noexcept -> void {
+            session.socket_.destroy();
+            if (&session != &sessions_[active_] && !cfg_.hot_standby_) {
+                session.state_ = TCPClientState::DISCONNECTED;
+                return;
+            }
+            session.backoff_ = session.backoff_ ? std::min(session.backoff_ * 2, cfg_.max_backoff_) : cfg_.initial_backoff_;
+            session.deadline_ = now + session.backoff_;
+            session.state_ = TCPClientState::BACKOFF;
+        }
+
+        auto onConnectFailed(TCPClientSession &session, Nanos now, const char *reason) noexcept -> void {
+            logger_.log("%:% %() % connect failed socket:% reason:% attempts:% backoff_ms:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_),
+                        session.socket_.fd_, reason, session.connect_attempts_, (session.backoff_ ? std::min(session.backoff_ * 2, cfg_.max_backoff_) : cfg_.initial_backoff_) / NANO_TO_MILLIS);
+            scheduleReconnect(session, now);
+        }
+
+        auto onSessionDropped(TCPClientSession &session, Nanos now) noexcept -> void {
+            logger_.log("%:% %() % session dropped socket:% active:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), session.socket_.fd_, &session == &sessions_[active_]);
+            disconnected_callback_(&session.socket_);
+
+            const auto was_active = (&session == &sessions_[active_]);
+            if (was_active && sessions_[active_ ^ 1].state_ == TCPClientState::CONNECTED) {
+                active_ ^= 1;
+                ++failovers_;
+                active_callback_(&sessions_[active_].socket_);
+            }
+            //the first retry of a session that was up goes out right away
+            session.backoff_ = 0;
+            scheduleReconnect(session, now);
+            session.deadline_ = now;
+        }
+
+        const TCPClientCfg cfg_;
+        int efd_ = -1;
+        epoll_event events_[2];
+        TCPClientSession sessions_[2];
+        size_t active_ = 0;
+        std::string time_str_;
+        Logger &logger_;
+    };
+}
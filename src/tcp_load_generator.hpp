@@ -0,0 +1,443 @@
+#pragma once
+
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "logger.hpp"
+#include "tcp_socket.hpp"
+#include "memory_pool.hpp"
+#include "buffer_pool.hpp"
+#include "intrusive_set.hpp"
+#include "latency_histogram.hpp"
+
+namespace common {
+    enum class LoadMode : uint8_t {
+        //requests go out on a fixed schedule whatever the replies do, latency counts from the scheduled time
+        OPEN_LOOP = 0,
+        //every connection keeps in_flight_ requests outstanding and sends the next one when a reply arrives
+        CLOSED_LOOP = 1
+    };
+
+    inline auto loadModeToString(LoadMode mode) {
+        switch (mode) {
+            case LoadMode::OPEN_LOOP: return "OPEN_LOOP";
+            case LoadMode::CLOSED_LOOP: return "CLOSED_LOOP";
+        }
+        return "UNKNOWN";
+    }
+
+    struct LoadGeneratorCfg {
+        std::string ip_ = "127.0.0.1";
+        std::string iface_ = "lo";
+        int port_ = -1;
+        size_t connections_ = 1000;
+        //bytes per request, the server echoes them back; at least sizeof(LoadMessageHeader)
+        size_t message_size_ = 64;
+        LoadMode mode_ = LoadMode::OPEN_LOOP;
+        //open loop: requests per second over all connections, handed out round robin
+        double rate_ = 10000;
+        //closed loop: requests each connection keeps outstanding
+        size_t in_flight_ = 1;
+        //closed loop: interval between one connection's requests the coordinated omission correction assumes,
+        //0 takes the p50 round trip of the warmup
+        Nanos expected_interval_ = 0;
+        //replies to requests sent before the warmup ended are not measured
+        Nanos warmup_ = 500 * NANO_TO_MILLIS;
+        Nanos duration_ = 2 * NANOS_TO_SECS;
+        //after the last request, how long to wait for the outstanding replies
+        Nanos drain_timeout_ = 1 * NANOS_TO_SECS;
+        Nanos connect_timeout_ = 10 * NANOS_TO_SECS;
+        //small per-connection buffers, thousands of connections add up; they grow up to the max on demand
+        size_t initial_buffer_size_ = 4 * 1024;
+        size_t max_buffer_size_ = 1024 * 1024;
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << "LoadGeneratorCfg[" << ip_ << ":" << port_ << " iface:" << iface_ << " mode:" << loadModeToString(mode_)
+               << " connections:" << connections_ << " message_size:" << message_size_;
+            if (mode_ == LoadMode::OPEN_LOOP)
+                ss << " rate:" << rate_;
+            else
+                ss << " in_flight:" << in_flight_ << " expected_interval_ns:" << expected_interval_;
+            ss << " warmup_ms:" << warmup_ / NANO_TO_MILLIS << " duration_ms:" << duration_ / NANO_TO_MILLIS << "]";
+            return ss.str();
+        }
+    };
+
+    //Start of every request, the rest of message_size_ is filler. The server echoes the bytes unchanged.
+    struct LoadMessageHeader {
+        uint64_t seq_;
+        //when the request was due: the schedule slot in open loop, the send time in closed loop
+        Nanos intended_time_;
+        Nanos send_time_;
+    } __attribute__((packed));
+
+    //A client connection of the generator. The TCPSocket base is what the epoll set and socket sets point to.
+    struct LoadConnection : public TCPSocket {
+        using TCPSocket::TCPSocket;
+
+        bool connected_ = false;
+        uint64_t next_seq_ = 0;
+        uint64_t next_reply_seq_ = 0;
+        //replies and their summed latency inside the measurement window, for the fairness report
+        uint64_t replies_ = 0;
+        double latency_sum_ = 0;
+    };
+
+    struct LoadGeneratorResult {
+        LoadGeneratorCfg cfg_;
+        size_t connected_ = 0;
+        uint64_t sent_ = 0;
+        uint64_t received_ = 0;
+        //replies inside the measurement window
+        uint64_t measured_ = 0;
+        //still outstanding when the drain timed out
+        uint64_t unanswered_ = 0;
+        uint64_t out_of_order_ = 0;
+        size_t disconnects_ = 0;
+        Nanos expected_interval_ = 0;
+        double seconds_ = 0;
+        double msgs_per_sec_ = 0;
+        double mb_per_sec_ = 0;
+        //round trips in ns: corrected_ counts from the intended send time (open loop) or includes the synthesised
+        //samples of recordCorrected() (closed loop), uncorrected_ is what the client saw from its actual send
+        LatencyHistogram corrected_;
+        LatencyHistogram uncorrected_;
+        //open loop: how late requests went out against their schedule slot
+        LatencyHistogram send_lag_;
+        //per-connection replies: min / max and Jain's fairness index, 1 when all got the same share, 1/n when one got all
+        uint64_t min_replies_ = 0;
+        uint64_t max_replies_ = 0;
+        double jain_index_ = 0;
+        //best and worst per-connection mean latency
+        double min_connection_mean_ns_ = 0;
+        double max_connection_mean_ns_ = 0;
+
+        auto toString() const {
+            std::stringstream ss;
+            ss << cfg_.toString() << "\n"
+               << "  connected:" << connected_ << " sent:" << sent_ << " received:" << received_ << " unanswered:" << unanswered_
+               << " out_of_order:" << out_of_order_ << " disconnects:" << disconnects_ << "\n"
+               << "  measured:" << measured_ << " seconds:" << seconds_ << " msgs/s:" << static_cast<uint64_t>(msgs_per_sec_)
+               << " MB/s:" << mb_per_sec_ << "\n"
+               << "  rtt_ns corrected   " << corrected_.toString() << "\n"
+               << "  rtt_ns uncorrected " << uncorrected_.toString() << "\n";
+            if (cfg_.mode_ == LoadMode::OPEN_LOOP)
+                ss << "  send_lag_ns        " << send_lag_.toString() << "\n";
+            else
+                ss << "  expected_interval_ns:" << expected_interval_ << "\n";
+            ss << "  fairness replies min:" << min_replies_ << " max:" << max_replies_ << " jain:" << jain_index_
+               << " connection_mean_ns min:" << static_cast<uint64_t>(min_connection_mean_ns_) << " max:" << static_cast<uint64_t>(max_connection_mean_ns_);
+            return ss.str();
+        }
+    };
+
+    //Capacity test client: opens connections_ non-blocking TCPSocket clients to an echo server and drives them all
+    //from the calling thread with one epoll set, the same edge-triggered readable / send sets TCPServer uses.
+    // - open loop: one global schedule of rate_ requests per second, each slot going to the next connection. A
+    //   request that goes out late, because the generator or a full socket held it up, is still measured from its
+    //   slot, so stalls are not hidden by the client slowing down (coordinated omission).
+    // - closed loop: in_flight_ requests per connection, the next one sent as each reply arrives. Latency is recorded
+    //   with LatencyHistogram::recordCorrected() against the expected interval.
+    //Replies are matched to requests by sequence number per connection. run() blocks for warmup_ + duration_ plus the drain.
+    class TCPLoadGenerator final {
+    public:
+        TCPLoadGenerator(Logger &logger, const LoadGeneratorCfg &cfg)
+            : cfg_(cfg), logger_(logger), buffer_pool_(cfg.initial_buffer_size_, cfg.max_buffer_size_), connection_pool_(cfg.connections_),
+              receive_sockets_(cfg.connections_), send_sockets_(cfg.connections_), events_(cfg.connections_), payload_(cfg.message_size_, 'x') {
+            ASSERT(cfg_.connections_, "load generator needs connections.");
+            ASSERT(cfg_.message_size_ >= sizeof(LoadMessageHeader), "load message_size must be at least " + std::to_string(sizeof(LoadMessageHeader)));
+            ASSERT(cfg_.mode_ == LoadMode::CLOSED_LOOP || cfg_.rate_ > 0, "open loop load needs a rate.");
+            ASSERT(cfg_.mode_ == LoadMode::OPEN_LOOP || cfg_.in_flight_ > 0, "closed loop load needs requests in flight.");
+            efd_ = epoll_create(1);
+            ASSERT(efd_ >= 0, "epoll_create() failed error:" + std::string(std::strerror(errno)));
+        }
+
+        ~TCPLoadGenerator() {
+            for (auto connection : connections_)
+                connection_pool_.deallocate(connection);
+            close(efd_);
+        }
+
+        TCPLoadGenerator() = delete;
+        TCPLoadGenerator(const TCPLoadGenerator &) = delete;
+        TCPLoadGenerator(const TCPLoadGenerator &&) = delete;
+        TCPLoadGenerator &operator=(const TCPLoadGenerator &) = delete;
+        TCPLoadGenerator &operator=(const TCPLoadGenerator &&) = delete;
+
+        //Start every connect, then wait until all finished or connect_timeout_ passed. Returns the connections up.
+        auto connect() noexcept -> size_t {
+            logger_.log("%:% %() % connecting %\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), cfg_.toString());
+            for (size_t i = 0; i < cfg_.connections_; ++i) {
+                auto connection = connection_pool_.allocate(logger_, &buffer_pool_, cfg_.initial_buffer_size_, buffer_pool_.maxChunkSize());
+                if (connection->connect(cfg_.ip_, cfg_.iface_, cfg_.port_, false) < 0) {
+                    logger_.log("%:% %() % connect() failed errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), strerror(errno));
+                    connection_pool_.deallocate(connection);
+                    continue;
+                }
+                //not writable before the handshake finished, EPOLLOUT says when it did
+                connection->writable_ = false;
+                connection->send_set_ = &send_sockets_;
+                epoll_event ev{};
+                ev.events = EPOLLET | EPOLLIN | EPOLLOUT;
+                ev.data.ptr = static_cast<TCPSocket *>(connection);
+                ASSERT(epoll_ctl(efd_, EPOLL_CTL_ADD, connection->fd_, &ev) != -1, "epoll_ctl() failed. error:" + std::string(std::strerror(errno)));
+                connection->epollout_registered_ = true;
+                connections_.push_back(connection);
+            }
+
+            const auto deadline = getCurrentNanos() + cfg_.connect_timeout_;
+            while (connected_ + failed_ < connections_.size() && getCurrentNanos() < deadline)
+                poll();
+            logger_.log("%:% %() % connected:% failed:% of:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), connected_, failed_, cfg_.connections_);
+            return connected_;
+        }
+
+        //Drive the load over the connected connections and measure it. Call once, after connect().
+        auto run() noexcept -> LoadGeneratorResult {
+            ASSERT(connected_, "no load generator connection is up.");
+            result_ = LoadGeneratorResult();
+            result_.cfg_ = cfg_;
+            result_.connected_ = connected_;
+            result_.expected_interval_ = cfg_.expected_interval_;
+
+            const auto start = getCurrentNanos();
+            warmup_end_ = start + cfg_.warmup_;
+            end_ = warmup_end_ + cfg_.duration_;
+            const auto open_loop = (cfg_.mode_ == LoadMode::OPEN_LOOP);
+            const auto interval = open_loop ? static_cast<double>(NANOS_TO_SECS) / cfg_.rate_ : 0.0;
+            //slots are start + k * interval, kept as a count so rounding does not drift the rate
+            uint64_t slot = 0;
+            size_t next_connection = 0;
+
+            if (!open_loop)
+                for (auto connection : connections_)
+                    for (size_t i = 0; connection->connected_ && i < cfg_.in_flight_; ++i)
+                        sendRequest(connection, start, start);
+
+            auto now = start;
+            auto expected_set = !open_loop && cfg_.expected_interval_;
+            for (; now < end_; now = getCurrentNanos()) {
+                if (!expected_set && now >= warmup_end_) {
+                    //closed loop without a configured interval: the typical round trip of the warmup is the pace one connection
+                    //expects. Without a warmup there is nothing to go by and nothing is corrected.
+                    result_.expected_interval_ = static_cast<Nanos>(warmup_histogram_.percentile(0.5));
+                    expected_set = true;
+                }
+                for (Nanos due = start + static_cast<Nanos>(static_cast<double>(slot) * interval);
+                     open_loop && due <= now; due = start + static_cast<Nanos>(static_cast<double>(++slot) * interval)) {
+                    for (size_t tries = 0; tries < connections_.size() && !connections_[next_connection]->connected_; ++tries)
+                        next_connection = (next_connection + 1) % connections_.size();
+                    sendRequest(connections_[next_connection], due, now);
+                    next_connection = (next_connection + 1) % connections_.size();
+                }
+                poll();
+                sendAndRecv();
+            }
+
+            //no more requests, wait for the replies still outstanding
+            const auto drain_deadline = now + cfg_.drain_timeout_;
+            for (; result_.received_ < result_.sent_ && connected_ && now < drain_deadline; now = getCurrentNanos()) {
+                poll();
+                sendAndRecv();
+            }
+            result_.unanswered_ = result_.sent_ - result_.received_;
+
+            summarise();
+            logger_.log("%:% %() % done sent:% received:% measured:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), result_.sent_, result_.received_, result_.measured_);
+            return result_;
+        }
+
+        auto connections() const noexcept -> const std::vector<LoadConnection *> & {
+            return connections_;
+        }
+
+    private:
+        auto sendRequest(LoadConnection *connection, Nanos intended_time, Nanos now) noexcept -> void {
+            if (UNLIKELY(!connection->connected_))
+                return;
+            const LoadMessageHeader header{connection->next_seq_, intended_time, now};
+            memcpy(payload_.data(), &header, sizeof(header));
+            if (UNLIKELY(!connection->send(payload_.data(), payload_.size()))) {
+                onDisconnected(connection);
+                return;
+            }
+            ++connection->next_seq_;
+            ++result_.sent_;
+            if (cfg_.mode_ == LoadMode::OPEN_LOOP && intended_time >= warmup_end_)
+                result_.send_lag_.record(now - intended_time);
+        }
+
+        //every whole echoed request in the receive buffer, a partial one is moved to the front for the next read
+        auto onReplies(LoadConnection *connection) noexcept -> void {
+            const auto now = getCurrentNanos();
+            const auto size = cfg_.message_size_;
+            size_t offset = 0;
+            for (; offset + size <= connection->next_rcv_valid_index_; offset += size) {
+                LoadMessageHeader header;
+                memcpy(&header, connection->rcv_buffer_ + offset, sizeof(header));
+                if (UNLIKELY(header.seq_ != connection->next_reply_seq_))
+                    ++result_.out_of_order_;
+                connection->next_reply_seq_ = header.seq_ + 1;
+                ++result_.received_;
+
+                const auto rtt = static_cast<uint64_t>(now - header.send_time_);
+                if (header.intended_time_ < warmup_end_) {
+                    warmup_histogram_.record(rtt);
+                } else {
+                    const auto corrected = static_cast<uint64_t>(now - header.intended_time_);
+                    result_.uncorrected_.record(rtt);
+                    if (cfg_.mode_ == LoadMode::OPEN_LOOP)
+                        result_.corrected_.record(corrected);
+                    else
+                        result_.corrected_.recordCorrected(rtt, static_cast<uint64_t>(result_.expected_interval_));
+                    if (now <= end_) {
+                        ++result_.measured_;
+                        ++connection->replies_;
+                        connection->latency_sum_ += static_cast<double>(corrected);
+                    }
+                }
+
+                if (cfg_.mode_ == LoadMode::CLOSED_LOOP && now < end_)
+                    sendRequest(connection, now, now);
+            }
+            //a request sent from here may have overflowed the send ring and dropped the connection
+            if (UNLIKELY(!connection->connected_))
+                return;
+            memmove(connection->rcv_buffer_, connection->rcv_buffer_ + offset, connection->next_rcv_valid_index_ - offset);
+            connection->next_rcv_valid_index_ -= offset;
+        }
+
+        //connect completions and socket readiness, like TCPServer::poll() for a set of client sockets
+        auto poll() noexcept -> void {
+            const int n = epoll_wait(efd_, events_.data(), static_cast<int>(events_.size()), 0);
+            for (int i = 0; i < n; ++i) {
+                auto socket = reinterpret_cast<TCPSocket *>(events_[i].data.ptr);
+                auto connection = static_cast<LoadConnection *>(socket);
+                const auto events = events_[i].events;
+
+                if (UNLIKELY(!connection->connected_)) {
+                    if (connection->fd_ < 0)
+                        continue;
+                    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                        const auto error = getSocketError(connection->fd_);
+                        if (!error && !(events & (EPOLLERR | EPOLLHUP))) {
+                            connection->connected_ = true;
+                            connection->writable_ = true;
+                            ++connected_;
+                        } else {
+                            logger_.log("%:% %() % connect failed socket:% error:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), connection->fd_, strerror(error));
+                            epoll_ctl(efd_, EPOLL_CTL_DEL, connection->fd_, nullptr);
+                            connection->destroy();
+                            ++failed_;
+                        }
+                    }
+                    continue;
+                }
+
+                if (events & EPOLLIN) {
+                    socket->readable_ = true;
+                    receive_sockets_.add(socket);
+                }
+                if (events & EPOLLOUT) {
+                    socket->writable_ = true;
+                    if (socket->pendingSendBytes())
+                        send_sockets_.add(socket);
+                }
+                if (events & (EPOLLERR | EPOLLHUP))
+                    onDisconnected(connection);
+            }
+        }
+
+        //one read per readable connection and a flush of every connection with queued requests
+        auto sendAndRecv() noexcept -> void {
+            for (auto i = receive_sockets_.size(); i-- > 0;) {
+                auto socket = receive_sockets_[i];
+                auto connection = static_cast<LoadConnection *>(socket);
+                socket->recvWith([this, connection](TCPSocket *, Nanos) { onReplies(connection); });
+                if (!socket->readable_ || socket->recv_disconnected_)
+                    receive_sockets_.remove(socket);
+                if (UNLIKELY(socket->recv_disconnected_))
+                    onDisconnected(connection);
+            }
+            for (auto i = send_sockets_.size(); i-- > 0;) {
+                auto socket = send_sockets_[i];
+                socket->flush();
+                if (!socket->pendingSendBytes() || socket->send_disconnected_)
+                    send_sockets_.remove(socket);
+                if (UNLIKELY(socket->send_disconnected_))
+                    onDisconnected(static_cast<LoadConnection *>(socket));
+            }
+        }
+
+        //a dropped connection takes no more requests, what it had outstanding counts as unanswered
+        auto onDisconnected(LoadConnection *connection) noexcept -> void {
+            if (!connection->connected_)
+                return;
+            logger_.log("%:% %() % disconnected socket:% outstanding:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), connection->fd_,
+                        connection->next_seq_ - connection->next_reply_seq_);
+            connection->connected_ = false;
+            --connected_;
+            ++result_.disconnects_;
+            receive_sockets_.remove(connection);
+            send_sockets_.remove(connection);
+            epoll_ctl(efd_, EPOLL_CTL_DEL, connection->fd_, nullptr);
+            connection->destroy();
+        }
+
+        auto summarise() noexcept -> void {
+            result_.seconds_ = static_cast<double>(cfg_.duration_) / NANOS_TO_SECS;
+            result_.msgs_per_sec_ = static_cast<double>(result_.measured_) / result_.seconds_;
+            result_.mb_per_sec_ = result_.msgs_per_sec_ * static_cast<double>(cfg_.message_size_) / (1024 * 1024);
+
+            //fairness over the connections that were up at the start of the run
+            double sum = 0;
+            double sum_squares = 0;
+            size_t n = 0;
+            result_.min_replies_ = std::numeric_limits<uint64_t>::max();
+            result_.min_connection_mean_ns_ = std::numeric_limits<double>::max();
+            for (auto connection : connections_) {
+                if (connection->fd_ < 0 && !connection->replies_)
+                    continue;
+                const auto replies = static_cast<double>(connection->replies_);
+                sum += replies;
+                sum_squares += replies * replies;
+                ++n;
+                result_.min_replies_ = std::min(result_.min_replies_, connection->replies_);
+                result_.max_replies_ = std::max(result_.max_replies_, connection->replies_);
+                if (connection->replies_) {
+                    const auto mean = connection->latency_sum_ / replies;
+                    result_.min_connection_mean_ns_ = std::min(result_.min_connection_mean_ns_, mean);
+                    result_.max_connection_mean_ns_ = std::max(result_.max_connection_mean_ns_, mean);
+                }
+            }
+            if (!n)
+                result_.min_replies_ = 0;
+            if (result_.max_connection_mean_ns_ == 0)
+                result_.min_connection_mean_ns_ = 0;
+            result_.jain_index_ = sum_squares > 0 ? sum * sum / (static_cast<double>(n) * sum_squares) : 0;
+        }
+
+        const LoadGeneratorCfg cfg_;
+        Logger &logger_;
+        int efd_ = -1;
+        BufferPool buffer_pool_;
+        MemoryPool<LoadConnection> connection_pool_;
+        std::vector<LoadConnection *> connections_;
+        IntrusiveSet<TCPSocket, &TCPSocket::receive_slot_> receive_sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::send_slot_> send_sockets_;
+        std::vector<epoll_event> events_;
+        std::vector<char> payload_;
+        size_t connected_ = 0;
+        size_t failed_ = 0;
+        Nanos warmup_end_ = 0;
+        Nanos end_ = 0;
+        LatencyHistogram warmup_histogram_;
+        LoadGeneratorResult result_;
+        std::string time_str_;
+    };
+}
@@ -1,26 +1,69 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <functional>
 #include <string>
 
 #include "macros.h"
 #include "time_utils.hpp"
 #include "tcp_socket.hpp"
+#include "memory_pool.hpp"
+#include "buffer_pool.hpp"
+#include "intrusive_set.hpp"
+#include "timer_wheel.hpp"
+#include "rx_capture.hpp"
 
 
 namespace common {
+    //default cap on concurrently accepted connections, further connections are refused
+    constexpr size_t TCPServerMaxConnections = 16 * 1024;
+
     struct TCPServer {
     public:
         int efd_ = -1;
         TCPSocket listener_socket_;
-        epoll_event events_[1024];
-        std::vector<TCPSocket *> sockets_, receive_sockets_, send_sockets_, disconnected_sockets_;
+        //sized to max_connections + listener so one epoll_wait() can report every ready socket
+        std::vector<epoll_event> events_;
+        //all accepted sockets / sockets with unread EPOLLIN edge / unsent bytes / closed this iteration.
+        //membership is stored in the socket itself, so add / remove / lookup are O(1) at any connection count.
+        IntrusiveSet<TCPSocket, &TCPSocket::socket_slot_> sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::receive_slot_> receive_sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::send_slot_> send_sockets_;
+        IntrusiveSet<TCPSocket, &TCPSocket::disconnected_slot_> disconnected_sockets_;
         std::function<void(TCPSocket *s, Nanos rx_time)> recv_callback_;
         std::function<void()> recv_finished_callback_;
+        //called once a connection is accepted, and right before a closed connection is freed
+        std::function<void(TCPSocket *s)> accept_callback_;
+        std::function<void(TCPSocket *s)> disconnect_callback_;
+        //with tx_timestamps_ every accepted socket reports its send timestamps here, see TCPSocket::enableTxTimestamps()
+        std::function<void(TCPSocket *s, uint64_t last_byte, Nanos tx_time)> tx_timestamp_callback_;
+        bool tx_timestamps_ = false;
+        //accepted sockets get a copy of recv_callback_, which may allocate for large captures; off for StaticTCPServer
+        bool copy_recv_callback_ = true;
         std::string time_str_;
         Logger &logger_;
 
+        //accepted sockets and their buffers come from here instead of new TCPSocket / new char[]
+        const size_t initial_buffer_size_;
+        BufferPool buffer_pool_;
+        MemoryPool<TCPSocket> socket_pool_;
+
+        //busy-poll mode, see setBusyPollMode()
+        bool busy_poll_ = false;
+        int busy_poll_usecs_ = 0;
+        int busy_poll_napi_budget_ = 0;
+        size_t busy_poll_read_budget_ = 0;
+        //poll() calls and those that found no ready socket and nothing left to read or flush
+        size_t polls_ = 0;
+        size_t empty_polls_ = 0;
+        //if set, ticked with getCurrentNanos() at the start of every poll(), e.g. for heartbeats and order timeouts
+        TimerWheel *timer_wheel_ = nullptr;
+        //if set, accepted sockets record every chunk they read into it, numbered from 1 in accept order, and each
+        //sendAndRecv() that read something ends with a RECV_FINISHED record; see RxReplay
+        RxCapture *rx_capture_ = nullptr;
+        uint32_t next_capture_id_ = 0;
+
         auto defaultRecvCallback(common::TCPSocket *socket, Nanos rx_time) noexcept {
             logger_.log("%:% %() % TCPServer::defaultRecvCallback() socket:% len:% rx:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, socket->next_rcv_valid_index_, rx_time);
         }
@@ -29,21 +72,34 @@ namespace common {
             logger_.log("%:% %() % TCPServer::defaultRecvFinishedCallback()\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_));
         }
 
-        explicit TCPServer(Logger &logger): listener_socket_ (logger), logger_(logger) {
+        explicit TCPServer(Logger &logger, size_t max_connections = TCPServerMaxConnections, size_t initial_buffer_size = TCPInitialBufferSize, size_t max_buffer_size = TCPBufferSize)
+            : listener_socket_ (logger), events_(max_connections + 1),
+              sockets_(max_connections), receive_sockets_(max_connections), send_sockets_(max_connections), disconnected_sockets_(max_connections),
+              logger_(logger), initial_buffer_size_(initial_buffer_size),
+              buffer_pool_(initial_buffer_size, max_buffer_size), socket_pool_(max_connections) {
             recv_callback_ = [this](auto socket, auto rx_time) {
                 defaultRecvCallback(socket, rx_time);
             };
             recv_finished_callback_ = [this]() {
                 defaultRecvFinishedCallback();
             };
+            accept_callback_ = [](auto) {};
+            disconnect_callback_ = [](auto) {};
+            tx_timestamp_callback_ = [](auto, auto, auto) {};
         }
 
-        auto common::TCPServer::destroy() {
+        auto destroy() {
             close(efd_);
             efd_ = -1;
             listener_socket_.destroy();
         }
 
+        ~TCPServer() {
+            for (auto socket : sockets_)
+                socket_pool_.deallocate(socket);
+            destroy();
+        }
+
         TCPServer() = delete;
         TCPServer(const TCPServer &) = delete;
         TCPServer(const TCPServer &&) = delete;
@@ -57,48 +113,89 @@ namespace common {
         //EPOLLET enalbed the edge-triggered-epoll option -> only nofitied when data need to be read,
         //leave the developer to read the data when they want.
         //EPOLLIN is used for notification once data is avaiable to be read
-        auto TCPServer::epoll_add(TCPSocket *socket) {
+        //EPOLLOUT fires (edge-triggered) once a socket whose send ring hit EAGAIN becomes writable again
+        auto epoll_add(TCPSocket *socket) {
             epoll_event ev{};
-            ev.events = EPOLLET | EPOLLIN;
+            ev.events = EPOLLET | EPOLLIN | EPOLLOUT;
             ev.data.ptr = reinterpret_cast<void *> (socket);
+            socket->epollout_registered_ = true;
             return (epoll_ctl(efd_, EPOLL_CTL_ADD, socket->fd_, &ev) != -1);
         }
 
+        //Busy-poll mode for a thread that owns its core and spins on poll() / sendAndRecv():
+        // - SO_BUSY_POLL / SO_PREFER_BUSY_POLL / SO_BUSY_POLL_BUDGET on every socket where permitted, so the kernel
+        //   polls the NIC queue instead of waiting for interrupts.
+        // - every readable socket is drained until EAGAIN in one sendAndRecv(), up to read_budget bytes, so one
+        //   fast sender cannot starve the others.
+        auto setBusyPollMode(bool enable, int busy_poll_usecs = 50, size_t read_budget = 256 * 1024, int napi_budget = 64) -> void {
+            busy_poll_ = enable;
+            busy_poll_usecs_ = busy_poll_usecs;
+            busy_poll_napi_budget_ = napi_budget;
+            busy_poll_read_budget_ = read_budget;
+
+            if (listener_socket_.fd_ >= 0)
+                applyBusyPoll(&listener_socket_);
+            for (auto socket : sockets_)
+                applyBusyPoll(socket);
+        }
+
+        auto applyBusyPoll(TCPSocket *socket) noexcept -> void {
+            if (!setBusyPoll(socket->fd_, busy_poll_, busy_poll_usecs_, busy_poll_napi_budget_))
+                logger_.log("%:% %() % setBusyPoll() not permitted socket:% errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, strerror(errno));
+        }
+
+        auto emptyPollRatio() const noexcept {
+            return polls_ ? static_cast<double>(empty_polls_) / static_cast<double>(polls_) : 0.0;
+        }
+
         //listen() first create a epoll instance using the epoll_create() Linux sys call,
         //and then save it in the efd_ var.
         //Then use the TCPSocket::connect() method we built to initialize listener_socket_,
         //but we must set the listening param to be true.
         //Finally we add listener_socket_ to the list of sockets to be monitored using epoll_add()
-        auto TCPServer::listen(const std::string &iface, int port) -> void {
+        //reuse_port lets several servers (e.g. ShardedTCPServer shards) listen on the same port
+        auto listen(const std::string &iface, int port, bool reuse_port = false) -> void {
             destroy();
             efd_ = epoll_create(1);
             ASSERT(efd_ >= 0, "epoll_create() failed error:" + std::string(std::strerror(errno)));
-            ASSERT(listener_socket_.connect("", iface, port, true) >= 0, "Listener socket failed to connect. iface:" + iface + " port:" + std::to_string(port) + " error:" + std::string(std::strerror(errno)));
+            ASSERT(listener_socket_.connect("", iface, port, true, reuse_port) >= 0, "Listener socket failed to connect. iface:" + iface + " port:" + std::to_string(port) + " error:" + std::string(std::strerror(errno)));
             ASSERT(epoll_add(&listener_socket_), "epoll_ctl() failed. error:" + std::string(std::strerror(errno)));
         }
 
         //epoll_del use epoll_ctl to set the EPOLL_CTL_DEL,
         //remove the TCPSocket from the list of sockets being monitored
-        auto TCPServer::epoll_del(TCPSocket *socket) {
+        auto epoll_del(TCPSocket *socket) {
             return (epoll_ctl(efd_, EPOLL_CTL_DEL, socket->fd_, nullptr) != -1);
         }
 
         //
-        auto TCPServer::del(TCPSocket *socket) {
+        auto del(TCPSocket *socket) {
             epoll_del(socket);
-            sockets_.erase(std::remove(sockets_.begin(), sockets_.end(), socket), sockets_.end());
-            receive_sockets_.erase(std::remove(receive_sockets_.begin(),receive_sockets_.end(), socket), receive_sockets_.end());
-            send_sockets_.erase(std::remove(send_sockets_.begin(), send_sockets_.end(), socket), send_sockets_.end());
+            sockets_.remove(socket);
+            receive_sockets_.remove(socket);
+            send_sockets_.remove(socket);
+            disconnected_sockets_.remove(socket);
         }
 
-        auto TCPServer::poll() noexcept -> void {
-            const int max_events = 1 + sockets_.size();
-            for (auto &socket:disconnected_sockets_) {
+        auto poll() noexcept -> void {
+            if (timer_wheel_)
+                timer_wheel_->tick(getCurrentNanos());
+
+            while (!disconnected_sockets_.empty()) {
+                auto socket = disconnected_sockets_.front();
+                logger_.log("%:% %() % closing socket:% pending_send:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_, socket->pendingSendBytes());
+                disconnect_callback_(socket);
                 del(socket);
+                socket_pool_.deallocate(socket);
             }
-            const int n = epoll_wait(efd_, events_, max_events, 0);
+
+            const int n = epoll_wait(efd_, events_.data(), static_cast<int>(events_.size()), 0);
             bool have_new_connection = false;
 
+            ++polls_;
+            if (!n && receive_sockets_.empty() && send_sockets_.empty())
+                ++empty_polls_;
+
             for (int i = 0; i < n; ++i) {
                 epoll_event &event = events_[i];
                 auto socket = reinterpret_cast<TCPSocket *>(event.data.ptr);
@@ -111,19 +208,25 @@ namespace common {
                     }
 
                     logger_.log("%:% %() % EPOLLIN socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_);
-                    if(std::find(receive_sockets_.begin(), receive_sockets_.end(), socket) == receive_sockets_.end()) receive_sockets_.push_back(socket);
+                    socket->readable_ = true;
+                    receive_sockets_.add(socket);
                 }
 
-                if (event.events && EPOLLOUT) {
+                if (event.events & EPOLLOUT) {
                     logger_.log("%:% %() % EPOLLOUT socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_);
-                    if (std::find(send_sockets_.begin(), send_sockets_.end(), socket) == send_sockets_.end())
-                        send_sockets_.push_back(socket);
+                    socket->writable_ = true;
+                    if (socket->pendingSendBytes())
+                        send_sockets_.add(socket);
                 }
 
                 if (event.events & (EPOLLERR | EPOLLHUP)) {
+                    //EPOLLERR also signals send timestamps / zero-copy completions on the error queue, only a pending SO_ERROR is fatal
+                    if ((socket->tx_timestamps_ || socket->zerocopy_) && !(event.events & EPOLLHUP) && !getSocketError(socket->fd_)) {
+                        socket->readErrQueue();
+                        continue;
+                    }
                     logger_.log("%:% %() % EPOLLERR socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), socket->fd_);
-                    if(std::find(disconnected_sockets_.begin(), disconnected_sockets_.end(), socket) == disconnected_sockets_.end())
-                        disconnected_sockets_.push_back(socket);
+                    disconnected_sockets_.add(socket);
                 }
             }
 
@@ -136,33 +239,102 @@ namespace common {
                 if (fd == -1)
                     break;
 
-                ASSERT(setNonBlocking(fd) && setNoDelay(fd), "Failed to set non-blocking or no-delay on socket:" + std::to_string(fd));
+                if (UNLIKELY(socket_pool_.isFull())) {
+                    logger_.log("%:% %() % connection limit reached, refusing socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd);
+                    close(fd);
+                    continue;
+                }
+
+                ASSERT(setNonBlocking(fd) && disableNagle(fd), "Failed to set non-blocking or no-delay on socket:" + std::to_string(fd));
                 logger_.log("%:% %() % accepted socket:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd);
 
-                TCPSocket *socket = new TCPSocket(logger_);
+                TCPSocket *socket = socket_pool_.allocate(logger_, &buffer_pool_, initial_buffer_size_, buffer_pool_.maxChunkSize());
                 socket->fd_ = fd;
-                socket->recv_callback_ = recv_callback_;
+                if (copy_recv_callback_)
+                    socket->recv_callback_ = recv_callback_;
+                socket->send_set_ = &send_sockets_;
+                if (rx_capture_) {
+                    socket->rx_capture_ = rx_capture_;
+                    socket->capture_id_ = ++next_capture_id_;
+                }
+                if (tx_timestamps_) {
+                    socket->tx_timestamp_callback_ = tx_timestamp_callback_;
+                    if (!socket->enableTxTimestamps())
+                        logger_.log("%:% %() % enableTxTimestamps() failed socket:% errno:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd, strerror(errno));
+                }
+                if (busy_poll_)
+                    applyBusyPoll(socket);
                 ASSERT(epoll_add(socket), "Unable to add socket. error:" + std::string(std::strerror(errno)));
-                if (std::find(sockets_.begin(), sockets_.end(), socket) == sockets_.end())
-                    sockets_.push_back(socket);
-                if (std::find(receive_sockets_.begin(),receive_sockets_.end(), socket) == receive_sockets_.end())
-                    receive_sockets_.push_back(socket);
+                sockets_.add(socket);
+                accept_callback_(socket);
+                //data may have arrived before the socket was registered, read until EAGAIN once
+                receive_sockets_.add(socket);
             }
         }
 
-        auto TCPServer::sendAndRecv() noexcept -> void {
+        //Only sockets with work are visited: readable ones until recvmsg() hits EAGAIN, writable ones until
+        //their send ring is empty. Iterating backwards keeps IntrusiveSet::remove() safe inside the loops.
+        auto sendAndRecv() noexcept -> void {
+            sendAndRecvWith([](TCPSocket *socket, Nanos rx_time) { socket->recv_callback_(socket, rx_time); }, recv_finished_callback_);
+        }
+
+        //sendAndRecv() calling on_recv(TCPSocket *, Nanos rx_time) and on_recv_finished() instead of the
+        //std::function callbacks, see StaticTCPServer
+        template<typename RecvHandler, typename RecvFinishedHandler>
+        auto sendAndRecvWith(RecvHandler &&on_recv, RecvFinishedHandler &&on_recv_finished) noexcept -> void {
             auto recv = false;
-            for (auto socket: receive_sockets_) {
-                if (socket->sendAndRecv())
+            for (auto i = receive_sockets_.size(); i-- > 0;) {
+                auto socket = receive_sockets_[i];
+                if (busy_poll_) {
+                    size_t bytes = 0;
+                    for (ssize_t n = 0; bytes < busy_poll_read_budget_ && (n = socket->recvWith(on_recv)) > 0;) {
+                        bytes += n;
+                        recv = true;
+                    }
+                    socket->flush();
+                } else if (socket->sendAndRecvWith(on_recv)) {
                     recv = true;
+                }
+                if (!socket->readable_ || socket->recv_disconnected_)
+                    receive_sockets_.remove(socket);
+                if (UNLIKELY(socket->send_disconnected_ || socket->recv_disconnected_))
+                    disconnected_sockets_.add(socket);
             }
-            if (recv) 
-                recv_finished_callback_();
-            for (auto socket:send_sockets_) {
-                socket->sendAndRecv();
+            if (recv) {
+                if (rx_capture_)
+                    rx_capture_->appendRecvFinished(getCurrentNanos());
+                on_recv_finished();
+            }
+
+            //sockets queued to by callbacks or earlier EAGAIN, dropped from the set once drained.
+            //slow consumers whose send ring overflowed are cut off instead of corrupting their stream
+            for (auto i = send_sockets_.size(); i-- > 0;) {
+                auto socket = send_sockets_[i];
+                socket->flush();
+                if (!socket->pendingSendBytes() || socket->send_disconnected_)
+                    send_sockets_.remove(socket);
+                if (UNLIKELY(socket->send_disconnected_))
+                    disconnected_sockets_.add(socket);
             }
         }
     };
 
-    
-}
\ No newline at end of file
+    //TCPServer whose receive handlers are resolved at compile time: Derived provides
+    //  void onRecv(TCPSocket *socket, Nanos rx_time) noexcept;
+    //  void onRecvFinished() noexcept;
+    //which sendAndRecv() calls directly, so they inline into the receive loop instead of one type-erased call per
+    //read. Accepted sockets get no copy of recv_callback_. Drive it through the Derived type (EventLoop::addTCPServer()
+    //keeps it), a TCPServer & gets the std::function path.
+    template<typename Derived>
+    struct StaticTCPServer : public TCPServer {
+        explicit StaticTCPServer(Logger &logger, size_t max_connections = TCPServerMaxConnections, size_t initial_buffer_size = TCPInitialBufferSize, size_t max_buffer_size = TCPBufferSize)
+            : TCPServer(logger, max_connections, initial_buffer_size, max_buffer_size) {
+            copy_recv_callback_ = false;
+        }
+
+        auto sendAndRecv() noexcept -> void {
+            auto derived = static_cast<Derived *>(this);
+            sendAndRecvWith([derived](TCPSocket *socket, Nanos rx_time) { derived->onRecv(socket, rx_time); }, [derived]() { derived->onRecvFinished(); });
+        }
+    };
+}
@@ -1,52 +1,199 @@
 #pragma once
 
 #include <functional>
+#include <sys/uio.h>
 #include "socket_utils.hpp"
 #include "logger.hpp"
+#include "buffer_pool.hpp"
+#include "intrusive_set.hpp"
+#include "rx_capture.hpp"
 
 
 namespace common {
+    //upper bound a socket's send / receive buffer may grow to
     constexpr size_t TCPBufferSize = 64 * 1024 * 1024;
+    //size each buffer starts at, grown by doubling on demand
+    constexpr size_t TCPInitialBufferSize = 64 * 1024;
+    //sendZeroCopy() copies payloads smaller than this, pinning pages and reading completions costs more than the memcpy
+    constexpr size_t TCPZeroCopyThreshold = 32 * 1024;
+    //zero-copy payloads queued or waiting for their completion, further ones are copied
+    constexpr size_t TCPZeroCopyMaxSegments = 1024;
+
+    //A caller-owned payload handed to sendZeroCopy(). ring_mark_ is send_tail_ when it was queued: ring bytes
+    //before the mark go out first. The kernel numbers every MSG_ZEROCOPY send call, the segment used
+    //[first_id_, first_id_ + num_ids_) and is released once all of them completed.
+    struct ZeroCopySegment {
+        const char *data_ = nullptr;
+        size_t len_ = 0;
+        size_t sent_ = 0;
+        size_t ring_mark_ = 0;
+        uint32_t first_id_ = 0;
+        uint32_t num_ids_ = 0;
+        uint32_t pending_ids_ = 0;
+        bool released_ = false;
+    };
 
     struct TCPSocket {
         int fd_ = -1;
+        //where send_buffer_ / rcv_buffer_ come from, plain new[] when no pool is given
+        BufferPool *buffer_pool_ = nullptr;
+        size_t max_buffer_size_ = TCPBufferSize;
         char *send_buffer_ = nullptr;
-        size_t next_send_valid_index_ = 0;
+        size_t send_buffer_size_ = 0;
+        //send_buffer_ is a ring: [send_head_, send_tail_) are unsent bytes, both only ever grow.
+        size_t send_head_ = 0;
+        size_t send_tail_ = 0;
+        //bytes ever queued by send() / sendZeroCopy(): a message just queued ends at stream offset bytesQueued() - 1
+        uint64_t bytes_queued_ = 0;
+        //zero-copy send mode, see enableZeroCopy(). zc_segments_ is a ring: [zc_head_, zc_send_) are sent and waiting
+        //for completions (or released out of order), [zc_send_, zc_tail_) still have bytes to send.
+        bool zerocopy_ = false;
+        size_t zerocopy_threshold_ = TCPZeroCopyThreshold;
+        std::vector<ZeroCopySegment> zc_segments_;
+        size_t zc_head_ = 0;
+        size_t zc_send_ = 0;
+        size_t zc_tail_ = 0;
+        size_t zc_unsent_bytes_ = 0;
+        //id the kernel gives the next MSG_ZEROCOPY send call
+        uint32_t zc_next_id_ = 0;
+        size_t zerocopy_sends_ = 0;
+        size_t zerocopy_copied_ = 0;
+        size_t zerocopy_fallbacks_ = 0;
         char *rcv_buffer_ = nullptr;
+        size_t rcv_buffer_size_ = 0;
         size_t next_rcv_valid_index_ = 0;
+        //start of the bytes not consumed yet, for readers that leave consumed bytes in place (see MessageFramer)
+        size_t rcv_read_index_ = 0;
         bool send_disconnected_ = false;
         bool recv_disconnected_ = false;
+        //false after EAGAIN, set back by the owner of the epoll set on EPOLLIN / EPOLLOUT.
+        bool readable_ = true;
+        bool writable_ = true;
+        //true once registered with EPOLLOUT, otherwise the send path retries writes on every call.
+        bool epollout_registered_ = false;
+        //positions in the owning TCPServer's socket sets, see IntrusiveSet
+        size_t socket_slot_ = NotInSet;
+        size_t receive_slot_ = NotInSet;
+        size_t send_slot_ = NotInSet;
+        size_t disconnected_slot_ = NotInSet;
+        //set by the server: send() registers the socket here when it queues bytes on an empty ring
+        IntrusiveSet<TCPSocket, &TCPSocket::send_slot_> *send_set_ = nullptr;
+        //if set, every chunk read is appended to it under capture_id_ before the recv callback sees it, see RxReplay
+        RxCapture *rx_capture_ = nullptr;
+        uint32_t capture_id_ = 0;
         struct sockaddr_in inInAddr;
         std::function<void(TCPSocket *s, Nanos rx_time)> recv_callback_;
+        //send timestamps, see enableTxTimestamps(): every byte up to and including stream offset last_byte left for the device at tx_time
+        std::function<void(TCPSocket *s, uint64_t last_byte, Nanos tx_time)> tx_timestamp_callback_;
+        bool tx_timestamps_ = false;
+        //stream offset the kernel's 32 bit OPT_ID keys count from, and the last offset reported, to undo the wrap
+        uint64_t tx_key_base_ = 0;
+        uint64_t last_tx_byte_ = 0;
+        //called with true when unsent bytes rise to send_high_watermark_, with false when they drain to send_low_watermark_.
+        std::function<void(TCPSocket *s, bool above_high_watermark)> send_watermark_callback_;
+        //a payload given to sendZeroCopy() is no longer referenced by the socket or the kernel and may be reused
+        std::function<void(TCPSocket *s, const void *data, size_t len)> zerocopy_release_callback_;
+        //a payload handed to the kernel without its completion when the socket was closed: the kernel may still read it
+        //while it sends the queued data, and no completion will ever tell when it stopped, so do not reuse it
+        std::function<void(TCPSocket *s, const void *data, size_t len)> zerocopy_abandon_callback_;
+        size_t send_high_watermark_ = 0;
+        size_t send_low_watermark_ = 0;
+        bool above_high_watermark_ = false;
         std::string time_str_;
         Logger &logger_;
 
-        size_t TCPBufferSize = 64 * 1024 * 1024;
-
         auto defaultRecvCallback(TCPSocket *socket, Nanos rx_time) noexcept
         {
-            logger_.log("%:% %() % TCPSocket::defaultRecvCallback() socket:% len:% rx:%\n", __FILE__, __LINE__, __FUNCTION__, 
+            logger_.log("%:% %() % TCPSocket::defaultRecvCallback() socket:% len:% rx:%\n", __FILE__, __LINE__, __FUNCTION__,
             getCurrentTimeStr(&time_str_), socket->fd_, socket->next_rcv_valid_index_, rx_time);
         }
 
-        explicit TCPSocket(Logger &logger): logger_(logger) {
-            send_buffer_ = new char[TCPBufferSize];
-            rcv_buffer_ = new char[TCPBufferSize];
+        auto defaultTxTimestampCallback(TCPSocket *socket, uint64_t last_byte, Nanos tx_time) noexcept
+        {
+            logger_.log("%:% %() % TCPSocket::defaultTxTimestampCallback() socket:% last_byte:% tx:%\n", __FILE__, __LINE__, __FUNCTION__,
+            getCurrentTimeStr(&time_str_), socket->fd_, last_byte, tx_time);
+        }
+
+        auto defaultZeroCopyReleaseCallback(TCPSocket *socket, const void *, size_t len) noexcept
+        {
+            logger_.log("%:% %() % TCPSocket::defaultZeroCopyReleaseCallback() socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__,
+            getCurrentTimeStr(&time_str_), socket->fd_, len);
+        }
+
+        auto defaultZeroCopyAbandonCallback(TCPSocket *socket, const void *, size_t len) noexcept
+        {
+            logger_.log("%:% %() % TCPSocket::defaultZeroCopyAbandonCallback() socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__,
+            getCurrentTimeStr(&time_str_), socket->fd_, len);
+        }
+
+        auto defaultSendWatermarkCallback(TCPSocket *socket, bool above_high_watermark) noexcept
+        {
+            logger_.log("%:% %() % TCPSocket::defaultSendWatermarkCallback() socket:% pending:% above_high:%\n", __FILE__, __LINE__, __FUNCTION__,
+            getCurrentTimeStr(&time_str_), socket->fd_, socket->pendingSendBytes(), static_cast<int>(above_high_watermark));
+        }
+
+        explicit TCPSocket(Logger &logger, BufferPool *buffer_pool = nullptr, size_t initial_buffer_size = TCPInitialBufferSize, size_t max_buffer_size = TCPBufferSize)
+            : buffer_pool_(buffer_pool), max_buffer_size_(max_buffer_size), logger_(logger) {
+            ASSERT(initial_buffer_size && initial_buffer_size <= max_buffer_size, "TCPSocket initial buffer size must be in (0, max_buffer_size].");
+            send_buffer_ = acquireBuffer(initial_buffer_size, &send_buffer_size_);
+            rcv_buffer_ = acquireBuffer(initial_buffer_size, &rcv_buffer_size_);
+            send_high_watermark_ = max_buffer_size_ / 2;
+            send_low_watermark_ = max_buffer_size_ / 8;
             //lambda?
             recv_callback_ = [this](auto socket, auto rx_time) {
                 defaultRecvCallback(socket, rx_time);
             };
+            send_watermark_callback_ = [this](auto socket, auto above_high_watermark) {
+                defaultSendWatermarkCallback(socket, above_high_watermark);
+            };
+            tx_timestamp_callback_ = [this](auto socket, auto last_byte, auto tx_time) {
+                defaultTxTimestampCallback(socket, last_byte, tx_time);
+            };
+            zerocopy_release_callback_ = [this](auto socket, auto data, auto len) {
+                defaultZeroCopyReleaseCallback(socket, data, len);
+            };
+            zerocopy_abandon_callback_ = [this](auto socket, auto data, auto len) {
+                defaultZeroCopyAbandonCallback(socket, data, len);
+            };
         }
 
-        auto TCPSocket::destroy() noexcept -> void {
+        auto destroy() noexcept -> void {
+            //completions that already arrived release their payloads, the error queue goes away with the fd
+            if (zerocopy_ && fd_ >= 0)
+                readErrQueue();
             close(fd_);
             fd_ = -1;
+            //payloads the kernel never saw are free again, those still waiting for a completion are abandoned
+            for (; zc_head_ != zc_tail_; ++zc_head_) {
+                auto &segment = zcSegment(zc_head_);
+                if (segment.released_)
+                    continue;
+                if (segment.pending_ids_) {
+                    segment.released_ = true;
+                    zerocopy_abandon_callback_(this, segment.data_, segment.len_);
+                } else {
+                    releaseSegment(segment);
+                }
+            }
+            zc_head_ = zc_send_ = zc_tail_ = 0;
+            zc_unsent_bytes_ = 0;
+            zc_next_id_ = 0;
+            zerocopy_ = false;
+            send_head_ = send_tail_ = 0;
+            rcv_read_index_ = next_rcv_valid_index_ = 0;
+            bytes_queued_ = 0;
+            tx_timestamps_ = false;
+            tx_key_base_ = last_tx_byte_ = 0;
+            readable_ = writable_ = true;
+            send_disconnected_ = recv_disconnected_ = false;
+            epollout_registered_ = false;
+            above_high_watermark_ = false;
         }
 
         ~TCPSocket() {
             destroy();
-            delete[] send_buffer_; send_buffer_ = nullptr;
-            delete[] rcv_buffer_; rcv_buffer_ = nullptr;
+            releaseBuffer(send_buffer_, send_buffer_size_); send_buffer_ = nullptr;
+            releaseBuffer(rcv_buffer_, rcv_buffer_size_); rcv_buffer_ = nullptr;
         }
 
         TCPSocket() = delete;
@@ -55,70 +202,401 @@ namespace common {
         TCPSocket &operator=(const TCPSocket &) = delete;
         TCPSocket &operator=(const TCPSocket &&) = delete;
 
-        auto TCPSocket::connect(const std::string &ip, const std::string &iface, int port, bool is_listening) -> int {
+        auto connect(const std::string &ip, const std::string &iface, int port, bool is_listening, bool reuse_port = false) -> int {
             destroy();
-            fd_ = createSocket(logger_, ip, iface, port, false, false, is_listening, 0, true);
+            fd_ = createSocket(logger_, SocketCfg{ip, iface, port, false, is_listening, true, reuse_port});
             inInAddr.sin_addr.s_addr = INADDR_ANY;
             inInAddr.sin_port = htons(port);
             inInAddr.sin_family = AF_INET;
             return fd_;
         }
 
-        auto TCPSocket::send(const void *data, size_t len) noexcept -> void {
-            if (len > 0) {
-                memcpy(send_buffer_ + next_send_valid_index_, data, len);
-                next_send_valid_index_ += len;
+        //unsent bytes in the ring and in queued zero-copy payloads
+        auto pendingSendBytes() const noexcept -> size_t {
+            return pendingRingBytes() + zc_unsent_bytes_;
+        }
+
+        auto pendingRingBytes() const noexcept -> size_t {
+            return send_tail_ - send_head_;
+        }
+
+        auto bytesQueued() const noexcept -> uint64_t {
+            return bytes_queued_;
+        }
+
+        //Ask for a software send timestamp of every sendmsg(). They are read back from the error queue by
+        //readErrQueue() and reported to tx_timestamp_callback_ by stream offset, see bytesQueued().
+        auto enableTxTimestamps() noexcept -> bool {
+            if (!setTxTimestamping(fd_))
+                return false;
+            //the kernel counts from the bytes already written to the socket
+            tx_key_base_ = bytes_queued_ - pendingSendBytes();
+            last_tx_byte_ = tx_key_base_;
+            tx_timestamps_ = true;
+            return true;
+        }
+
+        //Opt in to MSG_ZEROCOPY for sendZeroCopy() payloads of at least threshold bytes.
+        auto enableZeroCopy(size_t threshold = TCPZeroCopyThreshold) noexcept -> bool {
+            if (!setZeroCopy(fd_))
+                return false;
+            zc_segments_.resize(TCPZeroCopyMaxSegments);
+            zerocopy_threshold_ = threshold;
+            zerocopy_ = true;
+            return true;
+        }
+
+        auto zcSegment(size_t index) noexcept -> ZeroCopySegment & {
+            return zc_segments_[index % zc_segments_.size()];
+        }
+
+        auto releaseSegment(ZeroCopySegment &segment) noexcept -> void {
+            if (segment.released_)
+                return;
+            segment.released_ = true;
+            zerocopy_release_callback_(this, segment.data_, segment.len_);
+        }
+
+        //MSG_ZEROCOPY send calls [lo, hi] completed: release the payloads whose calls have all completed
+        auto onZeroCopyCompletion(uint32_t lo, uint32_t hi, bool copied) noexcept -> void {
+            if (copied)
+                zerocopy_copied_ += hi - lo + 1;
+            for (auto i = zc_head_; i != zc_tail_; ++i) {
+                auto &segment = zcSegment(i);
+                for (uint32_t id = segment.first_id_, n = 0; n < segment.num_ids_; ++id, ++n)
+                    if (static_cast<uint32_t>(id - lo) <= static_cast<uint32_t>(hi - lo))
+                        --segment.pending_ids_;
+                if (!segment.pending_ids_ && segment.sent_ == segment.len_)
+                    releaseSegment(segment);
+            }
+            while (zc_head_ != zc_send_ && zcSegment(zc_head_).released_)
+                ++zc_head_;
+        }
+
+        //Drain the error queue: send timestamps go to tx_timestamp_callback_, zero-copy completions release payloads.
+        auto readErrQueue() noexcept -> void {
+            ErrQueueEntry entry;
+            while (recvErrQueue(fd_, &entry)) {
+                if (entry.origin_ == SO_EE_ORIGIN_ZEROCOPY) {
+                    onZeroCopyCompletion(entry.lo_, entry.hi_, entry.zerocopy_copied_);
+                } else if (entry.origin_ == SO_EE_ORIGIN_TIMESTAMPING && entry.tx_time_) {
+                    //OPT_ID keys are 32 bit, extend relative to the previous report
+                    const auto relative = last_tx_byte_ - tx_key_base_;
+                    last_tx_byte_ += static_cast<uint32_t>(entry.lo_ - static_cast<uint32_t>(relative));
+                    tx_timestamp_callback_(this, last_tx_byte_, entry.tx_time_);
+                }
+            }
+        }
+
+        auto acquireBuffer(size_t size, size_t *actual_size) noexcept -> char * {
+            *actual_size = buffer_pool_ ? buffer_pool_->chunkSize(size) : size;
+            return buffer_pool_ ? buffer_pool_->acquire(size) : new char[size];
+        }
+
+        auto releaseBuffer(char *buffer, size_t size) noexcept -> void {
+            if (buffer_pool_)
+                buffer_pool_->release(buffer, size);
+            else
+                delete[] buffer;
+        }
+
+        //double the send ring until needed bytes fit, unwrapping the unsent bytes to the front of the new buffer
+        auto growSendBuffer(size_t needed) noexcept -> void {
+            auto new_size = send_buffer_size_;
+            while (new_size < needed)
+                new_size *= 2;
+            new_size = std::min(new_size, max_buffer_size_);
+
+            size_t actual_size = 0;
+            auto buffer = acquireBuffer(new_size, &actual_size);
+            const auto pending = pendingRingBytes();
+            const auto offset = send_head_ % send_buffer_size_;
+            const auto first = std::min(pending, send_buffer_size_ - offset);
+            memcpy(buffer, send_buffer_ + offset, first);
+            memcpy(buffer + first, send_buffer_, pending - first);
+
+            releaseBuffer(send_buffer_, send_buffer_size_);
+            send_buffer_ = buffer;
+            send_buffer_size_ = actual_size;
+            for (auto i = zc_send_; i != zc_tail_; ++i)
+                zcSegment(i).ring_mark_ -= send_head_;
+            send_head_ = 0;
+            send_tail_ = pending;
+        }
+
+        //double the receive buffer when the application left it full, keeping the unconsumed bytes
+        auto growRcvBuffer() noexcept -> void {
+            size_t actual_size = 0;
+            auto buffer = acquireBuffer(std::min(rcv_buffer_size_ * 2, max_buffer_size_), &actual_size);
+            memcpy(buffer, rcv_buffer_, next_rcv_valid_index_);
+
+            releaseBuffer(rcv_buffer_, rcv_buffer_size_);
+            rcv_buffer_ = buffer;
+            rcv_buffer_size_ = actual_size;
+        }
+
+        //Queue data for the next flush. If the peer is so slow that the ring overflows the connection is cut off
+        //(send_disconnected_) rather than silently dropping a piece of the stream.
+        auto send(const void *data, size_t len) noexcept -> bool {
+            if (UNLIKELY(send_disconnected_))
+                return false;
+
+            if (UNLIKELY(pendingRingBytes() + len > send_buffer_size_ && pendingRingBytes() + len <= max_buffer_size_))
+                growSendBuffer(pendingRingBytes() + len);
+
+            if (UNLIKELY(pendingRingBytes() + len > send_buffer_size_)) {
+                logger_.log("%:% %() % send ring overflow, cutting off socket:% pending:% len:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, pendingRingBytes(), len);
+                send_disconnected_ = true;
+                return false;
+            }
+
+            const auto offset = send_tail_ % send_buffer_size_;
+            const auto first = std::min(len, send_buffer_size_ - offset);
+            memcpy(send_buffer_ + offset, data, first);
+            memcpy(send_buffer_, static_cast<const char *>(data) + first, len - first);
+            sendCommit(len);
+            return true;
+        }
+
+        //Contiguous room for len bytes at the tail of the send ring, so a message can be encoded in place and queued
+        //with sendCommit(len). nullptr if the free space wraps around the end of the ring or the ring is at its limit,
+        //send() of an encoded copy is the way out then.
+        auto sendReserve(size_t len) noexcept -> char * {
+            if (UNLIKELY(send_disconnected_))
+                return nullptr;
+
+            if (UNLIKELY(pendingRingBytes() + len > send_buffer_size_ && pendingRingBytes() + len <= max_buffer_size_))
+                growSendBuffer(pendingRingBytes() + len);
+
+            const auto offset = send_tail_ % send_buffer_size_;
+            if (UNLIKELY(pendingRingBytes() + len > send_buffer_size_ || offset + len > send_buffer_size_))
+                return nullptr;
+            return send_buffer_ + offset;
+        }
+
+        //queue len bytes written to the ring tail, by send() or after sendReserve()
+        auto sendCommit(size_t len) noexcept -> void {
+            send_tail_ += len;
+            bytes_queued_ += len;
+
+            if (send_set_)
+                send_set_->add(this);
+
+            if (!above_high_watermark_ && pendingSendBytes() >= send_high_watermark_) {
+                above_high_watermark_ = true;
+                send_watermark_callback_(this, true);
+            }
+        }
+
+        //Queue a caller-owned payload without copying it. data must stay untouched until zerocopy_release_callback_
+        //hands it back, which happens once the kernel has released its pages (or right away when the payload is copied:
+        //zero-copy disabled, below zerocopy_threshold_, or too many payloads in flight). Stream order with send() is kept.
+        //Closing the socket first hands it to zerocopy_abandon_callback_ instead.
+        auto sendZeroCopy(const void *data, size_t len) noexcept -> bool {
+            if (!zerocopy_ || len < zerocopy_threshold_ || zc_tail_ - zc_head_ == zc_segments_.size()) {
+                ++zerocopy_fallbacks_;
+                const auto queued = send(data, len);
+                zerocopy_release_callback_(this, data, len);
+                return queued;
+            }
+
+            if (UNLIKELY(send_disconnected_))
+                return false;
+
+            auto &segment = zcSegment(zc_tail_++);
+            segment = {static_cast<const char *>(data), len, 0, send_tail_, zc_next_id_, 0, 0, false};
+            zc_unsent_bytes_ += len;
+            bytes_queued_ += len;
+
+            if (send_set_)
+                send_set_->add(this);
+
+            if (!above_high_watermark_ && pendingSendBytes() >= send_high_watermark_) {
+                above_high_watermark_ = true;
+                send_watermark_callback_(this, true);
+            }
+            return true;
+        }
+
+        //Ring bytes up to ring position limit, at most two iovecs when they wrap. False if the kernel did not take them all.
+        auto flushRing(size_t limit) noexcept -> bool {
+            while (send_head_ < limit) {
+                const auto offset = send_head_ % send_buffer_size_;
+                const auto first = std::min(limit - send_head_, send_buffer_size_ - offset);
+                iovec iov[2] = {{send_buffer_ + offset, first}, {send_buffer_, limit - send_head_ - first}};
+
+                msghdr msg{};
+                msg.msg_iov = iov;
+                msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+                const auto n = ::sendmsg(fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (UNLIKELY(n < 0)) {
+                    if (errno == EINTR)
+                        continue;
+                    if (wouldBlock())
+                        writable_ = false;
+                    else
+                        send_disconnected_ = true;
+                    return false;
+                }
+
+                logger_.log("%:% %() % send socket:% len:% pending:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, n, pendingSendBytes() - n);
+                send_head_ += n;
+                if (static_cast<size_t>(n) < iov[0].iov_len + iov[1].iov_len) {
+                    //partial write: socket buffer is full, wait for EPOLLOUT
+                    writable_ = false;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //The rest of the zero-copy payload at zc_send_. Every successful MSG_ZEROCOPY call takes the next kernel id.
+        //Without option memory for more pinned pages (ENOBUFS) the chunk is sent by copy instead.
+        auto flushZeroCopySegment() noexcept -> bool {
+            auto &segment = zcSegment(zc_send_);
+            while (segment.sent_ < segment.len_) {
+                auto flags = MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY;
+                auto n = ::send(fd_, segment.data_ + segment.sent_, segment.len_ - segment.sent_, flags);
+                if (UNLIKELY(n < 0 && errno == ENOBUFS)) {
+                    flags &= ~MSG_ZEROCOPY;
+                    n = ::send(fd_, segment.data_ + segment.sent_, segment.len_ - segment.sent_, flags);
+                }
+                if (UNLIKELY(n < 0)) {
+                    if (errno == EINTR)
+                        continue;
+                    if (wouldBlock())
+                        writable_ = false;
+                    else
+                        send_disconnected_ = true;
+                    return false;
+                }
+
+                logger_.log("%:% %() % zerocopy send socket:% len:% pending:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, n, pendingSendBytes() - n);
+                if (flags & MSG_ZEROCOPY) {
+                    if (!segment.num_ids_)
+                        segment.first_id_ = zc_next_id_;
+                    ++zc_next_id_;
+                    ++segment.num_ids_;
+                    ++segment.pending_ids_;
+                    ++zerocopy_sends_;
+                }
+                segment.sent_ += n;
+                zc_unsent_bytes_ -= n;
+                if (segment.sent_ < segment.len_) {
+                    writable_ = false;
+                    return false;
+                }
             }
+
+            ++zc_send_;
+            if (!segment.pending_ids_)
+                releaseSegment(segment);
+            while (zc_head_ != zc_send_ && zcSegment(zc_head_).released_)
+                ++zc_head_;
+            return true;
         }
 
-        auto TCPSocket::sendAndRecv() noexcept -> bool {
-            char ctrl[CMSG_SPACE(sizeof(struct timeval))];
-            struct cmsghdr *cmsg = (struct cmsghdr *) &ctrl;
+        //Write as much as the kernel takes: ring bytes and zero-copy payloads in the order they were queued.
+        //Unsent bytes stay queued; on EAGAIN nothing is retried until EPOLLOUT marks the socket writable_ again.
+        auto flush() noexcept -> void {
+            while (pendingSendBytes() && (writable_ || !epollout_registered_)) {
+                const auto ring_limit = zc_send_ != zc_tail_ ? zcSegment(zc_send_).ring_mark_ : send_tail_;
+                if (!flushRing(ring_limit))
+                    break;
+                if (zc_send_ != zc_tail_ && !flushZeroCopySegment())
+                    break;
+            }
+
+            if (!pendingRingBytes()) {
+                //queued payloads all sit at the (empty) ring head, rebase them with it
+                for (auto i = zc_send_; i != zc_tail_; ++i)
+                    zcSegment(i).ring_mark_ = 0;
+                send_head_ = send_tail_ = 0;
+            }
+
+            if (above_high_watermark_ && pendingSendBytes() <= send_low_watermark_) {
+                above_high_watermark_ = false;
+                send_watermark_callback_(this, false);
+            }
+        }
+
+        //One recvmsg() into rcv_buffer_ and, if anything arrived, the recv callback. Returns the bytes read, <= 0 otherwise.
+        auto recv() noexcept -> ssize_t {
+            return recvWith(recv_callback_);
+        }
+
+        //recv() calling handler(TCPSocket *, Nanos rx_time) instead of recv_callback_, resolved at compile time
+        template<typename Handler>
+        auto recvWith(Handler &&handler) noexcept -> ssize_t {
+            if (UNLIKELY(next_rcv_valid_index_ == rcv_buffer_size_ && rcv_buffer_size_ < max_buffer_size_))
+                growRcvBuffer();
+
+            char ctrl[TimestampCtrlSize];
             struct iovec iov;
             iov.iov_base = rcv_buffer_ + next_rcv_valid_index_;
-            iov.iov_len = TCPBufferSize - next_rcv_valid_index_;
+            iov.iov_len = rcv_buffer_size_ - next_rcv_valid_index_;
 
-            msghdr msg;
+            msghdr msg{};
             msg.msg_control = ctrl;
             msg.msg_controllen = sizeof(ctrl);
             msg.msg_name = &inInAddr;
             msg.msg_namelen = sizeof(inInAddr);
             msg.msg_iov = &iov;
             msg.msg_iovlen = 1;
-            
-            const auto n_rcv = recvmsg(fd_, &msg, MSG_DONTWAIT);
-            if (n_rcv > 0) {
-                next_rcv_valid_index_ += n_rcv;
-                Nanos kernel_time = 0;
-                struct timeval time_kernel;
 
-                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP && CMSG_LEN(sizeof(time_kernel))) {
-                    memcpy(&time_kernel, CMSG_DATA(cmsg),sizeof(time_kernel));
-                    kernel_time = time_kernel.tv_sec * NANOS_TO_SECS + time_kernel.tv_usec * NANOS_TO_MICROS;
-                }
+            //a buffer left full at max_buffer_size_ is not read into, a zero length recvmsg() would look like EOF
+            const auto n_rcv = iov.iov_len ? recvmsg(fd_, &msg, MSG_DONTWAIT) : -1;
+            if (n_rcv == 0) {
+                recv_disconnected_ = true;
+            } else if (n_rcv < 0 && iov.iov_len) {
+                if (wouldBlock())
+                    readable_ = false;
+                else if (errno != EINTR)
+                    recv_disconnected_ = true;
+            }
 
+            if (n_rcv > 0) {
+                next_rcv_valid_index_ += n_rcv;
+                const auto kernel_time = getRxTimestamp(&msg);
                 const auto user_time = getCurrentNanos();
+                if (rx_capture_)
+                    rx_capture_->append(capture_id_, kernel_time, user_time, rcv_buffer_ + next_rcv_valid_index_ - n_rcv, n_rcv);
                 logger_.log("%:% %() % read socket:% len:% utime:% ktime:% diff:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, next_rcv_valid_index_, user_time, kernel_time, (user_time - kernel_time));
-                recv_callback_(this, kernel_time);
+                handler(this, kernel_time);
             }
 
-            ssize_t n_send = std::min(TCPBufferSize, next_send_valid_index_);
-            while (n_send > 0) {
-                auto n_send_this_msg = std::min(static_cast<ssize_t> (next_send_valid_index_), n_send);
-                const int flags = MSG_DONTWAIT | MSG_NOSIGNAL | ((n_send_this_msg < n_send)? MSG_MORE : 0);
-                auto n = ::send(fd_, send_buffer_, n_send_this_msg, flags);
+            return n_rcv;
+        }
 
-                if (UNLIKELY(n < 0)) {
-                    if (!wouldBlock())
-                        send_disconnected_ = true;
-                    break;
-                }
-                logger_.log("%:% %() % send socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str_), fd_, n);
-                n_send -= n;
-                ASSERT(n == n_send_this_msg, "Don't support partial send lengths yet.");
-            }
-            next_send_valid_index_ = 0;
+        auto sendAndRecv() noexcept -> bool {
+            return sendAndRecvWith(recv_callback_);
+        }
+
+        template<typename Handler>
+        auto sendAndRecvWith(Handler &&handler) noexcept -> bool {
+            const auto n_rcv = recvWith(handler);
+            flush();
+            if (tx_timestamps_ || zerocopy_)
+                readErrQueue();
             return (n_rcv > 0);
         }
     };
-}
\ No newline at end of file
+
+    //TCPSocket whose receive handler is resolved at compile time: Derived provides
+    //  void onRecv(TCPSocket *socket, Nanos rx_time) noexcept;
+    //which recv() / sendAndRecv() call directly, so it inlines into the read path instead of going through
+    //recv_callback_. Drive it through the Derived type, a TCPSocket * or & gets the std::function path.
+    template<typename Derived>
+    struct StaticTCPSocket : public TCPSocket {
+        using TCPSocket::TCPSocket;
+
+        auto recv() noexcept -> ssize_t {
+            return recvWith([derived = static_cast<Derived *>(this)](TCPSocket *socket, Nanos rx_time) { derived->onRecv(socket, rx_time); });
+        }
+
+        auto sendAndRecv() noexcept -> bool {
+            return sendAndRecvWith([derived = static_cast<Derived *>(this)](TCPSocket *socket, Nanos rx_time) { derived->onRecv(socket, rx_time); });
+        }
+    };
+}
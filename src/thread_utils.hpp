@@ -22,8 +22,8 @@ namespace common
         std::atomic<bool> running(false),
             failed(false);
 
-        // lambda function?
-        auto thread_body = [&]
+        //func and args are moved into the thread body, the caller's temporaries die once we return
+        auto thread_body = [&running, &failed, core_id, name, func = std::forward<T>(func), ... args = std::forward<A>(args)]() mutable
         {
             if (core_id >= 0 && !setThreadCore(core_id))
             {
@@ -34,7 +34,7 @@ namespace common
 
             std::cout << "set core affinity for " << name << " " << pthread_self() << " to " << core_id << std::endl;
             running = true;
-            std::forward<T>(func)((std::forward<A>(args))...);
+            func(args...);
         };
 
         auto t = new std::thread(thread_body);
@@ -49,7 +49,7 @@ namespace common
         {
             t->join();
             delete t;
-            t == nullptr;
+            t = nullptr;
         }
 
         return t;
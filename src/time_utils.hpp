@@ -1,7 +1,11 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include <string>
 
@@ -32,4 +36,65 @@ namespace common
 
         return *time_str;
     }
-}
\ No newline at end of file
+
+    //raw time stamp counter, invariant on current x86 (constant_tsc / nonstop_tsc) and a few ns to read.
+    //other architectures fall back to the system clock
+    inline auto rdtsc() noexcept -> uint64_t
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(getCurrentNanos());
+#endif
+    }
+
+    //TSC reads converted to nanoseconds on the getCurrentNanos() timeline: one rdtsc and a multiply per read.
+    //calibrate() measures the TSC rate against the system clock and re-anchors, call it again to correct drift.
+    class TSCClock final
+    {
+        public:
+            explicit TSCClock(Nanos calibration = 10 * NANO_TO_MILLIS) noexcept
+            {
+                calibrate(calibration);
+            }
+
+            auto calibrate(Nanos interval) noexcept -> void
+            {
+                const auto start_nanos = getCurrentNanos();
+                const auto start_tsc = rdtsc();
+                Nanos end_nanos;
+                while ((end_nanos = getCurrentNanos()) - start_nanos < interval) {}
+                const auto end_tsc = rdtsc();
+
+                nanos_per_tsc_ = static_cast<double>(end_nanos - start_nanos) / static_cast<double>(end_tsc - start_tsc);
+                base_nanos_ = end_nanos;
+                base_tsc_ = end_tsc;
+            }
+
+            auto nanos() const noexcept -> Nanos
+            {
+                return toNanos(rdtsc());
+            }
+
+            auto toNanos(uint64_t tsc) const noexcept -> Nanos
+            {
+                return base_nanos_ + static_cast<Nanos>(static_cast<double>(static_cast<int64_t>(tsc - base_tsc_)) * nanos_per_tsc_);
+            }
+
+            //TSC ticks to a duration in nanoseconds
+            auto ticksToNanos(uint64_t ticks) const noexcept -> double
+            {
+                return static_cast<double>(ticks) * nanos_per_tsc_;
+            }
+
+            auto ghz() const noexcept
+            {
+                return 1.0 / nanos_per_tsc_;
+            }
+
+        private:
+            double nanos_per_tsc_ = 1.0;
+            Nanos base_nanos_ = 0;
+            uint64_t base_tsc_ = 0;
+    };
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "macros.h"
+#include "time_utils.hpp"
+#include "memory_pool.hpp"
+
+namespace common {
+    //6 levels of 64 slots cover 2^36 ticks, ~19 hours at 1us ticks. Later expiries wait in the top level and are
+    //re-filed whenever they come round.
+    constexpr size_t TimerWheelSlotBits = 6;
+    constexpr size_t TimerWheelSlots = 1UL << TimerWheelSlotBits;
+    constexpr size_t TimerWheelLevels = 6;
+
+    struct TimerNode;
+
+    //returned by schedule(), cancel() / reschedule() with it are safe no-ops once the timer fired or was cancelled
+    struct TimerId {
+        TimerNode *node_ = nullptr;
+        uint64_t generation_ = 0;
+
+        auto valid() const noexcept {
+            return node_ != nullptr;
+        }
+    };
+
+    //id is the timer that fired, reschedule(id, ...) from the callback makes a periodic timer
+    using TimerCallback = std::function<void(TimerId id, Nanos now)>;
+
+    struct TimerNode {
+        uint64_t expiry_tick_;
+        //unique per schedule() and 0 once freed, so a stale TimerId never matches a reused block
+        uint64_t generation_;
+        TimerNode *prev_ = nullptr;
+        TimerNode *next_ = nullptr;
+        uint8_t level_ = 0;
+        uint8_t slot_ = 0;
+        //unlinked while its callback runs
+        bool firing_ = false;
+        TimerCallback callback_;
+
+        TimerNode(uint64_t expiry_tick, uint64_t generation, TimerCallback &&callback)
+            : expiry_tick_(expiry_tick), generation_(generation), callback_(std::move(callback)) {}
+    };
+
+    //Hierarchical timer wheel (Varghese & Lauck): level l has 64 slots of 64^l ticks each, a timer is filed in the
+    //lowest level whose span covers its distance and moves down a level whenever the wheel below completes a round.
+    //schedule / cancel / reschedule are O(1), a tick touches only the slots it passes, and empty level 0 stretches
+    //are skipped through a per-level occupancy bitmap. Nodes come from a MemoryPool sized for the maximum number of
+    //pending timers; give it headroom, a nearly full pool scans longer for a free block.
+    //Single-threaded: drive it with tick(now) from the thread's poll loop, now from getCurrentNanos() or TSCClock.
+    //Timers never fire early, and late by at most one tick plus the time between tick() calls.
+    //A higher level slot is moved down in one go when its round starts, so millions of timers set far out cost the
+    //tick() that reaches them a stall of roughly 40ns per timer moved.
+    class TimerWheel final {
+    public:
+        size_t fired_ = 0;
+        //timers moved down a level, and timers past the top level's span re-filed
+        size_t cascaded_ = 0;
+
+        TimerWheel(size_t max_timers, Nanos tick_size, Nanos now)
+            : tick_size_(tick_size), start_(now), now_(now), pool_(max_timers) {
+            ASSERT(tick_size_ > 0, "TimerWheel tick size must be positive.");
+        }
+
+        TimerWheel() = delete;
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel(const TimerWheel &&) = delete;
+        TimerWheel &operator=(const TimerWheel &) = delete;
+        TimerWheel &operator=(const TimerWheel &&) = delete;
+
+        //call callback at the first tick() at or after expiry, an invalid TimerId if max_timers are pending
+        auto schedule(Nanos expiry, TimerCallback callback) noexcept -> TimerId {
+            if (UNLIKELY(pool_.isFull()))
+                return {};
+            auto node = pool_.allocate(expiryTick(expiry), ++generation_, std::move(callback));
+            ++pending_;
+            link(node);
+            return {node, node->generation_};
+        }
+
+        auto scheduleAfter(Nanos delay, TimerCallback callback) noexcept -> TimerId {
+            return schedule(now_ + delay, std::move(callback));
+        }
+
+        //false if the timer already fired or was cancelled, cancelling a timer from its own callback is fine
+        auto cancel(TimerId id) noexcept -> bool {
+            if (!isPending(id))
+                return false;
+            auto node = id.node_;
+            if (node->firing_) {
+                //freed once its callback returns
+                node->generation_ = 0;
+                return true;
+            }
+            unlink(node);
+            release(node);
+            return true;
+        }
+
+        //move a pending timer, or re-arm it from its own callback; false if it already fired or was cancelled
+        auto reschedule(TimerId id, Nanos expiry) noexcept -> bool {
+            if (!isPending(id))
+                return false;
+            auto node = id.node_;
+            if (node->firing_)
+                node->firing_ = false;
+            else
+                unlink(node);
+            node->expiry_tick_ = expiryTick(expiry);
+            link(node);
+            return true;
+        }
+
+        auto rescheduleAfter(TimerId id, Nanos delay) noexcept -> bool {
+            return reschedule(id, now_ + delay);
+        }
+
+        auto isPending(TimerId id) const noexcept -> bool {
+            return id.node_ && id.node_->generation_ == id.generation_;
+        }
+
+        //Advance to now and run every callback that expired, in tick order. Callbacks may schedule, cancel and
+        //reschedule any timer. Returns the number of callbacks run.
+        auto tick(Nanos now) noexcept -> size_t {
+            if (now <= now_)
+                return 0;
+            now_ = now;
+            const auto target = static_cast<uint64_t>((now - start_) / tick_size_);
+            size_t fired = 0;
+
+            while (now_tick_ < target) {
+                //the next occupied level 0 slot in this round, or the start of the next round
+                const auto index = now_tick_ & SlotMask;
+                const auto later = index == SlotMask ? 0 : occupied_[0] & (~0UL << (index + 1));
+                const auto next = now_tick_ - index + (later ? __builtin_ctzl(later) : TimerWheelSlots);
+                if (next > target) {
+                    now_tick_ = target;
+                    break;
+                }
+
+                now_tick_ = next;
+                if (!(now_tick_ & SlotMask))
+                    cascade();
+                fired += fireSlot(now_tick_ & SlotMask);
+            }
+
+            fired_ += fired;
+            return fired;
+        }
+
+        auto pending() const noexcept {
+            return pending_;
+        }
+
+        auto tickSize() const noexcept {
+            return tick_size_;
+        }
+
+        //time of the last tick()
+        auto now() const noexcept {
+            return now_;
+        }
+
+    private:
+        static constexpr uint64_t SlotMask = TimerWheelSlots - 1;
+        static constexpr uint64_t MaxSpan = 1UL << (TimerWheelSlotBits * TimerWheelLevels);
+
+        //first tick at or after expiry, never the current one which has already fired
+        auto expiryTick(Nanos expiry) const noexcept -> uint64_t {
+            const auto ticks = expiry > start_ ? static_cast<uint64_t>((expiry - start_ + tick_size_ - 1) / tick_size_) : 0;
+            return std::max(ticks, now_tick_ + 1);
+        }
+
+        auto link(TimerNode *node) noexcept -> void {
+            auto expiry = node->expiry_tick_;
+            auto delta = expiry - now_tick_;
+            if (UNLIKELY(delta >= MaxSpan)) {
+                //parked in the top level, re-filed when that slot comes round
+                expiry = now_tick_ + MaxSpan - 1;
+                delta = MaxSpan - 1;
+            }
+            size_t level = 0;
+            while (delta >= (1UL << (TimerWheelSlotBits * (level + 1))))
+                ++level;
+            const auto slot = (expiry >> (TimerWheelSlotBits * level)) & SlotMask;
+
+            auto &head = slots_[level][slot];
+            node->level_ = static_cast<uint8_t>(level);
+            node->slot_ = static_cast<uint8_t>(slot);
+            node->prev_ = nullptr;
+            node->next_ = head;
+            if (head)
+                head->prev_ = node;
+            head = node;
+            occupied_[level] |= 1UL << slot;
+        }
+
+        auto unlink(TimerNode *node) noexcept -> void {
+            if (node->next_)
+                node->next_->prev_ = node->prev_;
+            if (node->prev_)
+                node->prev_->next_ = node->next_;
+            else {
+                auto &head = slots_[node->level_][node->slot_];
+                head = node->next_;
+                if (!head)
+                    occupied_[node->level_] &= ~(1UL << node->slot_);
+            }
+            node->prev_ = node->next_ = nullptr;
+        }
+
+        auto release(TimerNode *node) noexcept -> void {
+            node->generation_ = 0;
+            pool_.deallocate(node);
+            --pending_;
+        }
+
+        //now_tick_ starts a level 0 round: re-file the level 1 slot for this round, and upwards while a level
+        //starts a round too. Higher levels only ever re-file into slots ahead of the ones already emptied.
+        auto cascade() noexcept -> void {
+            for (size_t level = 1; level < TimerWheelLevels; ++level) {
+                const auto index = (now_tick_ >> (TimerWheelSlotBits * level)) & SlotMask;
+                auto node = slots_[level][index];
+                //detach the whole list first, a timer can land in the same slot again
+                slots_[level][index] = nullptr;
+                occupied_[level] &= ~(1UL << index);
+                while (node) {
+                    const auto next = node->next_;
+                    link(node);
+                    ++cascaded_;
+                    node = next;
+                }
+                if (index)
+                    break;
+            }
+        }
+
+        //callbacks may cancel other timers of this slot, so take one node at a time off the live list
+        auto fireSlot(uint64_t slot) noexcept -> size_t {
+            size_t fired = 0;
+            auto &head = slots_[0][slot];
+            while (head) {
+                auto node = head;
+                unlink(node);
+                if (UNLIKELY(node->expiry_tick_ > now_tick_)) {
+                    //a parked timer that is still not due
+                    link(node);
+                    ++cascaded_;
+                    continue;
+                }
+
+                const TimerId id{node, node->generation_};
+                node->firing_ = true;
+                node->callback_(id, now_);
+                ++fired;
+                //still firing_ unless the callback re-armed it
+                if (node->firing_)
+                    release(node);
+            }
+            return fired;
+        }
+
+        const Nanos tick_size_;
+        const Nanos start_;
+        Nanos now_;
+        uint64_t now_tick_ = 0;
+        uint64_t generation_ = 0;
+        size_t pending_ = 0;
+        TimerNode *slots_[TimerWheelLevels][TimerWheelSlots] = {};
+        uint64_t occupied_[TimerWheelLevels] = {};
+        MemoryPool<TimerNode> pool_;
+    };
+}
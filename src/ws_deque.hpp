@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+
+#include "macros.h"
+
+namespace common
+{
+    //Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli - PPoPP'13 memory ordering).
+    //The owner thread push()es and pop()s at the bottom, any other thread may steal() from the top.
+    //Capacity is fixed and must be a power of two, push() fails instead of growing the ring.
+    template<typename T>
+    class WSDeque final
+    {
+    public:
+        explicit WSDeque(std::size_t capacity) : store_(capacity), mask_(capacity - 1)
+        {
+            ASSERT(capacity && !(capacity & (capacity - 1)), "WSDeque capacity must be a power of two: " + std::to_string(capacity));
+        }
+
+        WSDeque() = delete;
+        WSDeque(const WSDeque &) = delete;
+        WSDeque(const WSDeque &&) = delete;
+        WSDeque &operator=(const WSDeque &) = delete;
+        WSDeque &operator=(const WSDeque &&) = delete;
+
+        //owner only
+        auto push(T *elem) noexcept -> bool
+        {
+            const auto bottom = bottom_.load(std::memory_order_relaxed);
+            const auto top = top_.load(std::memory_order_acquire);
+            if (UNLIKELY(bottom - top >= static_cast<int64_t>(store_.size())))
+                return false;
+
+            store_[bottom & mask_].store(elem, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        //owner only, LIFO end so the owner keeps working on cache-hot tasks
+        auto pop() noexcept -> T *
+        {
+            const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+            bottom_.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto top = top_.load(std::memory_order_relaxed);
+
+            T *elem = nullptr;
+            if (top <= bottom)
+            {
+                elem = store_[bottom & mask_].load(std::memory_order_relaxed);
+                if (top == bottom)
+                {
+                    //last element, race against thieves for it
+                    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        elem = nullptr;
+                    bottom_.store(bottom + 1, std::memory_order_relaxed);
+                }
+            } else
+            {
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return elem;
+        }
+
+        //any thread, FIFO end. nullptr when empty or when another thief won the race
+        auto steal() noexcept -> T *
+        {
+            auto top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto bottom = bottom_.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+                return nullptr;
+
+            auto elem = store_[top & mask_].load(std::memory_order_relaxed);
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return elem;
+        }
+
+        auto size() const noexcept
+        {
+            const auto size = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+            return static_cast<size_t>(size > 0 ? size : 0);
+        }
+
+    private:
+        std::vector<std::atomic<T *>> store_;
+        const int64_t mask_;
+
+        //top_ is written by thieves, bottom_ only by the owner: keep them on separate cache lines
+        alignas(64) std::atomic<int64_t> top_ = {0};
+        alignas(64) std::atomic<int64_t> bottom_ = {0};
+    };
+}
@@ -0,0 +1,31 @@
+#include "../src/cpu_topology.hpp"
+#include "../src/thread_utils.hpp"
+
+#include <iostream>
+
+auto roleFunction(const std::string &role)
+{
+    std::cout << role << " running on cpu:" << sched_getcpu() << std::endl;
+}
+
+int main(int, char **)
+{
+    using namespace common;
+
+    const CpuTopology topology;
+    std::cout << topology.toString();
+
+    CorePlacementPlanner planner(topology);
+    planner.plan({"network_reactor", "strategy", "logger"});
+    std::cout << planner.toString();
+
+    const std::string reactor = "network_reactor", strategy = "strategy";
+    auto t1 = createAndStartThread(planner.coreFor(reactor), reactor, roleFunction, reactor);
+    auto t2 = createAndStartThread(planner.coreFor(strategy), strategy, roleFunction, strategy);
+
+    t1->join();
+    t2->join();
+
+    std::cout << "main exiting." << std::endl;
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/event_loop.hpp"
+
+#include <atomic>
+
+//One pinned EventLoop running an echo TCPServer, a multicast receiver, an LFQueue consumer, an eventfd and a
+//heartbeat timer, instead of hand-rolled poll() / sendAndRecv() / sleep_for() loops. The main thread drives it with
+//blocking TCP round trips, multicast datagrams, queue messages and eventfd signals, once with a spinning loop and
+//once with a loop that sleeps in epoll_wait() while idle.
+auto runScenario(bool spin, int port) {
+    using namespace common;
+
+    //the loop thread's objects log to their own Logger, Logger is single producer
+    Logger loop_logger(spin ? "event_loop_example_spin.log" : "event_loop_example_sleep.log");
+    Logger main_logger(spin ? "event_loop_example_spin_main.log" : "event_loop_example_sleep_main.log");
+
+    EventLoopCfg cfg;
+    cfg.spin_ = spin;
+    cfg.work_budget_ = 64;
+    EventLoop loop(loop_logger, cfg);
+
+    TCPServer server(loop_logger, 16);
+    server.recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+        socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+        socket->next_rcv_valid_index_ = 0;
+    };
+    server.recv_finished_callback_ = []() noexcept {};
+    server.listen("lo", port);
+    loop.addTCPServer("echo", server);
+
+    McastSocket receiver(loop_logger);
+    std::atomic<size_t> datagrams = {0};
+    receiver.recv_callback_ = [&datagrams](McastSocket *, const char *, size_t, Nanos) noexcept { datagrams.store(datagrams + 1, std::memory_order_relaxed); };
+    ASSERT(receiver.init("239.0.0.1", "lo", port + 1, true) >= 0 && receiver.join("239.0.0.1"), "multicast receiver setup failed.");
+    loop.addMcastSocket("mcast", receiver, EventPriority::LOW);
+
+    constexpr size_t queue_size = 1024;
+    LFQueue<uint64_t> orders(queue_size + 1);
+    uint64_t order_sum = 0;
+    loop.addQueue("orders", orders, [&order_sum](const uint64_t &order) { order_sum += order; }, EventPriority::HIGH);
+
+    std::atomic<uint64_t> signals = {0};
+    const int signal_fd = loop.addEventFd("signals", [&signals](uint64_t count) { signals += count; });
+
+    size_t beats = 0;
+    loop.timers().scheduleAfter(NANO_TO_MILLIS, [&loop, &beats](TimerId id, Nanos) {
+        ++beats;
+        loop.timers().rescheduleAfter(id, NANO_TO_MILLIS);
+    });
+
+    const auto start = getCurrentNanos();
+    loop.start();
+
+    //blocking round trips from a few plain clients
+    constexpr size_t num_clients = 4;
+    constexpr size_t round_trips = 2000;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int clients[num_clients];
+    for (auto &fd : clients) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && disableNagle(fd), "client connect() failed. errno:" + std::string(strerror(errno)));
+    }
+    LatencyHistogram rtt;
+    for (size_t i = 0; i < round_trips; ++i) {
+        for (auto fd : clients) {
+            uint64_t ping = i, pong = 0;
+            const auto t0 = getCurrentNanos();
+            ASSERT(::send(fd, &ping, sizeof(ping), 0) == sizeof(ping) && ::recv(fd, &pong, sizeof(pong), MSG_WAITALL) == sizeof(pong) && pong == ping, "echo failed.");
+            rtt.record(getCurrentNanos() - t0);
+        }
+    }
+    for (auto fd : clients)
+        close(fd);
+
+    //queue messages, waking the loop in case it sleeps
+    constexpr uint64_t num_orders = 100000;
+    for (uint64_t order = 1; order <= num_orders;) {
+        if (orders.size() < queue_size) {
+            *orders.getNextToWriteTo() = order++;
+            orders.updateWriteIndex();
+            if (!spin)
+                loop.wake();
+        }
+    }
+
+    McastSocket sender(main_logger);
+    ASSERT(sender.init("239.0.0.1", "lo", port + 1, false) >= 0, "multicast sender setup failed.");
+    constexpr size_t num_datagrams = 10000;
+    for (size_t i = 0; i < num_datagrams; ++i) {
+        sender.send(&i, sizeof(i));
+        if (sender.pendingSendDatagrams() == McastBatchSize)
+            sender.flush();
+        //stay below the receive buffer while the loop catches up
+        if (i % 128 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    sender.flush();
+
+    for (int i = 0; i < 100; ++i)
+        eventfd_write(signal_fd, 1);
+
+    //let the loop drain everything, and a few heartbeats pass
+    const auto deadline = getCurrentNanos() + 2 * NANOS_TO_SECS;
+    while (getCurrentNanos() < deadline && (datagrams < num_datagrams || orders.size() || signals < 100))
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    loop.stop();
+    const auto elapsed_ms = (getCurrentNanos() - start) / NANO_TO_MILLIS;
+
+    std::cout << (spin ? "spin " : "sleep") << " elapsed_ms:" << elapsed_ms << " datagrams:" << datagrams << "/" << num_datagrams
+              << " orders_sum_ok:" << (order_sum == num_orders * (num_orders + 1) / 2) << " signals:" << signals << " beats:" << beats << std::endl;
+    std::cout << "  tcp round trip ns " << rtt.toString() << std::endl;
+    std::cout << "  " << loop.stats().toString() << std::endl;
+    std::cout << loop.sourcesToString();
+
+    ASSERT(order_sum == num_orders * (num_orders + 1) / 2 && signals == 100, "queue or eventfd work lost.");
+    ASSERT(datagrams == num_datagrams, "multicast datagrams lost:" + std::to_string(datagrams.load()));
+    ASSERT(beats >= static_cast<size_t>(elapsed_ms) / 2, "heartbeat timer starved.");
+}
+
+int main(int, char **) {
+    runScenario(true, 12750);
+    runScenario(false, 12760);
+    return 0;
+}
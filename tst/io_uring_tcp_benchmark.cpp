@@ -0,0 +1,131 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/io_uring_tcp_server.hpp"
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+//Syscalls the servers make on the data path, counted by interposing the libc wrappers TCPServer / TCPSocket call.
+//The clients use send() / recv(), which are not counted. IoUringTCPServer counts its io_uring_enter() calls itself.
+static size_t server_syscalls = 0;
+
+extern "C" {
+    ssize_t recvmsg(int fd, msghdr *msg, int flags) {
+        ++server_syscalls;
+        return syscall(SYS_recvmsg, fd, msg, flags);
+    }
+
+    ssize_t sendmsg(int fd, const msghdr *msg, int flags) {
+        ++server_syscalls;
+        return syscall(SYS_sendmsg, fd, msg, flags);
+    }
+
+    int epoll_wait(int efd, epoll_event *events, int max_events, int timeout) {
+        ++server_syscalls;
+        return static_cast<int>(syscall(SYS_epoll_pwait, efd, events, max_events, timeout, nullptr, 8));
+    }
+}
+
+constexpr size_t MessageSize = 64;
+
+struct Result {
+    double msgs_per_sec_ = 0;
+    double syscalls_per_msg_ = 0;
+    double msgs_per_iteration_ = 0;
+};
+
+//Echo server driven from this thread: every connection keeps depth messages in flight, each loop iteration the
+//clients top up, the server runs poll() / sendAndRecv() once and the clients read their echoes back.
+//own_syscalls() reads the syscalls the server counts itself.
+template<typename Server, typename OwnSyscalls>
+auto runEcho(Server &server, int port, size_t num_clients, size_t depth, size_t messages, OwnSyscalls &&own_syscalls) {
+    using namespace common;
+
+    server.recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+        socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+        socket->next_rcv_valid_index_ = 0;
+    };
+    server.recv_finished_callback_ = []() noexcept {};
+    server.listen("lo", port);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    std::vector<int> clients(num_clients);
+    for (auto &fd : clients) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && disableNagle(fd), "client connect() failed. errno:" + std::string(strerror(errno)));
+    }
+    while (server.sockets_.size() < num_clients) {
+        server.poll();
+        server.sendAndRecv();
+    }
+
+    char payload[MessageSize * 16] = {};
+    char echo[64 * 1024];
+    std::vector<size_t> in_flight(num_clients, 0);
+    std::vector<size_t> received(num_clients, 0);
+    size_t echoed = 0;
+    size_t iterations = 0;
+
+    const auto syscalls_before = server_syscalls + own_syscalls();
+    const auto t0 = getCurrentNanos();
+    while (echoed < messages) {
+        for (size_t i = 0; i < num_clients; ++i) {
+            const auto top_up = depth - in_flight[i];
+            if (top_up && ::send(clients[i], payload, top_up * MessageSize, MSG_DONTWAIT) == static_cast<ssize_t>(top_up * MessageSize))
+                in_flight[i] = depth;
+        }
+        server.poll();
+        server.sendAndRecv();
+        ++iterations;
+        for (size_t i = 0; i < num_clients; ++i) {
+            const auto n = ::recv(clients[i], echo, sizeof(echo), MSG_DONTWAIT);
+            if (n <= 0)
+                continue;
+            received[i] += n;
+            const auto done = received[i] / MessageSize;
+            received[i] %= MessageSize;
+            in_flight[i] -= done;
+            echoed += done;
+        }
+    }
+    const auto elapsed = getCurrentNanos() - t0;
+    const auto syscalls = server_syscalls + own_syscalls() - syscalls_before;
+
+    for (auto fd : clients)
+        close(fd);
+    return Result{static_cast<double>(echoed) * NANOS_TO_SECS / static_cast<double>(elapsed), static_cast<double>(syscalls) / static_cast<double>(echoed),
+                  static_cast<double>(echoed) / static_cast<double>(iterations)};
+}
+
+//TCPServer (epoll + recvmsg() / sendmsg() per socket) against IoUringTCPServer (multishot accept / recv, provided
+//buffers, one io_uring_enter() per poll() and per sendAndRecv() with sends) echoing 64 byte messages over loopback,
+//for a few connection counts. Reports messages per second and server syscalls per message.
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("io_uring_tcp_benchmark.log");
+    constexpr size_t messages = 100000;
+    constexpr size_t depth = 4;
+    int port = 12780;
+
+    for (size_t num_clients : {1, 16, 128}) {
+        TCPServer epoll_server(logger_, 256);
+        const auto epoll = runEcho(epoll_server, port++, num_clients, depth, messages, []() { return size_t{0}; });
+
+        IoUringTCPServer uring_server(logger_, 256);
+        const auto uring = runEcho(uring_server, port++, num_clients, depth, messages, [&uring_server]() { return uring_server.enters_; });
+
+        std::cout << "clients:" << num_clients << " depth:" << depth << " messages:" << messages << std::endl;
+        std::cout << "  epoll    msgs/s:" << static_cast<uint64_t>(epoll.msgs_per_sec_) << " syscalls/msg:" << epoll.syscalls_per_msg_
+                  << " msgs/iteration:" << epoll.msgs_per_iteration_ << std::endl;
+        std::cout << "  io_uring msgs/s:" << static_cast<uint64_t>(uring.msgs_per_sec_) << " syscalls/msg:" << uring.syscalls_per_msg_
+                  << " msgs/iteration:" << uring.msgs_per_iteration_ << " completions:" << uring_server.completions_
+                  << " buffers_exhausted:" << uring_server.buffers_exhausted_ << " buffer_ring:" << uring_server.usesBufRing() << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include "../src/lf_queue.hpp"
+#include "../src/lf_multicast_queue.hpp"
+#include "../src/thread_utils.hpp"
+#include "../src/time_utils.hpp"
+
+#include <atomic>
+#include <iostream>
+
+//a received market data message as the reactor would publish it
+struct Message
+{
+    uint64_t seq_;
+    char payload_[48];
+    uint64_t check_;
+};
+
+constexpr size_t NumConsumers = 3;
+constexpr size_t QueueSize = 1024;
+constexpr uint64_t NumMessages = 2000000;
+
+inline auto makeMessage(uint64_t seq) noexcept
+{
+    Message message{seq, {}, seq * 2654435761ULL};
+    message.payload_[seq % sizeof(message.payload_)] = static_cast<char>(seq);
+    return message;
+}
+
+//what each consumer checks and reports: every message, in order, intact
+struct ConsumerStats
+{
+    uint64_t next_seq_ = 0;
+    uint64_t errors_ = 0;
+    uint64_t batches_ = 0;
+
+    auto onMessage(const Message &message) noexcept
+    {
+        errors_ += (message.seq_ != next_seq_ || message.check_ != message.seq_ * 2654435761ULL);
+        next_seq_ = message.seq_ + 1;
+    }
+};
+
+//The reactor thread publishes every message once to an LFMulticastQueue, and three consumers read all of them at
+//their own pace: the strategy one by one, the logger in batches with extra work per batch, the recorder in batches
+//of at most 64. Then the same fan-out the old way, one LFQueue per consumer and a copy of every message into each.
+//Reports producer ns per message and how often it found the ring full.
+int main(int, char **)
+{
+    using namespace common;
+
+    const auto yield = std::thread::hardware_concurrency() < 2;
+    auto wait = [yield]()
+    {
+        if (yield)
+            std::this_thread::yield();
+    };
+
+    {
+        LFMulticastQueue<Message> queue(QueueSize, NumConsumers);
+        ConsumerStats stats[NumConsumers];
+        std::thread *consumers[NumConsumers];
+
+        //strategy: one element at a time
+        consumers[0] = createAndStartThread(-1, "mc/strategy", [&]()
+        {
+            auto &stats0 = stats[0];
+            while (stats0.next_seq_ < NumMessages)
+            {
+                const auto message = queue.getNextToRead(0);
+                if (!message)
+                {
+                    wait();
+                    continue;
+                }
+                stats0.onMessage(*message);
+                ++stats0.batches_;
+                queue.updateReadIndex(0);
+            }
+        });
+        //logger: everything available, and slow per batch
+        consumers[1] = createAndStartThread(-1, "mc/logger", [&]()
+        {
+            auto &stats1 = stats[1];
+            uint64_t sink = 0;
+            while (stats1.next_seq_ < NumMessages)
+            {
+                if (!queue.readBatch(1, [&stats1](const Message &message) { stats1.onMessage(message); }))
+                {
+                    wait();
+                    continue;
+                }
+                ++stats1.batches_;
+                for (int i = 0; i < 2000; ++i)
+                    sink += rdtsc() & 1;
+            }
+            ASSERT(sink != static_cast<uint64_t>(-1), "logger work optimised out.");
+        });
+        //recorder: bounded batches
+        consumers[2] = createAndStartThread(-1, "mc/recorder", [&]()
+        {
+            auto &stats2 = stats[2];
+            while (stats2.next_seq_ < NumMessages)
+            {
+                if (!queue.readBatch(2, [&stats2](const Message &message) { stats2.onMessage(message); }, 64))
+                {
+                    wait();
+                    continue;
+                }
+                ++stats2.batches_;
+            }
+        });
+        for (auto consumer : consumers)
+            ASSERT(consumer, "consumer thread failed to start.");
+
+        uint64_t full = 0;
+        const auto t0 = getCurrentNanos();
+        for (uint64_t seq = 0; seq < NumMessages; ++seq)
+        {
+            Message *slot;
+            while (!(slot = queue.getNextToWriteTo()))
+            {
+                ++full;
+                wait();
+            }
+            *slot = makeMessage(seq);
+            queue.updateWriteIndex();
+        }
+        const auto elapsed = getCurrentNanos() - t0;
+
+        for (size_t c = 0; c < NumConsumers; ++c)
+        {
+            consumers[c]->join();
+            delete consumers[c];
+            ASSERT(stats[c].next_seq_ == NumMessages && !stats[c].errors_, "consumer " + std::to_string(c) + " missed or corrupted messages.");
+            std::cout << "multicast consumer " << c << " messages:" << stats[c].next_seq_ << " reads:" << stats[c].batches_
+                      << " msgs/read:" << static_cast<double>(stats[c].next_seq_) / static_cast<double>(stats[c].batches_) << std::endl;
+        }
+        std::cout << "multicast producer ns/msg:" << static_cast<double>(elapsed) / NumMessages << " ring_full:" << full << std::endl;
+    }
+
+    {
+        LFQueue<Message> *queues[NumConsumers];
+        for (auto &queue : queues)
+            queue = new LFQueue<Message>(QueueSize);
+        std::thread *consumers[NumConsumers];
+        uint64_t errors[NumConsumers] = {};
+        for (size_t c = 0; c < NumConsumers; ++c)
+        {
+            consumers[c] = createAndStartThread(-1, "lf/consumer" + std::to_string(c), [&, c]()
+            {
+                auto queue = queues[c];
+                for (uint64_t seq = 0; seq < NumMessages;)
+                {
+                    const auto message = queue->getNextToRead();
+                    if (!queue->size() || !message)
+                    {
+                        wait();
+                        continue;
+                    }
+                    errors[c] += (message->seq_ != seq++);
+                    queue->updateReadIndex();
+                }
+            });
+            ASSERT(consumers[c], "consumer thread failed to start.");
+        }
+
+        uint64_t full = 0;
+        const auto t0 = getCurrentNanos();
+        for (uint64_t seq = 0; seq < NumMessages; ++seq)
+        {
+            const auto message = makeMessage(seq);
+            for (auto queue : queues)
+            {
+                while (queue->size() >= QueueSize - 1)
+                {
+                    ++full;
+                    wait();
+                }
+                *queue->getNextToWriteTo() = message;
+                queue->updateWriteIndex();
+            }
+        }
+        const auto elapsed = getCurrentNanos() - t0;
+
+        for (size_t c = 0; c < NumConsumers; ++c)
+        {
+            consumers[c]->join();
+            delete consumers[c];
+            delete queues[c];
+            ASSERT(!errors[c], "LFQueue consumer " + std::to_string(c) + " read out of order.");
+        }
+        std::cout << "per-consumer LFQueue producer ns/msg:" << static_cast<double>(elapsed) / NumMessages << " queue_full:" << full << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/mcast_socket.hpp"
+
+#include <algorithm>
+
+//Publisher and subscriber McastSocket on one loopback multicast group. Every datagram carries a sequence number
+//and its send time; the subscriber checks for gaps and reports datagrams per recvmmsg(), wire -> callback latency from
+//the nanosecond receive timestamps and send() -> wire latency from the publisher's send timestamps.
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("mcast_socket_example.log");
+    const std::string iface = "lo";
+    const std::string group = "239.100.100.1";
+    const int port = 12500;
+
+    struct Packet {
+        uint64_t seq_;
+        Nanos send_time_;
+        char payload_[48];
+    };
+
+    McastSocket subscriber(logger_);
+    subscriber.init(group, iface, port, true);
+    ASSERT(subscriber.join(group), "McastSocket::join() failed. errno:" + std::string(strerror(errno)));
+
+    McastSocket publisher(logger_);
+    publisher.init(group, iface, port, false);
+    const bool tx_timestamps = publisher.enableTxTimestamps();
+
+    uint64_t next_seq = 0;
+    size_t gaps = 0;
+    std::vector<Nanos> kernel_to_user;
+    std::vector<Nanos> send_times;
+    std::vector<Nanos> send_to_wire;
+    publisher.tx_timestamp_callback_ = [&](McastSocket *, uint64_t datagram, Nanos tx_time) noexcept {
+        if (datagram < send_times.size())
+            send_to_wire.push_back(tx_time - send_times[datagram]);
+    };
+    subscriber.recv_callback_ = [&](McastSocket *, const char *data, size_t len, Nanos rx_time) noexcept {
+        ASSERT(len == sizeof(Packet), "unexpected datagram length:" + std::to_string(len));
+        const auto packet = reinterpret_cast<const Packet *>(data);
+        if (packet->seq_ != next_seq)
+            ++gaps;
+        next_seq = packet->seq_ + 1;
+        if (rx_time)
+            kernel_to_user.push_back(getCurrentNanos() - rx_time);
+    };
+
+    //bursts smaller than the socket receive buffer, so loopback does not drop anything
+    constexpr size_t num_packets = 100000;
+    constexpr size_t burst = 256;
+    kernel_to_user.reserve(num_packets);
+    send_times.reserve(num_packets);
+    send_to_wire.reserve(num_packets);
+    Packet packet{};
+    for (size_t sent = 0; sent < num_packets;) {
+        for (size_t i = 0; i < burst && sent < num_packets; ++i, ++sent) {
+            packet.seq_ = sent;
+            packet.send_time_ = getCurrentNanos();
+            send_times.push_back(packet.send_time_);
+            ASSERT(publisher.send(&packet, sizeof(packet)), "McastSocket::send() dropped seq:" + std::to_string(sent));
+        }
+        publisher.flush();
+        publisher.readTxTimestamps();
+
+        while (subscriber.datagrams_received_ < sent)
+            subscriber.recv();
+    }
+
+    publisher.readTxTimestamps();
+
+    std::sort(kernel_to_user.begin(), kernel_to_user.end());
+    std::sort(send_to_wire.begin(), send_to_wire.end());
+    auto percentile = [](const std::vector<Nanos> &v, double p) { return v.empty() ? 0 : v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))]; };
+
+    std::cout << "sent:" << publisher.datagrams_sent_ << " sendmmsg_calls:" << publisher.send_calls_
+              << " received:" << subscriber.datagrams_received_ << " recvmmsg_calls:" << subscriber.recv_calls_
+              << " gaps:" << gaps << " dropped:" << subscriber.datagrams_dropped_ << std::endl;
+    std::cout << "wire_to_callback_ns p50:" << percentile(kernel_to_user, 0.5) << " p99:" << percentile(kernel_to_user, 0.99) << std::endl;
+    std::cout << "send_to_wire_ns tx_timestamps:" << tx_timestamps << " stamps:" << send_to_wire.size()
+              << " p50:" << percentile(send_to_wire, 0.5) << " p99:" << percentile(send_to_wire, 0.99) << std::endl;
+
+    ASSERT(subscriber.datagrams_received_ == num_packets && !gaps, "multicast loopback lost or reordered datagrams.");
+    ASSERT(subscriber.leave(group), "McastSocket::leave() failed. errno:" + std::string(strerror(errno)));
+
+    return 0;
+}
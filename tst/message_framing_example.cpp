@@ -0,0 +1,166 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/message_framing.hpp"
+
+#include <random>
+
+//A TCPServer echoing length-prefixed messages through a MessageFramer, fed by a raw client that writes the stream
+//in random slices so frames arrive split at arbitrary points. Then the same with a fixed-size struct codec, and a
+//frame larger than the server's receive buffer may grow to, which must close the connection rather than stall it.
+struct Order {
+    uint64_t id_;
+    int64_t price_;
+    uint32_t qty_;
+    char side_;
+} __attribute__((packed));
+
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("message_framing_example.log");
+    std::mt19937 rng(42);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    //writes buffer to fd in random 1..max_slice byte pieces, spinning the server in between
+    auto writeSliced = [&](int fd, const std::string &buffer, size_t max_slice, TCPServer &server) {
+        std::uniform_int_distribution<size_t> slice(1, max_slice);
+        for (size_t offset = 0; offset < buffer.size();) {
+            const auto len = std::min(slice(rng), buffer.size() - offset);
+            const auto n = ::send(fd, buffer.data() + offset, len, MSG_DONTWAIT);
+            if (n > 0)
+                offset += n;
+            server.poll();
+            server.sendAndRecv();
+        }
+    };
+
+    {
+        TCPServer server(logger_, 4, 4096);
+        MessageFramer<LengthPrefixedCodec<>> framer(logger_);
+        //echo every message, encoded straight into the send ring with a "re:" prefix
+        framer.message_callback_ = [&framer](TCPSocket *socket, std::string_view msg, Nanos) noexcept {
+            framer.sendWith(socket, msg.size() + 3, [msg](char *body) {
+                memcpy(body, "re:", 3);
+                memcpy(body + 3, msg.data(), msg.size());
+            });
+        };
+        server.recv_callback_ = framer.recvCallback();
+        server.recv_finished_callback_ = []() noexcept {};
+        server.listen("lo", 12650);
+
+        addr.sin_port = htons(12650);
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "client connect() failed. errno:" + std::string(strerror(errno)));
+        while (server.sockets_.empty())
+            server.poll();
+
+        //messages up to 6000 bytes against a 4 KiB initial receive buffer, so some frames need the buffer to grow
+        constexpr size_t num_messages = 5000;
+        std::uniform_int_distribution<size_t> msg_len(0, 6000);
+        std::vector<std::string> messages;
+        std::string stream;
+        for (size_t i = 0; i < num_messages; ++i) {
+            messages.emplace_back(msg_len(rng), static_cast<char>('a' + i % 26));
+            const auto len = static_cast<uint32_t>(messages.back().size());
+            stream.append(reinterpret_cast<const char *>(&len), sizeof(len));
+            stream.append(messages.back());
+        }
+        writeSliced(fd, stream, 1500, server);
+
+        //read back and check every echo
+        MessageFramer<LengthPrefixedCodec<>> client_framer(logger_);
+        TCPSocket client_view(logger_);
+        size_t echoes = 0;
+        client_framer.message_callback_ = [&](TCPSocket *, std::string_view msg, Nanos) noexcept {
+            ASSERT(msg.substr(0, 3) == "re:" && msg.substr(3) == messages[echoes], "echo mismatch at message " + std::to_string(echoes));
+            ++echoes;
+        };
+        client_view.fd_ = fd;
+        client_view.recv_callback_ = client_framer.recvCallback();
+        while (echoes < num_messages) {
+            server.poll();
+            server.sendAndRecv();
+            client_view.recv();
+        }
+        client_view.fd_ = -1;
+        close(fd);
+
+        std::cout << "length_prefixed messages:" << framer.messages_received_ << " echoed:" << echoes
+                  << " server_compactions:" << framer.compactions_ << " encode_copies:" << framer.encode_copies_
+                  << " client_compactions:" << client_framer.compactions_ << std::endl;
+    }
+
+    {
+        TCPServer server(logger_, 4, 4096);
+        MessageFramer<FixedSizeCodec<Order>> framer(logger_);
+        uint64_t next_id = 0;
+        int64_t notional = 0;
+        framer.message_callback_ = [&](TCPSocket *, const Order &order, Nanos) noexcept {
+            ASSERT(order.id_ == next_id++, "order out of sequence:" + std::to_string(order.id_));
+            notional += order.price_ * order.qty_;
+        };
+        server.recv_callback_ = framer.recvCallback();
+        server.recv_finished_callback_ = []() noexcept {};
+        server.listen("lo", 12651);
+
+        addr.sin_port = htons(12651);
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "client connect() failed. errno:" + std::string(strerror(errno)));
+        while (server.sockets_.empty())
+            server.poll();
+
+        constexpr size_t num_orders = 100000;
+        std::string stream;
+        int64_t expected_notional = 0;
+        for (uint64_t i = 0; i < num_orders; ++i) {
+            const Order order{i, static_cast<int64_t>(100 + i % 7), static_cast<uint32_t>(1 + i % 10), (i & 1) ? 'B' : 'S'};
+            expected_notional += order.price_ * order.qty_;
+            stream.append(reinterpret_cast<const char *>(&order), sizeof(order));
+        }
+        writeSliced(fd, stream, 4000, server);
+        while (framer.messages_received_ < num_orders) {
+            server.poll();
+            server.sendAndRecv();
+        }
+        close(fd);
+
+        ASSERT(notional == expected_notional, "fixed size frames corrupted.");
+        std::cout << "fixed_size messages:" << framer.messages_received_ << " compactions:" << framer.compactions_ << " notional:" << notional << std::endl;
+    }
+
+    {
+        TCPServer server(logger_, 4, 4096, 16 * 1024);
+        MessageFramer<LengthPrefixedCodec<>> framer(logger_);
+        size_t disconnects = 0;
+        server.recv_callback_ = framer.recvCallback();
+        server.recv_finished_callback_ = []() noexcept {};
+        server.disconnect_callback_ = [&disconnects](TCPSocket *) noexcept { ++disconnects; };
+        server.listen("lo", 12652);
+
+        addr.sin_port = htons(12652);
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "client connect() failed. errno:" + std::string(strerror(errno)));
+        while (server.sockets_.empty())
+            server.poll();
+
+        //a valid length for the codec, but four times what this server's sockets can buffer
+        const uint32_t len = 64 * 1024;
+        std::string stream(reinterpret_cast<const char *>(&len), sizeof(len));
+        stream.append(1000, 'x');
+        writeSliced(fd, stream, 4000, server);
+        for (size_t i = 0; i < 1000 && !disconnects; ++i) {
+            server.poll();
+            server.sendAndRecv();
+        }
+        close(fd);
+
+        ASSERT(disconnects == 1 && framer.framing_errors_ == 1, "oversized frame did not close the connection.");
+        std::cout << "oversized frame closed, framing_errors:" << framer.framing_errors_ << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include "../src/benchmark.hpp"
+#include "../src/lf_queue.hpp"
+#include "../src/lf_multicast_queue.hpp"
+#include "../src/memory_pool.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/seqlock.hpp"
+
+#include <atomic>
+#include <thread>
+
+struct Order {
+    uint64_t id_;
+    int64_t price_;
+    uint32_t qty_;
+    char side_;
+    char pad_[43];
+};
+
+//Microbenchmarks of the building blocks, written as JSON for tracking between releases:
+//  microbenchmarks [out.json] [baseline.json] [tolerance]
+//With a baseline, benchmarks whose p50 got slower by more than tolerance (default 0.2) are listed and the exit code
+//is 1. The measuring thread is pinned to core 0; the LFQueue handoff threads to cores 1 and 2 when there are three
+//cores, and yield while waiting when there is only one.
+int main(int argc, char **argv) {
+    using namespace common;
+
+    const std::string out_path = argc > 1 ? argv[1] : "microbenchmarks.json";
+    const std::string baseline_path = argc > 2 ? argv[2] : "";
+    const double tolerance = argc > 3 ? std::stod(argv[3]) : 0.2;
+    const auto num_cores = std::thread::hardware_concurrency();
+    const bool spin = num_cores > 1;
+
+    BenchmarkSuite suite("microbenchmarks");
+    BenchmarkCfg cfg;
+    cfg.core_id_ = 0;
+
+    //time functions
+    {
+        uint64_t sink = 0;
+        std::string time_str;
+        cfg.batch_ = 64;
+        suite.run("rdtsc", cfg, [&sink](size_t) { sink += rdtsc(); });
+        suite.run("tsc_clock_nanos", cfg, [&sink, &suite](size_t) { sink += suite.tsc().nanos(); });
+        suite.run("get_current_nanos", cfg, [&sink](size_t) { sink += getCurrentNanos(); });
+        cfg.batch_ = 4;
+        cfg.samples_ = 20000;
+        suite.run("get_current_time_str", cfg, [&sink, &time_str](size_t) { sink += getCurrentTimeStr(&time_str).size(); });
+        ASSERT(sink, "time functions optimised out.");
+    }
+
+    //MemoryPool allocate + deallocate with half the pool live, so the free block scan is realistic
+    {
+        constexpr size_t pool_size = 1024;
+        MemoryPool<Order> pool(pool_size);
+        std::vector<Order *> live;
+        for (size_t i = 0; i < pool_size / 2; ++i)
+            live.push_back(pool.allocate(Order{i, 100, 1, 'B', {}}));
+        cfg.batch_ = 64;
+        cfg.samples_ = 100000;
+        suite.run("memory_pool_alloc_free", cfg, [&pool](size_t i) {
+            auto order = pool.allocate(Order{i, 100, 1, 'B', {}});
+            pool.deallocate(order);
+        });
+        for (auto order : live)
+            pool.deallocate(order);
+    }
+
+    //LFQueue: write + read on one thread, then one-way handoff latency and streaming cost across two threads
+    {
+        constexpr size_t queue_size = 1024;
+        LFQueue<uint64_t> queue(queue_size + 1);
+        uint64_t sum = 0;
+        cfg.batch_ = 64;
+        suite.run("lf_queue_write_read", cfg, [&queue, &sum](size_t i) {
+            *queue.getNextToWriteTo() = i;
+            queue.updateWriteIndex();
+            sum += *queue.getNextToRead();
+            queue.updateReadIndex();
+        });
+
+        constexpr size_t warmup = 1000;
+        constexpr size_t handoffs = 50000;
+        constexpr size_t stream_batch = 256;
+        constexpr size_t streamed = 8000 * stream_batch;
+        const int producer_core = num_cores > 2 ? 1 : -1;
+        const int consumer_core = num_cores > 2 ? 2 : -1;
+        auto wait = [spin]() {
+            if (!spin)
+                std::this_thread::yield();
+        };
+
+        //the consumer stamps every message's age, the producer sends the next one only once the queue is empty
+        BenchmarkResult handoff{"lf_queue_handoff", 1, {}, 0};
+        std::atomic<bool> streaming = {false};
+        auto consumer = createAndStartThread(consumer_core, "bench/consumer", [&]() {
+            for (size_t received = 0; received < warmup + handoffs;) {
+                auto next = queue.getNextToRead();
+                if (!queue.size() || !next) {
+                    wait();
+                    continue;
+                }
+                const auto ticks = rdtsc() - *next;
+                queue.updateReadIndex();
+                if (received++ >= warmup) {
+                    handoff.ticks_.record(ticks);
+                    handoff.total_ticks_ += ticks;
+                }
+            }
+            while (!streaming)
+                wait();
+            for (size_t received = 0; received < streamed;) {
+                for (auto next = queue.getNextToRead(); queue.size() && next; next = queue.getNextToRead()) {
+                    sum += *next;
+                    queue.updateReadIndex();
+                    ++received;
+                }
+                wait();
+            }
+        });
+        ASSERT(consumer, "consumer thread failed to start.");
+
+        auto producer = createAndStartThread(producer_core, "bench/producer", [&]() {
+            for (size_t i = 0; i < warmup + handoffs; ++i) {
+                while (queue.size())
+                    wait();
+                *queue.getNextToWriteTo() = rdtsc();
+                queue.updateWriteIndex();
+            }
+            while (queue.size())
+                wait();
+            streaming = true;
+
+            //the main thread is in join() meanwhile, so the suite is not shared
+            BenchmarkCfg stream_cfg;
+            stream_cfg.core_id_ = producer_core;
+            stream_cfg.warmup_ = 0;
+            stream_cfg.batch_ = stream_batch;
+            stream_cfg.samples_ = streamed / stream_batch;
+            suite.run("lf_queue_stream", stream_cfg, [&queue, &wait](size_t i) {
+                while (queue.size() >= queue_size)
+                    wait();
+                *queue.getNextToWriteTo() = i;
+                queue.updateWriteIndex();
+            });
+        });
+        ASSERT(producer, "producer thread failed to start.");
+        producer->join();
+        consumer->join();
+        delete producer;
+        delete consumer;
+        suite.add(std::move(handoff));
+        ASSERT(sum, "queue reads optimised out.");
+    }
+
+    //LFMulticastQueue: one write read by three consumers on one thread, the cost LFQueue pays three copies for
+    {
+        constexpr size_t num_consumers = 3;
+        LFMulticastQueue<Order> queue(1024, num_consumers);
+        uint64_t sum = 0;
+        cfg.batch_ = 64;
+        cfg.samples_ = 100000;
+        suite.run("lf_multicast_write_read", cfg, [&queue, &sum](size_t i) {
+            *queue.getNextToWriteTo() = Order{i, 100, 1, 'B', {}};
+            queue.updateWriteIndex();
+            for (size_t consumer = 0; consumer < num_consumers; ++consumer) {
+                sum += queue.getNextToRead(consumer)->id_;
+                queue.updateReadIndex(consumer);
+            }
+        });
+        ASSERT(sum, "multicast reads optimised out.");
+    }
+
+    //SeqlockSlot publish and snapshot of a 64 byte value, uncontended
+    {
+        SeqlockSlot<Order> slot;
+        uint64_t sum = 0;
+        cfg.batch_ = 64;
+        cfg.samples_ = 100000;
+        suite.run("seqlock_write", cfg, [&slot](size_t i) { slot.write(Order{i, 100, 1, 'B', {}}); });
+        suite.run("seqlock_read", cfg, [&slot, &sum](size_t) { sum += slot.read().id_; });
+        ASSERT(sum, "seqlock reads optimised out.");
+    }
+
+    //Logger::log producer side: formatting into the queue, the logger thread writes the file
+    {
+        Logger logger("microbenchmarks.log");
+        cfg.batch_ = 1;
+        cfg.warmup_ = 2000;
+        cfg.samples_ = 20000;
+        suite.run("logger_log", cfg, [&logger](size_t i) {
+            logger.log("%:% %() order:% price:% qty:%\n", __FILE__, __LINE__, __FUNCTION__, i, 100.25, 10);
+        });
+    }
+
+    //TCPSocket round trip over loopback: client send, server echo and client read driven from this thread
+    {
+        Logger logger("microbenchmarks_tcp.log");
+        constexpr int port = 12790;
+        TCPServer server(logger, 4);
+        server.recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+            socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+            socket->next_rcv_valid_index_ = 0;
+        };
+        server.recv_finished_callback_ = []() noexcept {};
+        server.listen("lo", port);
+
+        TCPSocket client(logger);
+        ASSERT(client.connect("127.0.0.1", "lo", port, false) >= 0, "client connect() failed.");
+        size_t echoed = 0;
+        client.recv_callback_ = [&echoed](TCPSocket *socket, Nanos) noexcept {
+            echoed += socket->next_rcv_valid_index_;
+            socket->next_rcv_valid_index_ = 0;
+        };
+        while (server.sockets_.empty())
+            server.poll();
+
+        cfg.warmup_ = 500;
+        cfg.samples_ = 3000;
+        suite.run("tcp_socket_round_trip", cfg, [&](size_t i) {
+            const uint64_t ping = i;
+            const auto expected = echoed + sizeof(ping);
+            client.send(&ping, sizeof(ping));
+            client.flush();
+            while (echoed < expected) {
+                server.poll();
+                server.sendAndRecv();
+                client.recv();
+            }
+        });
+    }
+
+    //compared before writing, the baseline may be the output file of the previous run
+    const auto regressed = baseline_path.empty() ? std::vector<std::string>() : suite.regressions(baseline_path, tolerance);
+    for (const auto &regression : regressed)
+        std::cout << "REGRESSION " << regression << std::endl;
+
+    ASSERT(suite.writeJson(out_path), "could not write " + out_path);
+    std::cout << "wrote " << out_path << std::endl;
+    return regressed.empty() ? 0 : 1;
+}
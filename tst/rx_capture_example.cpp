@@ -0,0 +1,141 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/rx_replay.hpp"
+
+#include <map>
+#include <sys/socket.h>
+
+struct Tick {
+    uint64_t seq_;
+    int64_t price_;
+} __attribute__((packed));
+
+//Strategy stand-in: frames Ticks out of the receive buffer, leaves a partial one for the next read, and keeps a
+//per-connection checksum of what it saw plus one reply per tick
+struct TickHandler {
+    std::map<uint32_t, uint64_t> checksums_;
+    size_t ticks_ = 0;
+    size_t batches_ = 0;
+
+    auto onRecv(common::TCPSocket *socket, common::Nanos) noexcept {
+        size_t offset = 0;
+        for (; offset + sizeof(Tick) <= socket->next_rcv_valid_index_; offset += sizeof(Tick)) {
+            Tick tick;
+            memcpy(&tick, socket->rcv_buffer_ + offset, sizeof(tick));
+            auto &checksum = checksums_[socket->capture_id_];
+            checksum = checksum * 31 + tick.seq_ * 7 + static_cast<uint64_t>(tick.price_);
+            ++ticks_;
+            socket->send(&tick.seq_, sizeof(tick.seq_));
+        }
+        memmove(socket->rcv_buffer_, socket->rcv_buffer_ + offset, socket->next_rcv_valid_index_ - offset);
+        socket->next_rcv_valid_index_ -= offset;
+    }
+
+    auto onRecvFinished() noexcept {
+        ++batches_;
+    }
+};
+
+//A TCPServer captures what a few raw clients send, in writes that split Ticks at odd offsets. The capture is then
+//replayed at max speed into a fresh handler, which must see exactly the same ticks per connection, and at recorded
+//speed, which must take about as long as the capture did. Also reports the cost of RxCapture::append().
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("rx_capture_example.log");
+    const std::string capture_path = "rx_capture_example.cap";
+    const int port = 12810;
+    constexpr size_t num_clients = 4;
+    constexpr size_t ticks_per_client = 20000;
+
+    TickHandler live;
+    Nanos capture_span = 0;
+    {
+        RxCapture capture(logger_, capture_path, 1024 * 1024);
+        TCPServer server(logger_, 16);
+        server.rx_capture_ = &capture;
+        server.recv_callback_ = [&live](TCPSocket *socket, Nanos rx_time) noexcept { live.onRecv(socket, rx_time); };
+        server.recv_finished_callback_ = [&live]() noexcept { live.onRecvFinished(); };
+        server.listen("lo", port);
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        int clients[num_clients];
+        for (auto &fd : clients) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && disableNagle(fd), "client connect() failed. errno:" + std::string(strerror(errno)));
+            while (server.sockets_.size() < static_cast<size_t>(&fd - clients + 1))
+                server.poll();
+        }
+
+        std::vector<Tick> ticks(ticks_per_client);
+        for (size_t i = 0; i < ticks_per_client; ++i)
+            ticks[i] = {i, static_cast<int64_t>(10000 + (i * 7919) % 101)};
+        const auto bytes = ticks_per_client * sizeof(Tick);
+        const auto data = reinterpret_cast<const char *>(ticks.data());
+        size_t sent[num_clients] = {};
+        char reply[64 * 1024];
+
+        const auto start = getCurrentNanos();
+        for (size_t round = 0; live.ticks_ < num_clients * ticks_per_client; ++round) {
+            for (size_t c = 0; c < num_clients; ++c) {
+                //write sizes that do not line up with Ticks, so reads end mid-tick
+                const auto len = std::min(bytes - sent[c], 5 + (round * 13 + c * 29) % 300);
+                if (len && ::send(clients[c], data + sent[c], len, MSG_DONTWAIT) > 0)
+                    sent[c] += len;
+            }
+            server.poll();
+            server.sendAndRecv();
+            for (auto fd : clients)
+                while (::recv(fd, reply, sizeof(reply), MSG_DONTWAIT) > 0) {}
+        }
+        capture_span = getCurrentNanos() - start;
+        for (auto fd : clients)
+            close(fd);
+        std::cout << "captured records:" << capture.records() << " bytes:" << capture.bytes() << " dropped:" << capture.dropped()
+                  << " ticks:" << live.ticks_ << " batches:" << live.batches_ << " span_ms:" << capture_span / NANO_TO_MILLIS << std::endl;
+    }
+
+    //max speed, handlers inlined
+    {
+        TickHandler replayed;
+        RxReplay replay(logger_, capture_path);
+        const auto t0 = getCurrentNanos();
+        const auto chunks = replay.replayWith([&replayed](TCPSocket *socket, Nanos rx_time) { replayed.onRecv(socket, rx_time); },
+                                              [&replayed]() { replayed.onRecvFinished(); }, ReplaySpeed::MAX);
+        const auto elapsed = getCurrentNanos() - t0;
+        ASSERT(replayed.checksums_ == live.checksums_ && replayed.ticks_ == live.ticks_ && replayed.batches_ == live.batches_, "replay diverged from the live run.");
+        std::cout << "replay max speed chunks:" << chunks << " ticks:" << replayed.ticks_ << " batches:" << replayed.batches_
+                  << " ns/chunk:" << elapsed / static_cast<Nanos>(chunks) << " discarded_reply_bytes:" << replay.sent_bytes_ << std::endl;
+    }
+
+    //recorded speed through the std::function callbacks
+    {
+        TickHandler replayed;
+        RxReplay replay(logger_, capture_path);
+        replay.recv_callback_ = [&replayed](TCPSocket *socket, Nanos rx_time) noexcept { replayed.onRecv(socket, rx_time); };
+        replay.recv_finished_callback_ = [&replayed]() noexcept { replayed.onRecvFinished(); };
+        const auto t0 = getCurrentNanos();
+        replay.replay(ReplaySpeed::RECORDED);
+        const auto elapsed = getCurrentNanos() - t0;
+        ASSERT(replayed.checksums_ == live.checksums_, "recorded speed replay diverged from the live run.");
+        std::cout << "replay recorded speed span_ms:" << elapsed / NANO_TO_MILLIS << " (captured " << capture_span / NANO_TO_MILLIS << ")" << std::endl;
+    }
+
+    //hot path cost: one 64 byte chunk per append()
+    {
+        TSCClock tsc;
+        RxCapture capture(logger_, "rx_capture_example_append.cap", 64 * 1024 * 1024);
+        char chunk[64] = {};
+        constexpr size_t appends = 200000;
+        const auto t0 = rdtsc();
+        for (size_t i = 0; i < appends; ++i)
+            capture.append(1, static_cast<Nanos>(i), static_cast<Nanos>(i), chunk, sizeof(chunk));
+        std::cout << "append 64B ns:" << tsc.ticksToNanos(rdtsc() - t0) / appends << std::endl;
+    }
+
+    return 0;
+}
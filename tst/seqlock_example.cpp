@@ -0,0 +1,137 @@
+#include "../src/time_utils.hpp"
+#include "../src/thread_utils.hpp"
+#include "../src/seqlock.hpp"
+#include "../src/shared_memory.hpp"
+
+#include <atomic>
+#include <sys/wait.h>
+
+//top of book with a checksum over the other fields, a torn read shows up as a mismatch
+struct Quote {
+    uint64_t seq_;
+    int64_t bid_;
+    int64_t ask_;
+    uint32_t bid_qty_;
+    uint32_t ask_qty_;
+    uint64_t check_;
+};
+
+constexpr size_t NumInstruments = 8;
+using QuoteTable = common::SeqlockTable<Quote, NumInstruments>;
+
+inline auto makeQuote(uint64_t seq) noexcept {
+    Quote quote{seq, static_cast<int64_t>(10000 + seq % 97), static_cast<int64_t>(10001 + seq % 97), static_cast<uint32_t>(seq % 1000), static_cast<uint32_t>(seq % 777), 0};
+    quote.check_ = quote.seq_ * 31 + static_cast<uint64_t>(quote.bid_) * 7 + static_cast<uint64_t>(quote.ask_) * 3 + quote.bid_qty_ + quote.ask_qty_;
+    return quote;
+}
+
+inline auto consistent(const Quote &quote) noexcept {
+    return quote.check_ == makeQuote(quote.seq_).check_;
+}
+
+//One writer thread publishing quotes to a SeqlockTable while reader threads take snapshots: every snapshot must be
+//consistent and no reader ever sees an instrument go back in time. Then the same across processes: the table lives
+//in shared memory, a forked child maps it read-only and checks the snapshots it reads there.
+int main(int, char **) {
+    using namespace common;
+
+    const auto yield = std::thread::hardware_concurrency() < 2;
+
+    {
+        QuoteTable table;
+        std::atomic<bool> running = {true};
+        constexpr size_t num_readers = 3;
+        size_t reads[num_readers] = {};
+        size_t skipped[num_readers] = {};
+        size_t errors[num_readers] = {};
+        std::thread *readers[num_readers];
+
+        for (size_t r = 0; r < num_readers; ++r) {
+            readers[r] = createAndStartThread(-1, "seqlock/reader" + std::to_string(r), [&, r]() {
+                uint64_t last_seq[NumInstruments] = {};
+                uint64_t last_version[NumInstruments] = {};
+                for (size_t i = 0; running; ++i) {
+                    const auto index = i % NumInstruments;
+                    Quote quote;
+                    if (!table.readIfChanged(index, &quote, &last_version[index])) {
+                        ++skipped[r];
+                        if (yield && !(i % 1024))
+                            std::this_thread::yield();
+                        continue;
+                    }
+                    ++reads[r];
+                    if (!consistent(quote) || quote.seq_ < last_seq[index])
+                        ++errors[r];
+                    last_seq[index] = quote.seq_;
+                }
+            });
+            ASSERT(readers[r], "reader thread failed to start.");
+        }
+
+        constexpr size_t writes = 5000000;
+        const auto t0 = getCurrentNanos();
+        for (uint64_t seq = 1; seq <= writes; ++seq) {
+            table.write(seq % NumInstruments, makeQuote(seq));
+            if (yield && !(seq % 4096))
+                std::this_thread::yield();
+        }
+        const auto elapsed = getCurrentNanos() - t0;
+        running = false;
+
+        size_t total_reads = 0;
+        size_t total_errors = 0;
+        for (size_t r = 0; r < num_readers; ++r) {
+            readers[r]->join();
+            delete readers[r];
+            total_reads += reads[r];
+            total_errors += errors[r];
+            std::cout << "reader " << r << " snapshots:" << reads[r] << " unchanged:" << skipped[r] << " errors:" << errors[r] << std::endl;
+        }
+        std::cout << "threads writes:" << writes << " ns/write:" << static_cast<double>(elapsed) / writes << " snapshots:" << total_reads << std::endl;
+        ASSERT(!total_errors, "torn or stale snapshots read.");
+        for (size_t index = 0; index < NumInstruments; ++index)
+            ASSERT(consistent(table.read(index)), "final snapshot torn.");
+    }
+
+    {
+        const std::string name = "/seqlock_example_" + std::to_string(getpid());
+        SharedMemoryObject<QuoteTable> shared(name, SharedMemoryMode::CREATE);
+        constexpr uint64_t writes = 2000000;
+
+        const auto child = fork();
+        ASSERT(child >= 0, "fork() failed.");
+        if (child == 0) {
+            //a second process with its own mapping of the table, read-only
+            SharedMemoryObject<QuoteTable> table(name, SharedMemoryMode::OPEN_READ_ONLY);
+            size_t snapshots = 0;
+            size_t errors = 0;
+            uint64_t last_version[NumInstruments] = {};
+            for (uint64_t seen = 0; seen < writes;) {
+                for (size_t index = 0; index < NumInstruments; ++index) {
+                    Quote quote;
+                    if (!table->readIfChanged(index, &quote, &last_version[index]))
+                        continue;
+                    ++snapshots;
+                    errors += !consistent(quote);
+                    seen = std::max(seen, quote.seq_);
+                }
+                if (yield)
+                    std::this_thread::yield();
+            }
+            std::cout << "process snapshots:" << snapshots << " errors:" << errors << std::endl;
+            _exit(errors ? 1 : 0);
+        }
+
+        for (uint64_t seq = 1; seq <= writes; ++seq) {
+            shared->write(seq % NumInstruments, makeQuote(seq));
+            if (yield && !(seq % 4096))
+                std::this_thread::yield();
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0, "reader process saw torn snapshots.");
+        std::cout << "process writes:" << writes << " reader ok" << std::endl;
+    }
+
+    return 0;
+}
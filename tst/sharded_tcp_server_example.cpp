@@ -0,0 +1,73 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/cpu_topology.hpp"
+#include "../src/sharded_tcp_server.hpp"
+
+//Two reactor shards on one port, connections handed off to a strategy loop on the main thread which acks each
+//message back through the shard that owns the connection.
+int main(int, char **) {
+    using namespace common;
+
+    const CpuTopology topology;
+    CorePlacementPlanner planner(topology);
+    planner.plan({"reactor-0", "reactor-1"});
+    std::cout << planner.toString();
+
+    const std::string iface = "lo";
+    const std::string ip = "127.0.0.1";
+    const int port = 12350;
+
+    ShardedTCPServer server("sharded_tcp_server_example", {planner.coreFor("reactor-0"), planner.coreFor("reactor-1")}, 1024, 4096);
+    server.listen(iface, port);
+    server.start();
+
+    Logger logger_("sharded_tcp_server_example.log");
+    std::vector<TCPSocket *> clients(8);
+    size_t acks = 0;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        clients[i] = new TCPSocket(logger_);
+        clients[i]->recv_callback_ = [&](TCPSocket *socket, Nanos) noexcept {
+            logger_.log("client socket:% got:%\n", socket->fd_, std::string(socket->rcv_buffer_, socket->next_rcv_valid_index_));
+            ++acks;
+            socket->next_rcv_valid_index_ = 0;
+        };
+        clients[i]->connect(ip, iface, port, false);
+    }
+
+    using namespace std::literals::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    for (size_t i = 0; i < clients.size(); ++i) {
+        const std::string msg = "ORDER-" + std::to_string(i);
+        clients[i]->send(msg.data(), msg.length());
+        clients[i]->sendAndRecv();
+    }
+
+    //strategy loop: drain every shard's queue, reply through the owning shard
+    const auto deadline = getCurrentNanos() + 2 * NANOS_TO_SECS;
+    while (acks < clients.size() && getCurrentNanos() < deadline) {
+        for (size_t shard_id = 0; shard_id < server.numShards(); ++shard_id) {
+            auto queue = server.handoffQueue(shard_id);
+            for (auto event = queue->getNextToRead(); queue->size() && event; event = queue->getNextToRead()) {
+                if (event->type_ == ShardEventType::DATA) {
+                    const std::string ack = "ACK " + std::string(event->data_, event->len_) + " via shard " + std::to_string(shard_id);
+                    server.send(shard_id, event->fd_, event->connection_id_, ack.data(), ack.length());
+                } else {
+                    std::cout << "shard:" << shard_id << " fd:" << event->fd_ << " connection:" << event->connection_id_ << (event->type_ == ShardEventType::CONNECTED ? " connected" : " disconnected") << std::endl;
+                }
+                queue->updateReadIndex();
+            }
+        }
+        for (auto client : clients)
+            client->sendAndRecv();
+    }
+
+    std::cout << "acks received:" << acks << "/" << clients.size() << std::endl;
+    for (size_t shard_id = 0; shard_id < server.numShards(); ++shard_id)
+        std::cout << "shard:" << shard_id << " " << server.shard(shard_id).stats_.toString() << std::endl;
+
+    for (auto client : clients)
+        delete client;
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/message_framing.hpp"
+
+struct Order {
+    uint64_t id_;
+    int64_t price_;
+    uint32_t qty_;
+    char side_;
+} __attribute__((packed));
+
+//TCPServer receiver for the statically dispatched run: onRecv() / onRecvFinished() inline into sendAndRecv()
+struct CountingServer : public common::StaticTCPServer<CountingServer> {
+    using StaticTCPServer::StaticTCPServer;
+
+    size_t bytes_ = 0;
+    size_t reads_ = 0;
+
+    auto onRecv(common::TCPSocket *socket, common::Nanos) noexcept {
+        bytes_ += socket->next_rcv_valid_index_;
+        ++reads_;
+        socket->next_rcv_valid_index_ = 0;
+    }
+
+    auto onRecvFinished() noexcept {}
+};
+
+//One small write from a raw client per poll() / sendAndRecv(), i.e. one recv callback per loop iteration.
+//Returns ns per iteration.
+template<typename Server>
+auto runServer(const common::TSCClock &tsc, Server &server, int port, size_t iterations) {
+    using namespace common;
+
+    server.listen("lo", port);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && disableNagle(fd), "client connect() failed. errno:" + std::string(strerror(errno)));
+    while (server.sockets_.empty())
+        server.poll();
+
+    const Order order{1, 100, 10, 'B'};
+    const auto t0 = rdtsc();
+    for (size_t i = 0; i < iterations; ++i) {
+        ASSERT(::send(fd, &order, sizeof(order), 0) == sizeof(order), "client send() failed.");
+        server.poll();
+        server.sendAndRecv();
+    }
+    const auto ns = tsc.ticksToNanos(rdtsc() - t0) / iterations;
+    close(fd);
+    return ns;
+}
+
+//Per-message dispatch through std::function versus handlers known at compile time.
+// - framing: MessageFramer splitting a receive buffer of fixed-size orders, message_callback_ against onRecvWith()
+//   with a lambda. No syscalls, this is the per-message cost that scales with message rate.
+// - server: TCPServer with recv_callback_ against StaticTCPServer, one read per iteration over loopback. Here the
+//   recvmsg() / epoll_wait() syscalls dominate and the dispatch saving is a small fraction.
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("static_dispatch_benchmark.log");
+    TSCClock tsc;
+
+    {
+        constexpr size_t buffer_size = 1024 * 1024;
+        constexpr size_t rounds = 300;
+        TCPSocket socket(logger_, nullptr, buffer_size, buffer_size);
+        const size_t num_orders = buffer_size / sizeof(Order);
+        for (size_t i = 0; i < num_orders; ++i) {
+            const Order order{i, static_cast<int64_t>(100 + i % 7), static_cast<uint32_t>(1 + i % 10), (i & 1) ? 'B' : 'S'};
+            memcpy(socket.rcv_buffer_ + i * sizeof(Order), &order, sizeof(Order));
+        }
+        const auto filled = num_orders * sizeof(Order);
+
+        MessageFramer<FixedSizeCodec<Order>> framer(logger_);
+        int64_t dynamic_notional = 0;
+        int64_t static_notional = 0;
+        framer.message_callback_ = [&dynamic_notional](TCPSocket *, const Order &order, Nanos) noexcept {
+            dynamic_notional += order.price_ * order.qty_;
+        };
+        auto static_handler = [&static_notional](TCPSocket *, const Order &order, Nanos) noexcept {
+            static_notional += order.price_ * order.qty_;
+        };
+
+        //alternate the two, so neither gets a warmer cache or clock
+        uint64_t dynamic_ticks = 0;
+        uint64_t static_ticks = 0;
+        for (size_t round = 0; round < rounds; ++round) {
+            socket.next_rcv_valid_index_ = filled;
+            auto t0 = rdtsc();
+            framer.onRecv(&socket, 0);
+            dynamic_ticks += rdtsc() - t0;
+
+            socket.next_rcv_valid_index_ = filled;
+            t0 = rdtsc();
+            framer.onRecvWith(&socket, 0, static_handler);
+            static_ticks += rdtsc() - t0;
+        }
+        ASSERT(dynamic_notional == static_notional && framer.messages_received_ == 2 * rounds * num_orders, "framing runs disagree.");
+
+        const auto messages = static_cast<double>(rounds * num_orders);
+        const auto dynamic_ns = tsc.ticksToNanos(dynamic_ticks) / messages;
+        const auto static_ns = tsc.ticksToNanos(static_ticks) / messages;
+        std::cout << "framing messages:" << rounds * num_orders << " std::function ns/msg:" << dynamic_ns << " static ns/msg:" << static_ns
+                  << " saved ns/msg:" << dynamic_ns - static_ns << std::endl;
+    }
+
+    {
+        constexpr size_t iterations = 20000;
+        TCPServer dynamic_server(logger_, 4);
+        size_t dynamic_bytes = 0;
+        dynamic_server.recv_callback_ = [&dynamic_bytes](TCPSocket *socket, Nanos) noexcept {
+            dynamic_bytes += socket->next_rcv_valid_index_;
+            socket->next_rcv_valid_index_ = 0;
+        };
+        dynamic_server.recv_finished_callback_ = []() noexcept {};
+        const auto dynamic_ns = runServer(tsc, dynamic_server, 12770, iterations);
+
+        CountingServer static_server(logger_, 4);
+        const auto static_ns = runServer(tsc, static_server, 12771, iterations);
+
+        ASSERT(dynamic_bytes == iterations * sizeof(Order) && static_server.bytes_ == iterations * sizeof(Order), "server runs lost bytes.");
+        std::cout << "server iterations:" << iterations << " std::function ns/iteration:" << dynamic_ns << " static ns/iteration:" << static_ns
+                  << " reads:" << static_server.reads_ << std::endl;
+    }
+
+    return 0;
+}
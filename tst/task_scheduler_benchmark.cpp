@@ -0,0 +1,103 @@
+#include "../src/task_scheduler.hpp"
+#include "../src/cpu_topology.hpp"
+#include "../src/time_utils.hpp"
+
+#include <iostream>
+#include <iomanip>
+
+//stand-in for a slice of risk recomputation, roughly a microsecond of arithmetic
+auto busyWork(uint64_t seed) noexcept
+{
+    for (int i = 0; i < 1000; ++i)
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed;
+}
+
+struct BenchResult
+{
+    common::Nanos elapsed_ = 0;
+    common::TaskSchedulerStats stats_;
+};
+
+//num_roots tasks are submitted from main, each spawns fan_out children onto its own worker's deque:
+//with fan_out > 0 idle workers only get work by stealing it
+auto runBenchmark(const std::vector<int> &cores, size_t num_roots, size_t fan_out)
+{
+    std::atomic<size_t> done = {0};
+    std::atomic<uint64_t> sink = {0};
+    BenchResult result;
+
+    common::TaskScheduler scheduler(cores, 4096, 1024);
+    const auto expected = num_roots * (1 + fan_out);
+    const auto start = common::getCurrentNanos();
+
+    for (size_t i = 0; i < num_roots; ++i)
+    {
+        auto root = [&done, &sink, fan_out, i]()
+        {
+            for (size_t j = 0; j < fan_out; ++j)
+            {
+                common::TaskScheduler::spawn([&done, &sink, i, j]()
+                {
+                    sink.fetch_add(busyWork(i * 31 + j), std::memory_order_relaxed);
+                    done.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            sink.fetch_add(busyWork(i), std::memory_order_relaxed);
+            done.fetch_add(1, std::memory_order_relaxed);
+        };
+
+        while (!scheduler.submit(root))
+            __builtin_ia32_pause();
+    }
+
+    while (done.load(std::memory_order_relaxed) < expected)
+        __builtin_ia32_pause();
+
+    result.elapsed_ = common::getCurrentNanos() - start;
+    result.stats_ = scheduler.stats();
+    return result;
+}
+
+int main(int, char **)
+{
+    using namespace common;
+
+    const CpuTopology topology;
+    //one worker per cpu at most, more would measure oversubscription rather than scaling
+    const auto max_workers = std::max<size_t>(topology.cpus().size(), 1);
+
+    constexpr size_t num_roots = 20000;
+    constexpr size_t fan_out = 7;
+
+    std::cout << "workers  elapsed_ms  tasks_per_sec  speedup  stolen  failed_steals" << std::endl;
+
+    double baseline = 0;
+    for (size_t num_workers = 1; num_workers <= max_workers; num_workers *= 2)
+    {
+        //pin to the best cpus available, main keeps submitting from wherever it runs
+        std::vector<std::string> roles;
+        for (size_t i = 0; i < num_workers; ++i)
+            roles.push_back("worker-" + std::to_string(i));
+
+        CorePlacementPlanner planner(topology);
+        std::vector<int> cores;
+        for (const auto &assignment : planner.plan(roles))
+            cores.push_back(assignment.cpu_id_);
+
+        const auto result = runBenchmark(cores, num_roots, fan_out);
+        const double secs = static_cast<double>(result.elapsed_) / NANOS_TO_SECS;
+        const double rate = static_cast<double>(num_roots * (1 + fan_out)) / secs;
+        if (num_workers == 1)
+            baseline = rate;
+
+        std::cout << std::setw(7) << num_workers
+                  << std::setw(12) << result.elapsed_ / NANO_TO_MILLIS
+                  << std::setw(15) << static_cast<uint64_t>(rate)
+                  << std::setw(9) << std::fixed << std::setprecision(2) << rate / baseline
+                  << std::setw(8) << result.stats_.stolen_
+                  << std::setw(15) << result.stats_.failed_steals_ << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sys/resource.h>
+
+//"VmRSS" / "VmSize" from /proc/self/status, in KiB
+auto readProcStatusKb(const std::string &key)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (!line.compare(0, key.size(), key))
+            return std::atol(line.c_str() + key.size() + 1);
+    return 0L;
+}
+
+//Connects clients one at a time and measures connect() -> accepted by TCPServer::poll(), then reports
+//the percentiles plus resident and virtual memory per connection.
+int main(int argc, char **argv) {
+    using namespace common;
+
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    //each connection needs two fds in this process, client and accepted side
+    const size_t max_fds_connections = (limit.rlim_cur - 64) / 2;
+    const size_t num_connections = std::min<size_t>(argc > 1 ? std::atol(argv[1]) : 10000, max_fds_connections);
+
+    Logger logger_("tcp_accept_benchmark.log");
+    const std::string iface = "lo";
+    const int port = 12347;
+
+    TCPServer server(logger_, num_connections);
+    server.listen(iface, port);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    const auto rss_before = readProcStatusKb("VmRSS:");
+    const auto vsz_before = readProcStatusKb("VmSize:");
+
+    std::vector<int> clients;
+    std::vector<Nanos> latencies;
+    clients.reserve(num_connections);
+    latencies.reserve(num_connections);
+
+    const auto start = getCurrentNanos();
+    for (size_t i = 0; i < num_connections; ++i) {
+        const auto t0 = getCurrentNanos();
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "client connect() failed. errno:" + std::string(strerror(errno)));
+        clients.push_back(fd);
+
+        while (server.sockets_.size() < i + 1)
+            server.poll();
+        latencies.push_back(getCurrentNanos() - t0);
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    const auto rss_after = readProcStatusKb("VmRSS:");
+    const auto vsz_after = readProcStatusKb("VmSize:");
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))]; };
+
+    std::cout << "connections:" << num_connections
+              << " elapsed_ms:" << elapsed / NANO_TO_MILLIS
+              << " accepts_per_sec:" << static_cast<uint64_t>(num_connections * 1e9 / elapsed) << std::endl;
+    std::cout << "connect_to_accept_ns p50:" << percentile(0.5) << " p90:" << percentile(0.9) << " p99:" << percentile(0.99)
+              << " p99.9:" << percentile(0.999) << " max:" << latencies.back() << std::endl;
+    std::cout << "rss_kb before:" << rss_before << " after:" << rss_after << " per_connection:" << (rss_after - rss_before) * 1024 / static_cast<long>(num_connections) << "B" << std::endl;
+    std::cout << "vsz_kb before:" << vsz_before << " after:" << vsz_after << " per_connection:" << (vsz_after - vsz_before) * 1024 / static_cast<long>(num_connections) << "B" << std::endl;
+    std::cout << "buffer_pool reserved_kb:" << server.buffer_pool_.bytesReserved() / 1024 << " in_use_kb:" << server.buffer_pool_.bytesInUse() / 1024 << std::endl;
+
+    for (auto fd : clients)
+        close(fd);
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+
+//A client that stops reading: the server keeps queueing replies, sees the high watermark, and once the
+//send ring overflows the connection is cut off instead of the stream being corrupted.
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("tcp_backpressure_example.log");
+    const std::string iface = "lo";
+    const std::string ip = "127.0.0.1";
+    const int port = 12346;
+
+    std::vector<char> chunk(1024 * 1024, 'x');
+    bool throttled = false;
+    size_t watermark_events = 0;
+
+    TCPServer server(logger_);
+    server.recv_callback_ = [&](TCPSocket *socket, Nanos) noexcept {
+        socket->next_rcv_valid_index_ = 0;
+        socket->send_watermark_callback_ = [&](TCPSocket *s, bool above_high_watermark) noexcept {
+            ++watermark_events;
+            throttled = above_high_watermark;
+            std::cout << "watermark socket:" << s->fd_ << " pending:" << s->pendingSendBytes() << " above_high:" << above_high_watermark << std::endl;
+        };
+    };
+    server.listen(iface, port);
+
+    TCPSocket client(logger_);
+    client.connect(ip, iface, port, false);
+
+    using namespace std::literals::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+    server.poll();
+
+    const std::string hello = "hello";
+    client.send(hello.data(), hello.length());
+    client.sendAndRecv();
+    std::this_thread::sleep_for(100ms);
+    server.poll();
+    server.sendAndRecv();
+
+    ASSERT(server.sockets_.size() == 1, "Expected one accepted connection.");
+    auto accepted = server.sockets_.front();
+
+    //ignore throttling on purpose until the ring overflows
+    size_t sent = 0;
+    while (accepted->send(chunk.data(), chunk.size())) {
+        sent += chunk.size();
+        server.poll();
+        server.sendAndRecv();
+    }
+
+    std::cout << "queued:" << sent << " pending:" << accepted->pendingSendBytes() << " throttled:" << throttled
+              << " watermark_events:" << watermark_events << " send_disconnected:" << accepted->send_disconnected_ << std::endl;
+
+    server.poll();
+    server.sendAndRecv();
+    server.poll();
+    std::cout << "server sockets after cut-off:" << server.sockets_.size() << std::endl;
+
+    return 0;
+}
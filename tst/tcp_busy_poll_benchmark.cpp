@@ -0,0 +1,75 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/thread_utils.hpp"
+
+#include <algorithm>
+
+//Loopback ping-pong against a TCPServer spinning on its own thread, once with the regular loop and once in
+//busy-poll mode. The client blocks in recv() so it does not compete with the server for a core.
+auto runPingPong(common::Logger &logger, int port, bool busy_poll, size_t round_trips) {
+    using namespace common;
+
+    TCPServer server(logger, 16);
+    server.recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+        socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+        socket->next_rcv_valid_index_ = 0;
+    };
+    server.recv_finished_callback_ = []() noexcept {};
+    server.listen("lo", port);
+    server.setBusyPollMode(busy_poll);
+
+    std::atomic<bool> running = {true};
+    auto server_thread = createAndStartThread(-1, busy_poll ? "busy_poll_server" : "regular_server", [&server, &running]() {
+        while (running.load(std::memory_order_relaxed)) {
+            server.poll();
+            server.sendAndRecv();
+        }
+    });
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "client connect() failed. errno:" + std::string(strerror(errno)));
+    disableNagle(fd);
+    if (busy_poll)
+        setBusyPoll(fd, true, 50, 64);
+
+    char msg[64] = {};
+    char reply[64];
+    std::vector<Nanos> latencies;
+    latencies.reserve(round_trips);
+    for (size_t i = 0; i < round_trips + 1000; ++i) {
+        const auto t0 = getCurrentNanos();
+        ASSERT(::send(fd, msg, sizeof(msg), 0) == sizeof(msg), "client send() failed.");
+        size_t received = 0;
+        while (received < sizeof(reply)) {
+            const auto n = ::recv(fd, reply + received, sizeof(reply) - received, 0);
+            ASSERT(n > 0, "client recv() failed.");
+            received += n;
+        }
+        if (i >= 1000) //warmup
+            latencies.push_back(getCurrentNanos() - t0);
+    }
+
+    running = false;
+    server_thread->join();
+    close(fd);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))]; };
+    std::cout << (busy_poll ? "busy_poll" : "regular  ")
+              << " rtt_ns p50:" << percentile(0.5) << " p90:" << percentile(0.9) << " p99:" << percentile(0.99) << " max:" << latencies.back()
+              << " empty_poll_ratio:" << server.emptyPollRatio() << " polls:" << server.polls_ << std::endl;
+}
+
+int main(int, char **) {
+    common::Logger logger_("tcp_busy_poll_benchmark.log");
+
+    runPingPong(logger_, 12450, false, 20000);
+    runPingPong(logger_, 12451, true, 20000);
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/tcp_client.hpp"
+
+#include <algorithm>
+#include <memory>
+
+//TCPClient with a hot standby against an echo TCPServer: fail over when the server drops the active session,
+//back off while the server is gone, reconnect once it is back, and time out connects to an address that never
+//answers. Reports client loop iteration times, which should stay far below any connect timeout (the max also
+//includes preemption when the logger thread shares the core).
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("tcp_client_reconnect_example.log");
+    const int port = 12700;
+
+    auto makeServer = [&]() {
+        auto server = std::make_unique<TCPServer>(logger_, 16);
+        server->recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+            socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+            socket->next_rcv_valid_index_ = 0;
+        };
+        server->recv_finished_callback_ = []() noexcept {};
+        server->listen("lo", port);
+        return server;
+    };
+    auto server = makeServer();
+
+    TCPClientCfg cfg;
+    cfg.ip_ = "127.0.0.1";
+    cfg.iface_ = "lo";
+    cfg.port_ = port;
+    cfg.connect_timeout_ = 200 * NANO_TO_MILLIS;
+    cfg.initial_backoff_ = 10 * NANO_TO_MILLIS;
+    cfg.max_backoff_ = 160 * NANO_TO_MILLIS;
+    cfg.hot_standby_ = true;
+    TCPClient client(logger_, cfg);
+
+    size_t echoed = 0;
+    size_t connects = 0;
+    size_t drops = 0;
+    client.recv_callback_ = [&](TCPSocket *socket, Nanos) noexcept {
+        echoed += socket->next_rcv_valid_index_;
+        socket->next_rcv_valid_index_ = 0;
+    };
+    client.connected_callback_ = [&](TCPSocket *) noexcept { ++connects; };
+    client.disconnected_callback_ = [&](TCPSocket *) noexcept { ++drops; };
+
+    std::vector<Nanos> iterations;
+    iterations.reserve(4 * 1024 * 1024);
+    auto record = [&](Nanos t0) {
+        if (iterations.size() < iterations.capacity())
+            iterations.push_back(getCurrentNanos() - t0);
+    };
+    auto spin = [&](auto done, Nanos timeout) {
+        const auto end = getCurrentNanos() + timeout;
+        while (!done() && getCurrentNanos() < end) {
+            const auto t0 = getCurrentNanos();
+            client.poll();
+            client.sendAndRecv();
+            record(t0);
+            if (server) {
+                server->poll();
+                server->sendAndRecv();
+            }
+        }
+        return done();
+    };
+    auto bothConnected = [&]() {
+        return client.session(0).state_ == TCPClientState::CONNECTED && client.session(1).state_ == TCPClientState::CONNECTED;
+    };
+    auto ping = [&]() {
+        const auto before = echoed;
+        ASSERT(client.send("ping", 4), "send() on the active session failed.");
+        return spin([&]() { return echoed >= before + 4; }, 1000 * NANO_TO_MILLIS);
+    };
+
+    client.start();
+    ASSERT(spin(bothConnected, 1000 * NANO_TO_MILLIS), "active and standby sessions did not connect.");
+    ASSERT(ping(), "no echo on the first session.");
+    std::cout << "connected active and standby, connects:" << connects << std::endl;
+
+    //the server drops the active session: find it by the client's local port
+    sockaddr_in local{};
+    socklen_t len = sizeof(local);
+    getsockname(client.activeSocket()->fd_, reinterpret_cast<sockaddr *>(&local), &len);
+    for (auto socket : server->sockets_) {
+        sockaddr_in peer{};
+        len = sizeof(peer);
+        getpeername(socket->fd_, reinterpret_cast<sockaddr *>(&peer), &len);
+        if (peer.sin_port == local.sin_port)
+            server->disconnected_sockets_.add(socket);
+    }
+    const auto active_before = client.activeSocket();
+    ASSERT(spin([&]() { return client.activeSocket() != active_before; }, 1000 * NANO_TO_MILLIS), "no failover to the standby session.");
+    ASSERT(ping(), "no echo after failover.");
+    ASSERT(spin(bothConnected, 1000 * NANO_TO_MILLIS), "dropped session did not reconnect as standby.");
+    std::cout << "failed over to standby, failovers:" << client.failovers_ << " drops:" << drops << " connects:" << connects << std::endl;
+
+    //the server goes away: both sessions drop and back off while connects are refused
+    server.reset();
+    spin([]() { return false; }, 500 * NANO_TO_MILLIS);
+    std::cout << "server down, state:" << tcpClientStateToString(client.state())
+              << " attempts:" << client.session(0).connect_attempts_ << "/" << client.session(1).connect_attempts_
+              << " backoff_ms:" << client.session(0).backoff_ / NANO_TO_MILLIS << std::endl;
+    ASSERT(!client.isConnected(), "client still connected without a server.");
+
+    const auto restart = getCurrentNanos();
+    server = makeServer();
+    ASSERT(spin([&]() { return client.isConnected(); }, 2000 * NANO_TO_MILLIS), "client did not reconnect.");
+    std::cout << "server back, reconnected after ms:" << (getCurrentNanos() - restart) / NANO_TO_MILLIS << std::endl;
+    ASSERT(ping(), "no echo after reconnect.");
+
+    //an address nobody answers: connects time out (or fail right away without a route) and back off
+    TCPClientCfg blackhole_cfg = cfg;
+    blackhole_cfg.ip_ = "192.0.2.123";
+    blackhole_cfg.iface_ = "";
+    blackhole_cfg.connect_timeout_ = 100 * NANO_TO_MILLIS;
+    blackhole_cfg.hot_standby_ = false;
+    TCPClient blackhole(logger_, blackhole_cfg);
+    blackhole.start();
+    const auto blackhole_end = getCurrentNanos() + 600 * NANO_TO_MILLIS;
+    while (getCurrentNanos() < blackhole_end) {
+        const auto t0 = getCurrentNanos();
+        blackhole.poll();
+        blackhole.sendAndRecv();
+        record(t0);
+    }
+    std::cout << "unreachable peer, state:" << tcpClientStateToString(blackhole.state()) << " attempts:" << blackhole.session(0).connect_attempts_ << std::endl;
+    ASSERT(!blackhole.isConnected() && blackhole.session(0).connect_attempts_ > 1, "unreachable peer was not retried.");
+
+    std::sort(iterations.begin(), iterations.end());
+    std::cout << "client loop iteration ns p50:" << iterations[iterations.size() / 2] << " p99.9:" << iterations[iterations.size() * 999 / 1000]
+              << " max:" << iterations.back() << std::endl;
+
+    return 0;
+}
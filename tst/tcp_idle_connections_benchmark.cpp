@@ -0,0 +1,94 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+
+#include <algorithm>
+#include <sys/resource.h>
+
+//Thousands of connected but silent clients plus a few hot ones doing echo round trips.
+//With O(1) bookkeeping the server loop cost and hot round trip latency should not grow with the idle count.
+auto runBenchmark(common::Logger &logger, int port, size_t num_idle, size_t num_hot, size_t round_trips) {
+    using namespace common;
+
+    TCPServer server(logger, num_idle + num_hot);
+    server.recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+        socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+        socket->next_rcv_valid_index_ = 0;
+    };
+    server.recv_finished_callback_ = []() noexcept {};
+    server.listen("lo", port);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    std::vector<int> clients;
+    for (size_t i = 0; i < num_idle + num_hot; ++i) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "client connect() failed. errno:" + std::string(strerror(errno)));
+        disableNagle(fd);
+        clients.push_back(fd);
+        while (server.sockets_.size() < i + 1)
+            server.poll();
+    }
+
+    //empty loop iterations: nothing ready, only bookkeeping and one epoll_wait()
+    constexpr size_t idle_loops = 100000;
+    auto start = getCurrentNanos();
+    for (size_t i = 0; i < idle_loops; ++i) {
+        server.poll();
+        server.sendAndRecv();
+    }
+    const auto idle_loop_ns = (getCurrentNanos() - start) / static_cast<Nanos>(idle_loops);
+
+    char msg[64] = {};
+    char reply[64];
+    std::vector<Nanos> latencies;
+    latencies.reserve(round_trips);
+    for (size_t i = 0; i < round_trips; ++i) {
+        const int fd = clients[num_idle + i % num_hot];
+        const auto t0 = getCurrentNanos();
+        ASSERT(::send(fd, msg, sizeof(msg), 0) == sizeof(msg), "client send() failed.");
+
+        size_t received = 0;
+        while (received < sizeof(reply)) {
+            server.poll();
+            server.sendAndRecv();
+            const auto n = recv(fd, reply + received, sizeof(reply) - received, MSG_DONTWAIT);
+            if (n > 0)
+                received += n;
+        }
+        latencies.push_back(getCurrentNanos() - t0);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))]; };
+    std::cout << "idle:" << num_idle << " hot:" << num_hot
+              << " empty_loop_ns:" << idle_loop_ns
+              << " rtt_ns p50:" << percentile(0.5) << " p99:" << percentile(0.99) << " max:" << latencies.back() << std::endl;
+
+    for (auto fd : clients)
+        close(fd);
+}
+
+int main(int, char **) {
+    using namespace common;
+
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    const size_t max_connections = (limit.rlim_cur - 64) / 2;
+
+    Logger logger_("tcp_idle_connections_benchmark.log");
+
+    int port = 12400;
+    for (size_t num_idle : {0, 1000, 4000, 8000}) {
+        if (num_idle + 8 > max_connections)
+            break;
+        runBenchmark(logger_, port++, num_idle, 8, 20000);
+    }
+
+    return 0;
+}
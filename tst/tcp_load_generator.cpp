@@ -0,0 +1,86 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+#include "../src/tcp_load_generator.hpp"
+
+#include <atomic>
+#include <thread>
+#include <sys/resource.h>
+
+//Capacity test of TCPServer as production runs it: the server echoes on its own thread, TCPLoadGenerator drives
+//thousands of client connections from this one.
+//  tcp_load_generator [open|closed|both] [connections] [message_size] [rate msgs/s | in_flight] [seconds]
+//Open loop sends rate requests per second over all connections, closed loop keeps in_flight requests outstanding
+//per connection. Prints corrected and uncorrected round trip histograms, throughput and per-connection fairness.
+int main(int argc, char **argv) {
+    using namespace common;
+
+    const std::string mode = argc > 1 ? argv[1] : "both";
+    const size_t connections = argc > 2 ? std::stoul(argv[2]) : 1000;
+    const size_t message_size = argc > 3 ? std::stoul(argv[3]) : 64;
+    const double rate_or_in_flight = argc > 4 ? std::stod(argv[4]) : 0;
+    const double seconds = argc > 5 ? std::stod(argv[5]) : 2;
+    ASSERT(mode == "open" || mode == "closed" || mode == "both", "mode must be open, closed or both, not " + mode);
+
+    //client and server end of every connection live in this process
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    ASSERT(connections * 2 + 64 <= limit.rlim_cur, "not enough file descriptors for " + std::to_string(connections) + " connections.");
+
+    //Logger is single producer: one for the server thread, one for the generator
+    Logger server_logger("tcp_load_generator_server.log");
+    Logger client_logger("tcp_load_generator_client.log");
+
+    int port = 12800;
+    auto run = [&](LoadMode load_mode) {
+        TCPServer server(server_logger, connections, 4 * 1024);
+        server.recv_callback_ = [](TCPSocket *socket, Nanos) noexcept {
+            socket->send(socket->rcv_buffer_, socket->next_rcv_valid_index_);
+            socket->next_rcv_valid_index_ = 0;
+        };
+        server.recv_finished_callback_ = []() noexcept {};
+        server.listen("lo", port);
+
+        std::atomic<bool> running = {true};
+        const auto yield = std::thread::hardware_concurrency() < 2;
+        auto server_thread = createAndStartThread(-1, "load/server", [&]() {
+            while (running) {
+                server.poll();
+                server.sendAndRecv();
+                if (yield)
+                    std::this_thread::yield();
+            }
+        });
+        ASSERT(server_thread, "server thread failed to start.");
+
+        LoadGeneratorCfg cfg;
+        cfg.port_ = port++;
+        cfg.connections_ = connections;
+        cfg.message_size_ = message_size;
+        cfg.mode_ = load_mode;
+        if (load_mode == LoadMode::OPEN_LOOP && rate_or_in_flight > 0)
+            cfg.rate_ = rate_or_in_flight;
+        if (load_mode == LoadMode::CLOSED_LOOP && rate_or_in_flight > 0)
+            cfg.in_flight_ = static_cast<size_t>(rate_or_in_flight);
+        cfg.duration_ = static_cast<Nanos>(seconds * NANOS_TO_SECS);
+
+        TCPLoadGenerator generator(client_logger, cfg);
+        const auto connected = generator.connect();
+        std::cout << "connected " << connected << " of " << connections << std::endl;
+        if (connected)
+            std::cout << generator.run().toString() << std::endl;
+
+        running = false;
+        server_thread->join();
+        delete server_thread;
+    };
+
+    if (mode != "closed")
+        run(LoadMode::OPEN_LOOP);
+    if (mode != "open")
+        run(LoadMode::CLOSED_LOOP);
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_server.hpp"
+
+#include <algorithm>
+
+//Loopback ping-pong between a TCPSocket client and a TCPServer, both with nanosecond receive timestamps and send
+//timestamps enabled. Reports wire -> recv callback on the server and recv callback -> wire for its replies, matched
+//to the reply by stream offset.
+int main(int, char **) {
+    using namespace common;
+
+    Logger logger_("tcp_timestamping_example.log");
+    const std::string iface = "lo";
+    const std::string ip = "127.0.0.1";
+    const int port = 12550;
+    constexpr size_t msg_size = 64;
+    constexpr size_t round_trips = 10000;
+
+    std::vector<Nanos> wire_to_callback;
+    std::vector<Nanos> callback_to_wire;
+    //stream offset of the last byte of every reply -> time its recv callback started
+    std::vector<std::pair<uint64_t, Nanos>> replies;
+    size_t next_reply = 0;
+    wire_to_callback.reserve(round_trips);
+    callback_to_wire.reserve(round_trips);
+    replies.reserve(round_trips);
+
+    TCPServer server(logger_, 16);
+    server.tx_timestamps_ = true;
+    server.recv_callback_ = [&](TCPSocket *socket, Nanos rx_time) noexcept {
+        const auto callback_time = getCurrentNanos();
+        if (rx_time)
+            wire_to_callback.push_back(callback_time - rx_time);
+        while (socket->next_rcv_valid_index_ >= msg_size) {
+            socket->send(socket->rcv_buffer_, msg_size);
+            replies.emplace_back(socket->bytesQueued() - 1, callback_time);
+            memmove(socket->rcv_buffer_, socket->rcv_buffer_ + msg_size, socket->next_rcv_valid_index_ - msg_size);
+            socket->next_rcv_valid_index_ -= msg_size;
+        }
+    };
+    server.recv_finished_callback_ = []() noexcept {};
+    //one send timestamp covers every reply up to last_byte
+    server.tx_timestamp_callback_ = [&](TCPSocket *, uint64_t last_byte, Nanos tx_time) noexcept {
+        for (; next_reply < replies.size() && replies[next_reply].first <= last_byte; ++next_reply)
+            callback_to_wire.push_back(tx_time - replies[next_reply].second);
+    };
+    server.listen(iface, port);
+
+    TCPSocket client(logger_);
+    client.connect(ip, iface, port, false);
+    size_t client_received = 0;
+    client.recv_callback_ = [&](TCPSocket *socket, Nanos) noexcept {
+        client_received += socket->next_rcv_valid_index_;
+        socket->next_rcv_valid_index_ = 0;
+    };
+
+    while (server.sockets_.empty())
+        server.poll();
+
+    char msg[msg_size] = {};
+    for (size_t i = 0; i < round_trips; ++i) {
+        client.send(msg, sizeof(msg));
+        while (client_received < (i + 1) * msg_size) {
+            client.sendAndRecv();
+            server.poll();
+            server.sendAndRecv();
+        }
+    }
+    //late send timestamps
+    for (int i = 0; i < 1000 && next_reply < replies.size(); ++i)
+        server.poll();
+
+    std::sort(wire_to_callback.begin(), wire_to_callback.end());
+    std::sort(callback_to_wire.begin(), callback_to_wire.end());
+    auto percentile = [](const std::vector<Nanos> &v, double p) { return v.empty() ? 0 : v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))]; };
+
+    std::cout << "round_trips:" << round_trips << " rx_stamps:" << wire_to_callback.size() << " tx_stamped_replies:" << callback_to_wire.size() << std::endl;
+    std::cout << "wire_to_callback_ns p50:" << percentile(wire_to_callback, 0.5) << " p99:" << percentile(wire_to_callback, 0.99) << std::endl;
+    std::cout << "callback_to_wire_ns p50:" << percentile(callback_to_wire, 0.5) << " p99:" << percentile(callback_to_wire, 0.99) << std::endl;
+
+    ASSERT(!wire_to_callback.empty() && !callback_to_wire.empty(), "no kernel timestamps received.");
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "../src/time_utils.hpp"
+#include "../src/logger.hpp"
+#include "../src/tcp_socket.hpp"
+#include "../src/thread_utils.hpp"
+
+#include <atomic>
+#include <ctime>
+
+auto threadCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<common::Nanos>(ts.tv_sec) * common::NANOS_TO_SECS + ts.tv_nsec;
+}
+
+//Streams total_bytes of payload_size payloads from a TCPSocket to a plain blocking reader thread over loopback,
+//either copied through send() or handed to sendZeroCopy() with MSG_ZEROCOPY. Reports throughput and the sending
+//thread's CPU time per MiB. A payload buffer is only reused after zerocopy_release_callback_ returned it.
+auto runStream(common::Logger &logger, int port, bool zerocopy, size_t payload_size, size_t total_bytes) {
+    using namespace common;
+
+    const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ASSERT(bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && ::listen(listen_fd, 1) == 0, "bind()/listen() failed. errno:" + std::string(strerror(errno)));
+
+    std::atomic<size_t> received = {0};
+    auto reader = createAndStartThread(-1, "zerocopy_reader", [listen_fd, total_bytes, &received]() {
+        const int fd = accept(listen_fd, nullptr, nullptr);
+        std::vector<char> buffer(4 * 1024 * 1024);
+        size_t bytes = 0;
+        while (bytes < total_bytes) {
+            const auto n = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (n <= 0)
+                break;
+            bytes += n;
+        }
+        received = bytes;
+        close(fd);
+    });
+
+    TCPSocket sender(logger);
+    sender.connect("127.0.0.1", "lo", port, false);
+    const bool zerocopy_enabled = zerocopy && sender.enableZeroCopy(0);
+
+    constexpr size_t num_payloads = 16;
+    std::vector<std::vector<char>> payloads(num_payloads, std::vector<char>(payload_size, 'z'));
+    std::vector<const void *> free_payloads;
+    for (auto &payload : payloads)
+        free_payloads.push_back(payload.data());
+    sender.zerocopy_release_callback_ = [&free_payloads](TCPSocket *, const void *data, size_t) noexcept {
+        free_payloads.push_back(data);
+    };
+
+    const auto cpu_start = threadCpuNanos();
+    const auto start = getCurrentNanos();
+    size_t queued = 0;
+    while (queued < total_bytes || sender.pendingSendBytes()) {
+        //keep a few payloads in flight, the copying path would otherwise grow the send ring without bound
+        if (queued < total_bytes && !free_payloads.empty() && sender.pendingSendBytes() < 4 * payload_size) {
+            const auto payload = free_payloads.back();
+            free_payloads.pop_back();
+            if (zerocopy)
+                sender.sendZeroCopy(payload, payload_size);
+            else {
+                sender.send(payload, payload_size);
+                free_payloads.push_back(payload);
+            }
+            queued += payload_size;
+        }
+        sender.flush();
+        if (zerocopy_enabled)
+            sender.readErrQueue();
+        ASSERT(!sender.send_disconnected_, "sender was disconnected.");
+    }
+    while (received < total_bytes)
+        if (zerocopy_enabled)
+            sender.readErrQueue();
+    const auto elapsed = getCurrentNanos() - start;
+    const auto cpu = threadCpuNanos() - cpu_start;
+
+    //every payload comes back once the kernel is done with it
+    while (zerocopy_enabled && free_payloads.size() < num_payloads)
+        sender.readErrQueue();
+
+    reader->join();
+    delete reader;
+    close(listen_fd);
+
+    const auto mib = static_cast<double>(total_bytes) / (1024 * 1024);
+    std::cout << (zerocopy ? "zerocopy" : "copy    ") << " payload:" << payload_size / 1024 << "KiB"
+              << " MiB/s:" << static_cast<uint64_t>(mib * 1e9 / elapsed)
+              << " sender_cpu_ns_per_MiB:" << static_cast<uint64_t>(cpu / mib)
+              << " zerocopy_sends:" << sender.zerocopy_sends_ << " kernel_copied:" << sender.zerocopy_copied_
+              << " fallbacks:" << sender.zerocopy_fallbacks_ << std::endl;
+}
+
+int main(int, char **) {
+    common::Logger logger_("tcp_zerocopy_benchmark.log");
+
+    //loopback cannot hand pages to the receiver, the kernel copies them on delivery and reports
+    //SO_EE_CODE_ZEROCOPY_COPIED, so expect little gain here compared to a real NIC
+    int port = 12600;
+    for (size_t payload_size : {16 * 1024, 256 * 1024, 1024 * 1024}) {
+        runStream(logger_, port++, false, payload_size, 2048UL * 1024 * 1024);
+        runStream(logger_, port++, true, payload_size, 2048UL * 1024 * 1024);
+    }
+
+    return 0;
+}
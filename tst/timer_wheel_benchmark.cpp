@@ -0,0 +1,142 @@
+#include "../src/time_utils.hpp"
+#include "../src/timer_wheel.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+//callbacks capture this and a timer index only, so they fit std::function's inline storage
+struct FireStats {
+    const std::vector<common::Nanos> *expiries_;
+    size_t fired_ = 0;
+    size_t early_ = 0;
+    common::Nanos max_late_ = 0;
+};
+
+auto percentile(std::vector<uint64_t> &samples, double p) {
+    return samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+}
+
+//TimerWheel with millions of pending timers on a simulated clock, costs measured with the TSC: schedule, reschedule
+//and cancel per operation, then tick() while the wheel drains, then periodic heartbeats re-armed from their callbacks.
+//Every timer is checked to fire no earlier than its expiry and no later than one tick plus one step.
+int main(int, char **) {
+    using namespace common;
+
+    TSCClock tsc;
+    std::cout << "tsc_ghz:" << tsc.ghz() << std::endl;
+
+    {
+        constexpr size_t reads = 10 * 1000 * 1000;
+        Nanos sink = 0;
+        auto t0 = rdtsc();
+        for (size_t i = 0; i < reads; ++i)
+            sink += getCurrentNanos();
+        const auto system_clock = tsc.ticksToNanos(rdtsc() - t0) / reads;
+        t0 = rdtsc();
+        for (size_t i = 0; i < reads; ++i)
+            sink += tsc.nanos();
+        const auto tsc_clock = tsc.ticksToNanos(rdtsc() - t0) / reads;
+        std::cout << "clock read ns getCurrentNanos:" << system_clock << " TSCClock::nanos:" << tsc_clock << (sink ? "" : " ") << std::endl;
+    }
+
+    constexpr size_t num_timers = 4 * 1000 * 1000;
+    constexpr Nanos tick_size = NANOS_TO_MICROS;
+    constexpr Nanos horizon = 60 * NANOS_TO_SECS;
+    constexpr Nanos step = 100 * NANOS_TO_MICROS;
+
+    //pool headroom keeps MemoryPool's free block scan short
+    TimerWheel wheel(num_timers + num_timers / 4, tick_size, 0);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<Nanos> expiry_dist(1, horizon);
+    std::uniform_int_distribution<size_t> index_dist(0, num_timers - 1);
+    std::vector<TimerId> ids(num_timers);
+    std::vector<Nanos> expiries(num_timers);
+    for (auto &expiry : expiries)
+        expiry = expiry_dist(rng);
+
+    FireStats stats{&expiries};
+    auto callback = [&stats](size_t index) {
+        return [stats = &stats, index](TimerId, Nanos now) {
+            const auto expiry = (*stats->expiries_)[index];
+            ++stats->fired_;
+            if (now < expiry)
+                ++stats->early_;
+            stats->max_late_ = std::max(stats->max_late_, now - expiry);
+        };
+    };
+
+    auto t0 = rdtsc();
+    for (size_t i = 0; i < num_timers; ++i)
+        ids[i] = wheel.schedule(expiries[i], callback(i));
+    std::cout << "schedule timers:" << num_timers << " ns/op:" << tsc.ticksToNanos(rdtsc() - t0) / num_timers << std::endl;
+    ASSERT(wheel.pending() == num_timers, "not every timer was scheduled.");
+
+    constexpr size_t num_ops = 1000 * 1000;
+    std::vector<size_t> targets(num_ops);
+    for (auto &target : targets)
+        target = index_dist(rng);
+    std::vector<Nanos> new_expiries(num_ops);
+    for (auto &expiry : new_expiries)
+        expiry = expiry_dist(rng);
+
+    t0 = rdtsc();
+    for (size_t i = 0; i < num_ops; ++i)
+        wheel.reschedule(ids[targets[i]], new_expiries[i]);
+    std::cout << "reschedule ops:" << num_ops << " ns/op:" << tsc.ticksToNanos(rdtsc() - t0) / num_ops << std::endl;
+    for (size_t i = 0; i < num_ops; ++i)
+        expiries[targets[i]] = new_expiries[i];
+
+    for (auto &target : targets)
+        target = index_dist(rng);
+    size_t cancelled = 0;
+    t0 = rdtsc();
+    for (size_t i = 0; i < num_ops; ++i)
+        cancelled += wheel.cancel(ids[targets[i]]);
+    std::cout << "cancel ops:" << num_ops << " cancelled:" << cancelled << " ns/op:" << tsc.ticksToNanos(rdtsc() - t0) / num_ops << std::endl;
+    ASSERT(!wheel.cancel(ids[targets[0]]), "cancelled timer cancelled twice.");
+
+    //drain: one tick() per simulated step, with millions still pending for most of the run
+    std::vector<uint64_t> tick_ticks;
+    tick_ticks.reserve(horizon / step + 1);
+    const auto drain_start = rdtsc();
+    for (Nanos now = step; now <= horizon + step; now += step) {
+        t0 = rdtsc();
+        wheel.tick(now);
+        tick_ticks.push_back(rdtsc() - t0);
+    }
+    const auto drain = tsc.ticksToNanos(rdtsc() - drain_start);
+    std::sort(tick_ticks.begin(), tick_ticks.end());
+    std::cout << "drain ticks:" << tick_ticks.size() << " fired:" << stats.fired_ << " cascaded:" << wheel.cascaded_
+              << " ns/fired:" << drain / stats.fired_
+              << " tick() ns p50:" << tsc.ticksToNanos(percentile(tick_ticks, 0.5)) << " p99:" << tsc.ticksToNanos(percentile(tick_ticks, 0.99))
+              << " p99.9:" << tsc.ticksToNanos(percentile(tick_ticks, 0.999)) << " max:" << tsc.ticksToNanos(tick_ticks.back())
+              << " max_late_us:" << stats.max_late_ / NANOS_TO_MICROS << std::endl;
+    ASSERT(stats.fired_ + cancelled == num_timers && !wheel.pending(), "timers lost: fired " + std::to_string(stats.fired_));
+    ASSERT(!stats.early_ && stats.max_late_ < step + tick_size, "timer fired outside its window.");
+
+    //heartbeats: every timer re-arms itself from its callback
+    {
+        constexpr size_t num_heartbeats = 10 * 1000;
+        constexpr Nanos interval = NANO_TO_MILLIS;
+        constexpr Nanos run = NANOS_TO_SECS;
+        constexpr Nanos heartbeat_step = 10 * NANOS_TO_MICROS;
+        const auto start = wheel.now();
+        size_t beats = 0;
+        for (size_t i = 0; i < num_heartbeats; ++i) {
+            wheel.scheduleAfter(static_cast<Nanos>(1 + i * interval / num_heartbeats), [&wheel, &beats](TimerId id, Nanos) {
+                ++beats;
+                wheel.rescheduleAfter(id, interval);
+            });
+        }
+        t0 = rdtsc();
+        for (Nanos now = start + heartbeat_step; now <= start + run; now += heartbeat_step)
+            wheel.tick(now);
+        const auto elapsed = tsc.ticksToNanos(rdtsc() - t0);
+        std::cout << "heartbeats:" << num_heartbeats << " beats:" << beats << " ns/beat:" << elapsed / beats << " pending:" << wheel.pending() << std::endl;
+        ASSERT(wheel.pending() == num_heartbeats && beats >= num_heartbeats * (run / interval - 1), "heartbeats missed.");
+    }
+
+    return 0;
+}